@@ -0,0 +1,259 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/BufferPool>
+#include <vpb/BuildLog>
+
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace vpb;
+
+BufferPool::BufferPool():
+    _maxNumBytes(256*1024*1024),
+    _numBytes(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    clear();
+}
+
+unsigned int BufferPool::computeSizeClass(unsigned int numBytes)
+{
+    if (numBytes<=4096) return 4096;
+
+    // classes are an eighth of a power of two apart, so at most 12.5% of a buffer is wasted.
+    unsigned int powerOfTwo = 4096;
+    while(powerOfTwo<numBytes) powerOfTwo <<= 1;
+
+    unsigned int granularity = osg::maximum(4096u, powerOfTwo/8);
+    return ((numBytes+granularity-1)/granularity)*granularity;
+}
+
+void BufferPool::setMaximumNumBytes(unsigned long long maxNumBytes)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _maxNumBytes = maxNumBytes;
+    trim();
+}
+
+void BufferPool::trim()
+{
+    // free the largest buffers first, they're the least likely to be asked for again.
+    while(_numBytes>_maxNumBytes && !_freeBuffers.empty())
+    {
+        FreeBufferMap::iterator itr = _freeBuffers.end();
+        --itr;
+
+        free(itr->second.back());
+        itr->second.pop_back();
+        _numBytes -= itr->first;
+
+        if (itr->second.empty()) _freeBuffers.erase(itr);
+    }
+
+    while(_numBytes>_maxNumBytes && !_freeFloatArrays.empty())
+    {
+        FreeFloatArrayMap::iterator itr = _freeFloatArrays.end();
+        --itr;
+
+        itr->second.pop_back();
+        _numBytes -= itr->first*sizeof(float);
+
+        if (itr->second.empty()) _freeFloatArrays.erase(itr);
+    }
+}
+
+void BufferPool::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    for(FreeBufferMap::iterator itr = _freeBuffers.begin();
+        itr != _freeBuffers.end();
+        ++itr)
+    {
+        for(Buffers::iterator bitr = itr->second.begin();
+            bitr != itr->second.end();
+            ++bitr)
+        {
+            free(*bitr);
+        }
+    }
+
+    _freeBuffers.clear();
+    _freeFloatArrays.clear();
+    _numBytes = 0;
+}
+
+unsigned char* BufferPool::acquireBuffer(unsigned int numBytes, bool zero)
+{
+    unsigned int sizeClass = computeSizeClass(numBytes);
+
+    unsigned char* buffer = 0;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+        ++_statistics.numAcquired;
+
+        FreeBufferMap::iterator itr = _freeBuffers.find(sizeClass);
+        if (itr != _freeBuffers.end())
+        {
+            buffer = itr->second.back();
+            itr->second.pop_back();
+            if (itr->second.empty()) _freeBuffers.erase(itr);
+
+            _numBytes -= sizeClass;
+            ++_statistics.numReused;
+        }
+    }
+
+    if (buffer)
+    {
+        if (zero) memset(buffer, 0, numBytes);
+    }
+    else
+    {
+        // fresh pages from the system are already zero, so calloc avoids a second pass over the memory.
+        buffer = static_cast<unsigned char*>(zero ? calloc(sizeClass, 1) : malloc(sizeClass));
+        if (!buffer) return 0;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _bufferSizes[buffer] = sizeClass;
+
+    return buffer;
+}
+
+void BufferPool::releaseBuffer(unsigned char* buffer)
+{
+    if (!buffer) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    BufferSizeMap::iterator itr = _bufferSizes.find(buffer);
+    if (itr == _bufferSizes.end())
+    {
+        log(osg::WARN,"BufferPool::releaseBuffer() buffer not allocated by the pool.");
+        return;
+    }
+
+    unsigned int sizeClass = itr->second;
+    _bufferSizes.erase(itr);
+
+    _freeBuffers[sizeClass].push_back(buffer);
+    _numBytes += sizeClass;
+
+    trim();
+}
+
+osg::FloatArray* BufferPool::acquireFloatArray(unsigned int num, bool zero)
+{
+    osg::ref_ptr<osg::FloatArray> array;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+        ++_statistics.numAcquired;
+
+        FreeFloatArrayMap::iterator itr = _freeFloatArrays.find(num);
+        if (itr != _freeFloatArrays.end())
+        {
+            array = itr->second.back();
+            itr->second.pop_back();
+            if (itr->second.empty()) _freeFloatArrays.erase(itr);
+
+            _numBytes -= num*sizeof(float);
+            ++_statistics.numReused;
+        }
+    }
+
+    if (array.valid())
+    {
+        if (zero) std::fill(array->begin(), array->end(), 0.0f);
+    }
+    else
+    {
+        array = new osg::FloatArray(num);
+    }
+
+    return array.release();
+}
+
+void BufferPool::recycleHeightField(osg::HeightField* heightField)
+{
+    osg::FloatArray* array = heightField ? heightField->getFloatArray() : 0;
+    if (!array || array->referenceCount()!=1 || array->empty()) return;
+
+    unsigned int num = array->size();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _freeFloatArrays[num].push_back(array);
+    _numBytes += num*sizeof(float);
+
+    trim();
+}
+
+BufferPool::Statistics BufferPool::getStatistics() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    Statistics statistics = _statistics;
+    statistics.numBytes = _numBytes;
+    return statistics;
+}
+
+void BufferPool::reportStatistics() const
+{
+    Statistics statistics = getStatistics();
+    double reuseRatio = statistics.numAcquired>0 ? double(statistics.numReused)/double(statistics.numAcquired) : 0.0;
+
+    log(osg::NOTICE,"Buffer pool: acquired=%llu reused=%llu (reuse ratio %.1f%%) held=%lluMB",
+        statistics.numAcquired, statistics.numReused, reuseRatio*100.0, statistics.numBytes/(1024*1024));
+}
+
+PooledImage::PooledImage(BufferPool* pool, int s, int t, GLenum pixelFormat, GLenum type, bool zero):
+    _pool(pool),
+    _pooledData(0)
+{
+    unsigned int numBytes = osg::Image::computeRowWidthInBytes(s, pixelFormat, type, 1) * t;
+    _pooledData = _pool->acquireBuffer(numBytes, zero);
+    if (!_pooledData)
+    {
+        // fall back to the image's own allocation.
+        allocateImage(s, t, 1, pixelFormat, type);
+        if (zero && data()) memset(data(), 0, getTotalSizeInBytes());
+        return;
+    }
+
+    // the image never frees the buffer itself, so it can't be freed behind the pool's back when the data is replaced.
+    setImage(s, t, 1, pixelFormat, pixelFormat, type, _pooledData, osg::Image::NO_DELETE, 1);
+}
+
+bool PooledImage::releaseReplacedData()
+{
+    if (!_pooledData || data()==_pooledData) return false;
+
+    _pool->releaseBuffer(_pooledData);
+    _pooledData = 0;
+    return true;
+}
+
+PooledImage::~PooledImage()
+{
+    // nothing can use the buffer once the image has gone, whether or not it's still the image's data.
+    if (_pooledData) _pool->releaseBuffer(_pooledData);
+}
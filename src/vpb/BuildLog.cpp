@@ -353,3 +353,39 @@ void BuildLog::report(std::ostream& out)
 }
 
 
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// ProgressReport
+//
+ProgressReport::ProgressReport(const std::string& name, unsigned int numItems):
+    _name(name),
+    _numItems(numItems),
+    _numCompleted(0),
+    _startTick(osg::Timer::instance()->tick())
+{
+}
+
+void ProgressReport::completed(const std::string& item)
+{
+    unsigned int numCompleted;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        numCompleted = ++_numCompleted;
+    }
+
+    double elapsed = osg::Timer::instance()->delta_s(_startTick, osg::Timer::instance()->tick());
+    double percent = _numItems>0 ? 100.0*double(numCompleted)/double(_numItems) : 100.0;
+
+    // assume the remaining items take as long on average as those already completed.
+    double remaining = numCompleted<_numItems ? elapsed*double(_numItems-numCompleted)/double(numCompleted) : 0.0;
+
+    log(osg::NOTICE,"%s: completed %u of %u (%.1f%%) %s, elapsed %.1fs, estimated remaining %.1fs",
+        _name.c_str(), numCompleted, _numItems, percent, item.c_str(), elapsed, remaining);
+}
+
+unsigned int ProgressReport::getNumCompleted() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _numCompleted;
+}
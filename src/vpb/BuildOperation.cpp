@@ -19,6 +19,7 @@ using namespace vpb;
 BuildOperation::BuildOperation(ThreadPool* threadPool, BuildLog* buildLog, const std::string& name, bool keep):
     osg::Operation(name,keep),
     _threadPool(threadPool),
+    _affinityHint(-1),
     _buildLog(buildLog)
 {
     _log = new OperationLog();
@@ -31,8 +32,6 @@ BuildOperation::BuildOperation(ThreadPool* threadPool, BuildLog* buildLog, const
 
 void BuildOperation::operator () (osg::Object*)
 {
-    if (_threadPool) _threadPool->runningOperation(this);
-
     pushOperationLog(_log.get());
 
     if (_buildLog.valid())
@@ -46,8 +45,5 @@ void BuildOperation::operator () (osg::Object*)
     if (_buildLog.valid()) _buildLog->completedOperation(this);
     
     popOperationLog();
-
-    if (_threadPool) _threadPool->completedOperation(this);
-
 }
 
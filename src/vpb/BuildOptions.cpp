@@ -15,6 +15,8 @@
 
 #include <osgDB/FileNameUtils>
 
+#include <OpenThreads/Thread>
+
 using namespace vpb;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -93,6 +95,14 @@ BuildOptions::BuildOptions()
     _archiveName = "";
     _buildOverlays = false;
     _reprojectSources = true;
+    _virtualReprojection = false;
+    _reprojectionNumThreads = 0;
+    _reprojectionWarpMemory = 0;
+    _reprojectionErrorThreshold = 0.0f;
+    _reprojectionCompression = "PACKBITS";
+    _reprojectionPredictor = 0;
+    _reprojectionNumConcurrentSources = 0;
+    _overviewNumConcurrentSources = 0;
     _generateTiles = true;
     _comment = "";
     _convertFromGeographicToGeocentric = false;
@@ -100,6 +110,7 @@ BuildOptions::BuildOptions()
     _decorateWithCoordinateSystemNode = true;
     _decorateWithMultiTextureControl = true;
     _useInterpolatedTerrainSampling = true;
+    _bottomUpPyramid = false;
     _destinationCoordinateSystemString = "";
     _destinationCoordinateSystem = new osg::CoordinateSystemNode;
     _destinationCoordinateSystem->setEllipsoidModel(new osg::EllipsoidModel);
@@ -114,6 +125,7 @@ BuildOptions::BuildOptions()
     _maximumVisiableDistanceOfTopLevel = 1e10;
     _radiusToMaxVisibleDistanceRatio = 7.0f;
     _simplifyTerrain = true;
+    _optimizeTileGeometry = false;
     _skirtRatio = 0.02f;
     _tileBasename = "output";
     _tileExtension = ".osgb";
@@ -134,6 +146,9 @@ BuildOptions::BuildOptions()
     
     _numReadThreadsToCoresRatio = 0.0f;
     _numWriteThreadsToCoresRatio = 0.0f;
+
+    _sourceBlockCacheSize = 256;
+    _memoryBudget = 0;
     
     _layerInheritance = INHERIT_NEAREST_AVAILABLE;
     
@@ -151,6 +166,11 @@ BuildOptions::BuildOptions()
     
     _compressionMethod = GL_DRIVER;
     _compressionQuality = FASTEST;
+    _compressionNumThreads = 1;
+    _mipMapMethod = CPU_MIPMAPS;
+    _mipMapFilter = BOX_FILTER;
+    _mipMapLinearLight = false;
+    _mipMapNumThreads = 1;
 
 }
 
@@ -177,6 +197,14 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     _archiveName = rhs._archiveName;
     _buildOverlays = rhs._buildOverlays;
     _reprojectSources = rhs._reprojectSources;
+    _virtualReprojection = rhs._virtualReprojection;
+    _reprojectionNumThreads = rhs._reprojectionNumThreads;
+    _reprojectionWarpMemory = rhs._reprojectionWarpMemory;
+    _reprojectionErrorThreshold = rhs._reprojectionErrorThreshold;
+    _reprojectionCompression = rhs._reprojectionCompression;
+    _reprojectionPredictor = rhs._reprojectionPredictor;
+    _reprojectionNumConcurrentSources = rhs._reprojectionNumConcurrentSources;
+    _overviewNumConcurrentSources = rhs._overviewNumConcurrentSources;
     _generateTiles = rhs._generateTiles;
     _comment = rhs._comment;
     _convertFromGeographicToGeocentric = rhs._convertFromGeographicToGeocentric;
@@ -184,6 +212,7 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     _decorateWithCoordinateSystemNode = rhs._decorateWithCoordinateSystemNode;
     _decorateWithMultiTextureControl = rhs._decorateWithMultiTextureControl;
     _useInterpolatedTerrainSampling = rhs._useInterpolatedTerrainSampling;
+    _bottomUpPyramid = rhs._bottomUpPyramid;
     _destinationCoordinateSystemString = rhs._destinationCoordinateSystemString;
     _destinationCoordinateSystem = rhs._destinationCoordinateSystem;
     _directory = rhs._directory;
@@ -198,6 +227,7 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     _maximumVisiableDistanceOfTopLevel = rhs._maximumVisiableDistanceOfTopLevel;
     _radiusToMaxVisibleDistanceRatio = rhs._radiusToMaxVisibleDistanceRatio;
     _simplifyTerrain = rhs._simplifyTerrain;
+    _optimizeTileGeometry = rhs._optimizeTileGeometry;
     _skirtRatio = rhs._skirtRatio;
     _tileBasename = rhs._tileBasename;
     _tileExtension = rhs._tileExtension;
@@ -217,6 +247,9 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     
     _numReadThreadsToCoresRatio = rhs._numReadThreadsToCoresRatio;
     _numWriteThreadsToCoresRatio = rhs._numWriteThreadsToCoresRatio;
+
+    _sourceBlockCacheSize = rhs._sourceBlockCacheSize;
+    _memoryBudget = rhs._memoryBudget;
     
     _buildOptionsString = rhs._buildOptionsString;
     _writeOptionsString = rhs._writeOptionsString;
@@ -238,6 +271,12 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     _blendingPolicy = rhs._blendingPolicy;
 
     _compressionMethod = rhs._compressionMethod;
+    _compressionQuality = rhs._compressionQuality;
+    _compressionNumThreads = rhs._compressionNumThreads;
+    _mipMapMethod = rhs._mipMapMethod;
+    _mipMapFilter = rhs._mipMapFilter;
+    _mipMapLinearLight = rhs._mipMapLinearLight;
+    _mipMapNumThreads = rhs._mipMapNumThreads;
     
     _imageOptions.clear();
     for(unsigned int i=0; i< rhs.getNumLayerImageOptions(); ++i)
@@ -347,6 +386,7 @@ bool BuildOptions::compatible(BuildOptions& rhs) const
     if (_decorateWithCoordinateSystemNode != rhs._decorateWithCoordinateSystemNode) return false;
     if (_decorateWithMultiTextureControl != rhs._decorateWithMultiTextureControl) return false;
     if (_useInterpolatedTerrainSampling != rhs._useInterpolatedTerrainSampling) return false;
+    if (_bottomUpPyramid != rhs._bottomUpPyramid) return false;
     if (_destinationCoordinateSystemString != rhs._destinationCoordinateSystemString) return false;
     if (_directory != rhs._directory) return false;
     if (_outputTaskDirectories != rhs._outputTaskDirectories) return false;
@@ -364,6 +404,7 @@ bool BuildOptions::compatible(BuildOptions& rhs) const
     if (_tileBasename != rhs._tileBasename) return false;
     if (_tileExtension != rhs._tileExtension) return false;
     if (_useLocalTileTransform != rhs._useLocalTileTransform) return false;
+    if (_optimizeTileGeometry != rhs._optimizeTileGeometry) return false;
     if (_verticalScale != rhs._verticalScale) return false;
     if (_writeNodeBeforeSimplification != rhs._writeNodeBeforeSimplification) return false;
     if (_distributedBuildSplitLevel != rhs._distributedBuildSplitLevel) return false;
@@ -412,6 +453,24 @@ bool BuildOptions::compatible(BuildOptions& rhs) const
     return true;
 }
 
+unsigned int BuildOptions::computeNumConcurrentReprojections() const
+{
+    if (_reprojectionNumConcurrentSources>0) return _reprojectionNumConcurrentSources;
+
+    // each reprojection may itself warp with several threads, so share the processors out between them.
+    unsigned int numProcessors = osg::maximum(OpenThreads::GetNumberOfProcessors(), 1);
+    return osg::maximum(numProcessors / osg::maximum(_reprojectionNumThreads, 1u), 1u);
+}
+
+unsigned int BuildOptions::computeNumConcurrentOverviewBuilds() const
+{
+    if (_overviewNumConcurrentSources>0) return _overviewNumConcurrentSources;
+
+    // overview builds stream through whole files, more than a few at a time just contend for the disk.
+    unsigned int numProcessors = osg::maximum(OpenThreads::GetNumberOfProcessors(), 1);
+    return osg::minimum(numProcessors, 4u);
+}
+
 void BuildOptions::setLayerImageOptions(unsigned int layerNum, vpb::ImageOptions* imageOptions)
 {
     if (layerNum>=_imageOptions.size())
@@ -287,10 +287,19 @@ public:
         
         VPB_ADD_BOOL_PROPERTY(BuildOverlays);
         VPB_ADD_BOOL_PROPERTY(ReprojectSources);
+        VPB_ADD_BOOL_PROPERTY(VirtualReprojection);
+        VPB_ADD_UINT_PROPERTY(ReprojectionNumThreads);
+        VPB_ADD_UINT_PROPERTY(ReprojectionWarpMemory);
+        VPB_ADD_FLOAT_PROPERTY(ReprojectionErrorThreshold);
+        VPB_ADD_STRING_PROPERTY(ReprojectionCompression);
+        VPB_ADD_UINT_PROPERTY(ReprojectionPredictor);
+        VPB_ADD_UINT_PROPERTY(ReprojectionNumConcurrentSources);
+        VPB_ADD_UINT_PROPERTY(OverviewNumConcurrentSources);
         VPB_ADD_BOOL_PROPERTY(GenerateTiles);
         VPB_ADD_BOOL_PROPERTY(ConvertFromGeographicToGeocentric);
         VPB_ADD_BOOL_PROPERTY(UseLocalTileTransform);
         VPB_ADD_BOOL_PROPERTY(SimplifyTerrain);
+        VPB_ADD_BOOL_PROPERTY(OptimizeTileGeometry);
         VPB_ADD_BOOL_PROPERTY(DecorateGeneratedSceneGraphWithCoordinateSystemNode);
         VPB_ADD_BOOL_PROPERTY(DecorateGeneratedSceneGraphWithMultiTextureControl);
         VPB_ADD_BOOL_PROPERTY(WriteNodeBeforeSimplification);
@@ -299,6 +308,7 @@ public:
         
         VPB_ADD_BOOL_PROPERTY(UseInterpolatedImagerySampling);
         VPB_ADD_BOOL_PROPERTY(UseInterpolatedTerrainSampling);
+        VPB_ADD_BOOL_PROPERTY(BottomUpPyramid);
         
         VPB_ADD_STRING_PROPERTY(DestinationCoordinateSystem);
         VPB_ADD_STRING_PROPERTY(DestinationCoordinateSystemFormat);
@@ -327,6 +337,8 @@ public:
         
         VPB_ADD_FLOAT_PROPERTY(NumReadThreadsToCoresRatio);
         VPB_ADD_FLOAT_PROPERTY(NumWriteThreadsToCoresRatio);
+        VPB_ADD_UINT_PROPERTY(SourceBlockCacheSize);
+        VPB_ADD_UINT_PROPERTY(MemoryBudget);
 
         VPB_ADD_STRING_PROPERTY(BuildOptionsString);
         VPB_ADD_STRING_PROPERTY(WriteOptionsString);
@@ -358,7 +370,14 @@ public:
             VPB_AEV(ENABLE_BLENDING_WHEN_ALPHA_PRESENT);
         }
 
-        VPB_ADD_ENUM_PROPERTY_THREE_VALUES(CompressionMethod, GL_DRIVER, NVTT, NVTT_NOCUDA)
+        { VPB_AEP(CompressionMethod); VPB_AEV(GL_DRIVER); VPB_AEV(NVTT); VPB_AEV(NVTT_NOCUDA); VPB_AEV(CPU); }
+
+        VPB_ADD_UINT_PROPERTY(CompressionNumThreads);
+
+        VPB_ADD_ENUM_PROPERTY_TWO_VALUES(MipMapMethod, CPU_MIPMAPS, COMPRESSOR_MIPMAPS)
+        VPB_ADD_ENUM_PROPERTY_THREE_VALUES(MipMapFilter, BOX_FILTER, KAISER_FILTER, LANCZOS_FILTER)
+        VPB_ADD_BOOL_PROPERTY(MipMapLinearLight);
+        VPB_ADD_UINT_PROPERTY(MipMapNumThreads);
 
     }
 
@@ -600,12 +619,22 @@ REGISTER_OBJECT_WRAPPER( BuildOptions,
     ADD_FLOAT_SERIALIZER( SkirtRatio, 0.02f);
 
     ADD_BOOL_SERIALIZER( UseInterpolatedTerrainSampling, true);
+    ADD_BOOL_SERIALIZER( BottomUpPyramid, false);
     ADD_BOOL_SERIALIZER( BuildOverlays, false);
     ADD_BOOL_SERIALIZER( ReprojectSources, true);
+    ADD_BOOL_SERIALIZER( VirtualReprojection, false);
+    ADD_UINT_SERIALIZER( ReprojectionNumThreads, 0);
+    ADD_UINT_SERIALIZER( ReprojectionWarpMemory, 0);
+    ADD_FLOAT_SERIALIZER( ReprojectionErrorThreshold, 0.0f);
+    ADD_STRING_SERIALIZER( ReprojectionCompression, "PACKBITS");
+    ADD_UINT_SERIALIZER( ReprojectionPredictor, 0);
+    ADD_UINT_SERIALIZER( ReprojectionNumConcurrentSources, 0);
+    ADD_UINT_SERIALIZER( OverviewNumConcurrentSources, 0);
     ADD_BOOL_SERIALIZER( GenerateTiles, true);
     ADD_BOOL_SERIALIZER( ConvertFromGeographicToGeocentric, false);
     ADD_BOOL_SERIALIZER( UseLocalTileTransform, true);
     ADD_BOOL_SERIALIZER( SimplifyTerrain, true);
+    ADD_BOOL_SERIALIZER( OptimizeTileGeometry, false);
 
     ADD_BOOL_SERIALIZER( DecorateGeneratedSceneGraphWithCoordinateSystemNode, true);
     ADD_BOOL_SERIALIZER( DecorateGeneratedSceneGraphWithMultiTextureControl, true);
@@ -648,6 +677,8 @@ REGISTER_OBJECT_WRAPPER( BuildOptions,
     ADD_BOOL_SERIALIZER( DisableWrites, false);
     ADD_FLOAT_SERIALIZER( NumReadThreadsToCoresRatio, 0.0f);
     ADD_FLOAT_SERIALIZER( NumWriteThreadsToCoresRatio, 0.0f);
+    ADD_UINT_SERIALIZER( SourceBlockCacheSize, 256);
+    ADD_UINT_SERIALIZER( MemoryBudget, 0);
 
     ADD_STRING_SERIALIZER( BuildOptionsString, "");
     ADD_STRING_SERIALIZER( WriteOptionsString, "");
@@ -700,6 +731,7 @@ REGISTER_OBJECT_WRAPPER( BuildOptions,
         ADD_ENUM_VALUE( GL_DRIVER );
         ADD_ENUM_VALUE( NVTT );
         ADD_ENUM_VALUE( NVTT_NOCUDA);        
+        ADD_ENUM_VALUE( CPU );
     END_ENUM_SERIALIZER();
 
     BEGIN_ENUM_SERIALIZER( CompressionQuality, FASTEST);
@@ -709,6 +741,22 @@ REGISTER_OBJECT_WRAPPER( BuildOptions,
         ADD_ENUM_VALUE( HIGHEST );
     END_ENUM_SERIALIZER();   
 
+    ADD_UINT_SERIALIZER( CompressionNumThreads, 1);
+
+    BEGIN_ENUM_SERIALIZER( MipMapMethod, CPU_MIPMAPS);
+        ADD_ENUM_VALUE( CPU_MIPMAPS );
+        ADD_ENUM_VALUE( COMPRESSOR_MIPMAPS );
+    END_ENUM_SERIALIZER();
+
+    BEGIN_ENUM_SERIALIZER( MipMapFilter, BOX_FILTER);
+        ADD_ENUM_VALUE( BOX_FILTER );
+        ADD_ENUM_VALUE( KAISER_FILTER );
+        ADD_ENUM_VALUE( LANCZOS_FILTER );
+    END_ENUM_SERIALIZER();
+
+    ADD_BOOL_SERIALIZER( MipMapLinearLight, false);
+    ADD_UINT_SERIALIZER( MipMapNumThreads, 1);
+
     ADD_USER_SERIALIZER( DestinationExtents );
 
     ADD_USER_SERIALIZER( LayerImageOptions );
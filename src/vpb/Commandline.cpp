@@ -532,6 +532,7 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--raster","Interpret input as a raster data set (default).");
     usage.addCommandLineOption("--max-visible-distance-of-top-level","Set the maximum visible distance that the top most tile can be viewed at.");
     usage.addCommandLineOption("--no-terrain-simplification","Switch off terrain simplification.");
+    usage.addCommandLineOption("--optimize-geometry","Reorder the triangles and vertices of terrain tiles for the GPU vertex cache, merging skirts into the same 16 bit index list where possible.");
     usage.addCommandLineOption("--default-color <r,g,b,a>","Sets the default color of the terrain.");
     usage.addCommandLineOption("--radius-to-max-visible-distance-ratio","Set the maximum visible distance ratio for all tiles apart from the top most tile. The maximum visuble distance is computed from the ratio * tile radius.");
     usage.addCommandLineOption("--no-mip-mapping","Disable mip mapping of textures.");
@@ -554,6 +555,14 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--zt","");
     usage.addCommandLineOption("--BuildOverlays [True/False]","Switch on/off the building of overlay within the source imagery. Overlays can help reduce texture aliasing artificats.");
     usage.addCommandLineOption("--ReprojectSources [True/False]","Switch on/off the reprojection of any source imagery that aren't in the correct projection for the database build.");
+    usage.addCommandLineOption("--virtual-reprojection","Reproject raster sources on the fly as tiles are read from them, rather than writing reprojected temporary files before the build.");
+    usage.addCommandLineOption("--reproject-threads <num>","Set the number of threads used to warp each reprojected source, 0 warps in a single thread.");
+    usage.addCommandLineOption("--reproject-warp-memory <MB>","Set the memory in megabytes the warper may use for each chunk of a reprojected source, 0 for GDAL's default.");
+    usage.addCommandLineOption("--reproject-error-threshold <pixels>","Set the maximum error in pixels when approximating the reprojection transform, 0 transforms every pixel exactly.");
+    usage.addCommandLineOption("--reproject-compression <method>","Set the GeoTIFF compression of reprojected sources, i.e. PACKBITS, LZW, DEFLATE or NONE.");
+    usage.addCommandLineOption("--reproject-predictor <num>","Set the GeoTIFF predictor used with LZW/DEFLATE compression of reprojected sources, 0 for none.");
+    usage.addCommandLineOption("--reproject-concurrency <num>","Set the number of sources reprojected at the same time, 0 chooses from the number of processors and --reproject-threads.");
+    usage.addCommandLineOption("--overview-concurrency <num>","Set the number of sources that have overviews built at the same time, 0 chooses up to 4.");
     usage.addCommandLineOption("--GenerateTiles [True/False]","Switch on/off the generation of the output database tiles.");
     usage.addCommandLineOption("--version","Print out version.");
     usage.addCommandLineOption("--version-number","Print out version number only.");
@@ -574,9 +583,13 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--terrain-mask","Set the overall mask to assign terrain.");
     usage.addCommandLineOption("--read-threads-ratio <ratio>","Set the ratio number of read threads relative to number of cores to use.");
     usage.addCommandLineOption("--write-threads-ratio <ratio>","Set the ratio number of write threads relative to number of cores to use.");
+    usage.addCommandLineOption("--block-cache-size <MB>","Set the size in megabytes of the cache of decoded source blocks, 0 disables the cache.");
+    usage.addCommandLineOption("--memory-budget <MB>","Set the budget in megabytes for tile image and height field data, reading of new tiles is held back while it's exceeded. 0 for no limit.");
     usage.addCommandLineOption("--build-options <string>","Set build options string.");
     usage.addCommandLineOption("--interpolate-terrain","Enable the use of interpolation when sampling data from source DEMs.");
     usage.addCommandLineOption("--no-interpolate-terrain","Disable the use of interpolation when sampling data from source DEMs.");
+    usage.addCommandLineOption("--bottom-up-pyramid","Build each tile straight after its children, downsampling it from them rather than reading the sources again.");
+    usage.addCommandLineOption("--no-bottom-up-pyramid","Build from the top level downwards, reading every level from the sources.");
     usage.addCommandLineOption("--interpolate-imagery","Enable the use of interpolation when sampling data from source imagery.");
     usage.addCommandLineOption("--no-interpolate-imagery","Disable the use of interpolation when sampling data from source imagery.");
     usage.addCommandLineOption("--abort-task-on-error","Hint to osgdem to abort the build when any errors occur (default).");
@@ -596,10 +609,17 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--compressor-gl-driver", "Use the OpenGL driver to compress output imagery.");
     usage.addCommandLineOption("--compressor-nvtt", "Use NVTT to compress output imagery, using CUDA if possible.");
     usage.addCommandLineOption("--compressor-nvtt-nocuda", "Use NVTT to compress output imagery, disabling CUDA.");    
-    usage.addCommandLineOption("--compression-quality-fastest", "Uses the 'fastest' quality setting when using NVVT to compress textures.");    
-    usage.addCommandLineOption("--compression-quality-normal", "Uses the 'normal' quality setting when using NVVT to compress textures.");    
-    usage.addCommandLineOption("--compression-quality-production", "Uses the 'production' quality setting when using NVVT to compress textures.");    
-    usage.addCommandLineOption("--compression-quality-highest", "Uses the 'highest' quality setting when using NVVT to compress textures.");    
+    usage.addCommandLineOption("--compressor-cpu", "Use VPB's built in DXT encoder to compress output imagery, no graphics context required.");
+    usage.addCommandLineOption("--compressor-threads <num>", "Set the number of threads each texture is compressed with when using --compressor-cpu.");
+    usage.addCommandLineOption("--mipmap-cpu", "Generate the mipmaps of imagery on the CPU with VPB's own filtered generator, the default.  Compressing with NVTT still uses NVTT's mipmaps.");
+    usage.addCommandLineOption("--mipmap-compressor", "Leave generating the mipmaps of imagery to the OpenGL driver or NVTT, as selected by the compressor options.");
+    usage.addCommandLineOption("--mipmap-filter <filter>", "Set the filter used to generate mipmaps on the CPU.  <filter> can be BOX_FILTER, KAISER_FILTER or LANCZOS_FILTER.");
+    usage.addCommandLineOption("--mipmap-linear-light", "Treat the colour channels of imagery as sRGB and generate CPU mipmaps in linear light.");
+    usage.addCommandLineOption("--mipmap-threads <num>", "Set the number of threads each texture's mipmaps are generated with on the CPU.");
+    usage.addCommandLineOption("--compression-quality-fastest", "Uses the 'fastest' quality setting when using NVVT or the CPU compressor to compress textures.");    
+    usage.addCommandLineOption("--compression-quality-normal", "Uses the 'normal' quality setting when using NVVT or the CPU compressor to compress textures.");    
+    usage.addCommandLineOption("--compression-quality-production", "Uses the 'production' quality setting when using NVVT or the CPU compressor to compress textures.");    
+    usage.addCommandLineOption("--compression-quality-highest", "Uses the 'highest' quality setting when using NVVT or the CPU compressor to compress textures.");    
 }
 
 bool Commandline::readImageOptions(int pos, std::ostream& fout, osg::ArgumentParser& arguments, vpb::ImageOptions& imageOptions)
@@ -754,6 +774,29 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
     while(arguments.read("--ReprojectSources",flag)) { buildOptions->setReprojectSources(flag); }
     while(arguments.read("--ReprojectSources")) { buildOptions->setReprojectSources(true); }
 
+    while(arguments.read("--virtual-reprojection")) { buildOptions->setVirtualReprojection(true); }
+
+    unsigned int reprojectionNumThreads = 0;
+    while(arguments.read("--reproject-threads",reprojectionNumThreads)) { buildOptions->setReprojectionNumThreads(reprojectionNumThreads); }
+
+    unsigned int reprojectionWarpMemory = 0;
+    while(arguments.read("--reproject-warp-memory",reprojectionWarpMemory)) { buildOptions->setReprojectionWarpMemory(reprojectionWarpMemory); }
+
+    float reprojectionErrorThreshold = 0.0f;
+    while(arguments.read("--reproject-error-threshold",reprojectionErrorThreshold)) { buildOptions->setReprojectionErrorThreshold(reprojectionErrorThreshold); }
+
+    std::string reprojectionCompression;
+    while(arguments.read("--reproject-compression",reprojectionCompression)) { buildOptions->setReprojectionCompression(reprojectionCompression); }
+
+    unsigned int reprojectionPredictor = 0;
+    while(arguments.read("--reproject-predictor",reprojectionPredictor)) { buildOptions->setReprojectionPredictor(reprojectionPredictor); }
+
+    unsigned int reprojectionNumConcurrentSources = 0;
+    while(arguments.read("--reproject-concurrency",reprojectionNumConcurrentSources)) { buildOptions->setReprojectionNumConcurrentSources(reprojectionNumConcurrentSources); }
+
+    unsigned int overviewNumConcurrentSources = 0;
+    while(arguments.read("--overview-concurrency",overviewNumConcurrentSources)) { buildOptions->setOverviewNumConcurrentSources(overviewNumConcurrentSources); }
+
     while(arguments.read("--GenerateTiles",flag)) { buildOptions->setGenerateTiles(flag); }
     while(arguments.read("--GenerateTiles")) { buildOptions->setGenerateTiles(true); }
 
@@ -801,6 +844,10 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
     {
       buildOptions->setCompressionMethod(vpb::BuildOptions::NVTT_NOCUDA);      
     }
+    while(arguments.read("--compressor-cpu"))
+    {
+      buildOptions->setCompressionMethod(vpb::BuildOptions::CPU);
+    }
     while(arguments.read("--compressor-gl-driver"))
     {
       buildOptions->setCompressionMethod(vpb::BuildOptions::GL_DRIVER);      
@@ -822,6 +869,25 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
     {
       buildOptions->setCompressionQuality(vpb::BuildOptions::HIGHEST);      
     }
+
+    unsigned int compressionNumThreads = 1;
+    while(arguments.read("--compressor-threads",compressionNumThreads)) { buildOptions->setCompressionNumThreads(compressionNumThreads); }
+
+    while(arguments.read("--mipmap-cpu")) { buildOptions->setMipMapMethod(vpb::BuildOptions::CPU_MIPMAPS); }
+    while(arguments.read("--mipmap-compressor")) { buildOptions->setMipMapMethod(vpb::BuildOptions::COMPRESSOR_MIPMAPS); }
+
+    std::string mipMapFilter;
+    while(arguments.read("--mipmap-filter", mipMapFilter))
+    {
+        if (mipMapFilter == "BOX_FILTER") buildOptions->setMipMapFilter(vpb::BuildOptions::BOX_FILTER);
+        else if (mipMapFilter == "KAISER_FILTER") buildOptions->setMipMapFilter(vpb::BuildOptions::KAISER_FILTER);
+        else if (mipMapFilter == "LANCZOS_FILTER") buildOptions->setMipMapFilter(vpb::BuildOptions::LANCZOS_FILTER);
+    }
+
+    while(arguments.read("--mipmap-linear-light")) { buildOptions->setMipMapLinearLight(true); }
+
+    unsigned int mipMapNumThreads = 1;
+    while(arguments.read("--mipmap-threads",mipMapNumThreads)) { buildOptions->setMipMapNumThreads(mipMapNumThreads); }
     
 
     std::string notifyLevel;
@@ -845,6 +911,16 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
         buildOptions->setUseInterpolatedTerrainSampling(false);
     }
 
+    while(arguments.read("--bottom-up-pyramid"))
+    {
+        buildOptions->setBottomUpPyramid(true);
+    }
+
+    while(arguments.read("--no-bottom-up-pyramid"))
+    {
+        buildOptions->setBottomUpPyramid(false);
+    }
+
 
     std::string buildname;
     while (arguments.read("--ibn",buildname))
@@ -942,6 +1018,11 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
         buildOptions->setSimplifyTerrain(false);
     }
 
+    while (arguments.read("--optimize-geometry"))
+    {
+        buildOptions->setOptimizeTileGeometry(true);
+    }
+
     while (arguments.read("--geocentric"))
     {
         buildOptions->setConvertFromGeographicToGeocentric(true);
@@ -986,6 +1067,12 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
     while(arguments.read("--read-threads-ratio",ratio)) { buildOptions->setNumReadThreadsToCoresRatio(ratio); }
     while(arguments.read("--write-threads-ratio",ratio)) { buildOptions->setNumWriteThreadsToCoresRatio(ratio); }
 
+    unsigned int blockCacheSize = 0;
+    while(arguments.read("--block-cache-size",blockCacheSize)) { buildOptions->setSourceBlockCacheSize(blockCacheSize); }
+
+    unsigned int memoryBudget = 0;
+    while(arguments.read("--memory-budget",memoryBudget)) { buildOptions->setMemoryBudget(memoryBudget); }
+
     std::string inheritance;
     while (arguments.read("--layer-inheritance",inheritance) )
     {
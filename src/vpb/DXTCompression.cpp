@@ -0,0 +1,641 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/DXTCompression>
+
+#include <osg/Math>
+
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include <math.h>
+
+using namespace vpb;
+
+namespace
+{
+
+// The 16 texels of a 4x4 block, in row order, kept in fixed size arrays so the per texel loops can be vectorized by the compiler.
+struct Block
+{
+    float           colours[16][3];
+    unsigned char   alphas[16];
+};
+
+inline int clampComponent(float v, int maxValue)
+{
+    int i = int(v*float(maxValue)/255.0f+0.5f);
+    return i<0 ? 0 : (i>maxValue ? maxValue : i);
+}
+
+inline unsigned int packRGB565(const float* rgb)
+{
+    return (clampComponent(rgb[0],31)<<11) | (clampComponent(rgb[1],63)<<5) | clampComponent(rgb[2],31);
+}
+
+inline void unpackRGB565(unsigned int c, float* rgb)
+{
+    unsigned int r = (c>>11) & 31;
+    unsigned int g = (c>>5) & 63;
+    unsigned int b = c & 31;
+    rgb[0] = float((r<<3) | (r>>2));
+    rgb[1] = float((g<<2) | (g>>4));
+    rgb[2] = float((b<<3) | (b>>2));
+}
+
+inline void clampPoint(float* p)
+{
+    for(unsigned int c=0; c<3; ++c) p[c] = p[c]<0.0f ? 0.0f : (p[c]>255.0f ? 255.0f : p[c]);
+}
+
+// the weight of endpoint 0 for each index, as the decoder interpolates them.
+const float s_fourColourWeights[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+const float s_threeColourWeights[4] = { 1.0f, 0.0f, 0.5f, 0.0f };
+
+struct ColourFit
+{
+    unsigned int    c0;
+    unsigned int    c1;
+    unsigned int    indices[16];
+    float           error;
+};
+
+// quantize the endpoints, then pick each texel's index from the palette the decoder will build from them.
+void evaluateEndpoints(const Block& block, const bool* transparent, bool threeColourMode, bool dxt1,
+                       const float* endpoint0, const float* endpoint1, ColourFit& fit)
+{
+    unsigned int c0 = packRGB565(endpoint0);
+    unsigned int c1 = packRGB565(endpoint1);
+
+    // DXT1 selects the three colour mode, with transparency, by the order of the endpoints, DXT3/5 always use four colours.
+    if (threeColourMode)
+    {
+        if (c0>c1) { unsigned int tmp = c0; c0 = c1; c1 = tmp; }
+    }
+    else
+    {
+        if (c0<c1) { unsigned int tmp = c0; c0 = c1; c1 = tmp; }
+    }
+
+    bool decodeThreeColour = dxt1 && c0<=c1;
+
+    float palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for(unsigned int c=0; c<3; ++c)
+    {
+        if (decodeThreeColour)
+        {
+            palette[2][c] = (palette[0][c]+palette[1][c])*0.5f;
+            palette[3][c] = 0.0f;
+        }
+        else
+        {
+            palette[2][c] = (2.0f*palette[0][c]+palette[1][c])/3.0f;
+            palette[3][c] = (palette[0][c]+2.0f*palette[1][c])/3.0f;
+        }
+    }
+
+    unsigned int numColours = decodeThreeColour ? 3 : 4;
+
+    fit.c0 = c0;
+    fit.c1 = c1;
+    fit.error = 0.0f;
+
+    for(unsigned int i=0; i<16; ++i)
+    {
+        if (transparent[i])
+        {
+            fit.indices[i] = 3;
+            continue;
+        }
+
+        float distances[4];
+        for(unsigned int p=0; p<4; ++p)
+        {
+            float dr = block.colours[i][0]-palette[p][0];
+            float dg = block.colours[i][1]-palette[p][1];
+            float db = block.colours[i][2]-palette[p][2];
+            distances[p] = dr*dr + dg*dg + db*db;
+        }
+
+        unsigned int best = 0;
+        for(unsigned int p=1; p<numColours; ++p)
+        {
+            if (distances[p]<distances[best]) best = p;
+        }
+
+        fit.indices[i] = best;
+        fit.error += distances[best];
+    }
+}
+
+void computeBoundingBoxEndpoints(const float (*points)[3], unsigned int numPoints, float* endpoint0, float* endpoint1)
+{
+    float minPoint[3] = { 255.0f, 255.0f, 255.0f };
+    float maxPoint[3] = { 0.0f, 0.0f, 0.0f };
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for(unsigned int i=0; i<numPoints; ++i)
+    {
+        for(unsigned int c=0; c<3; ++c)
+        {
+            minPoint[c] = osg::minimum(minPoint[c], points[i][c]);
+            maxPoint[c] = osg::maximum(maxPoint[c], points[i][c]);
+            mean[c] += points[i][c];
+        }
+    }
+
+    // inset the box a little as the extremes are rarely worth reaching exactly.
+    for(unsigned int c=0; c<3; ++c)
+    {
+        mean[c] /= float(numPoints);
+        float inset = (maxPoint[c]-minPoint[c])/16.0f;
+        minPoint[c] += inset;
+        maxPoint[c] -= inset;
+    }
+
+    // pick the diagonal of the box that follows the colours, using the sign of red and blue's covariance with green.
+    float covarianceRG = 0.0f;
+    float covarianceBG = 0.0f;
+    for(unsigned int i=0; i<numPoints; ++i)
+    {
+        covarianceRG += (points[i][0]-mean[0])*(points[i][1]-mean[1]);
+        covarianceBG += (points[i][2]-mean[2])*(points[i][1]-mean[1]);
+    }
+    if (covarianceRG<0.0f) std::swap(minPoint[0], maxPoint[0]);
+    if (covarianceBG<0.0f) std::swap(minPoint[2], maxPoint[2]);
+
+    for(unsigned int c=0; c<3; ++c)
+    {
+        endpoint0[c] = maxPoint[c];
+        endpoint1[c] = minPoint[c];
+    }
+}
+
+void computePrincipalAxisEndpoints(const float (*points)[3], unsigned int numPoints, float* endpoint0, float* endpoint1)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for(unsigned int i=0; i<numPoints; ++i)
+    {
+        for(unsigned int c=0; c<3; ++c) mean[c] += points[i][c];
+    }
+    for(unsigned int c=0; c<3; ++c) mean[c] /= float(numPoints);
+
+    // covariance xx, xy, xz, yy, yz, zz
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for(unsigned int i=0; i<numPoints; ++i)
+    {
+        float dx = points[i][0]-mean[0];
+        float dy = points[i][1]-mean[1];
+        float dz = points[i][2]-mean[2];
+        cov[0] += dx*dx; cov[1] += dx*dy; cov[2] += dx*dz;
+        cov[3] += dy*dy; cov[4] += dy*dz; cov[5] += dz*dz;
+    }
+
+    // power iteration for the dominant eigenvector of the covariance, starting from the row of the channel that varies most.
+    unsigned int row = (cov[0]>=cov[3] && cov[0]>=cov[5]) ? 0 : (cov[3]>=cov[5] ? 1 : 2);
+    float axis[3];
+    axis[0] = row==0 ? cov[0] : (row==1 ? cov[1] : cov[2]);
+    axis[1] = row==0 ? cov[1] : (row==1 ? cov[3] : cov[4]);
+    axis[2] = row==0 ? cov[2] : (row==1 ? cov[4] : cov[5]);
+    for(unsigned int iteration=0; iteration<8; ++iteration)
+    {
+        float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+        float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+        float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+        float largest = osg::maximum(fabsf(x), osg::maximum(fabsf(y), fabsf(z)));
+        if (largest<1e-6f) break;
+        axis[0] = x/largest; axis[1] = y/largest; axis[2] = z/largest;
+    }
+
+    float length2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+    if (length2<1e-12f)
+    {
+        // all the colours are the same.
+        for(unsigned int c=0; c<3; ++c) endpoint0[c] = endpoint1[c] = mean[c];
+        return;
+    }
+
+    float minT = 0.0f, maxT = 0.0f;
+    for(unsigned int i=0; i<numPoints; ++i)
+    {
+        float t = ((points[i][0]-mean[0])*axis[0] + (points[i][1]-mean[1])*axis[1] + (points[i][2]-mean[2])*axis[2])/length2;
+        if (i==0 || t<minT) minT = t;
+        if (i==0 || t>maxT) maxT = t;
+    }
+
+    for(unsigned int c=0; c<3; ++c)
+    {
+        endpoint0[c] = mean[c] + maxT*axis[c];
+        endpoint1[c] = mean[c] + minT*axis[c];
+    }
+    clampPoint(endpoint0);
+    clampPoint(endpoint1);
+}
+
+// solve for the endpoints that best reproduce the block's colours with the fit's indices held fixed.
+bool refineEndpoints(const Block& block, const bool* transparent, bool threeColourMode, const ColourFit& fit,
+                     float* endpoint0, float* endpoint1)
+{
+    const float* weights = threeColourMode ? s_threeColourWeights : s_fourColourWeights;
+
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[3] = { 0.0f, 0.0f, 0.0f };
+    float bx[3] = { 0.0f, 0.0f, 0.0f };
+    for(unsigned int i=0; i<16; ++i)
+    {
+        if (transparent[i]) continue;
+
+        float a = weights[fit.indices[i]];
+        float b = 1.0f-a;
+        aa += a*a; bb += b*b; ab += a*b;
+        for(unsigned int c=0; c<3; ++c)
+        {
+            ax[c] += a*block.colours[i][c];
+            bx[c] += b*block.colours[i][c];
+        }
+    }
+
+    float determinant = aa*bb - ab*ab;
+    if (fabsf(determinant)<1e-6f) return false;
+
+    for(unsigned int c=0; c<3; ++c)
+    {
+        endpoint0[c] = (ax[c]*bb - bx[c]*ab)/determinant;
+        endpoint1[c] = (bx[c]*aa - ax[c]*ab)/determinant;
+    }
+    clampPoint(endpoint0);
+    clampPoint(endpoint1);
+    return true;
+}
+
+void writeColourBlock(const ColourFit& fit, unsigned char* output)
+{
+    output[0] = fit.c0 & 0xff;
+    output[1] = (fit.c0>>8) & 0xff;
+    output[2] = fit.c1 & 0xff;
+    output[3] = (fit.c1>>8) & 0xff;
+
+    unsigned int bits = 0;
+    for(unsigned int i=0; i<16; ++i) bits |= fit.indices[i] << (2*i);
+
+    output[4] = bits & 0xff;
+    output[5] = (bits>>8) & 0xff;
+    output[6] = (bits>>16) & 0xff;
+    output[7] = (bits>>24) & 0xff;
+}
+
+void encodeColourBlock(const Block& block, bool dxt1, bool punchThroughAlpha, BuildOptions::CompressionQuality quality, unsigned char* output)
+{
+    bool transparent[16];
+    float points[16][3];
+    unsigned int numPoints = 0;
+    bool threeColourMode = false;
+    for(unsigned int i=0; i<16; ++i)
+    {
+        transparent[i] = punchThroughAlpha && block.alphas[i]<128;
+        if (transparent[i])
+        {
+            threeColourMode = true;
+        }
+        else
+        {
+            points[numPoints][0] = block.colours[i][0];
+            points[numPoints][1] = block.colours[i][1];
+            points[numPoints][2] = block.colours[i][2];
+            ++numPoints;
+        }
+    }
+
+    ColourFit best;
+    if (numPoints==0)
+    {
+        // fully transparent, c0<=c1 selects the three colour mode and index 3 is transparent black.
+        best.c0 = 0;
+        best.c1 = 0;
+        for(unsigned int i=0; i<16; ++i) best.indices[i] = 3;
+        writeColourBlock(best, output);
+        return;
+    }
+
+    float endpoint0[3], endpoint1[3];
+    if (quality==BuildOptions::FASTEST) computeBoundingBoxEndpoints(points, numPoints, endpoint0, endpoint1);
+    else computePrincipalAxisEndpoints(points, numPoints, endpoint0, endpoint1);
+
+    evaluateEndpoints(block, transparent, threeColourMode, dxt1, endpoint0, endpoint1, best);
+
+    unsigned int numIterations = 0;
+    if (quality==BuildOptions::PRODUCTION) numIterations = 1;
+    else if (quality==BuildOptions::HIGHEST) numIterations = 4;
+
+    for(unsigned int iteration=0; iteration<numIterations && best.error>0.0f; ++iteration)
+    {
+        // the fit's indices are relative to its quantized endpoint order, so refine against that order.
+        bool fitThreeColour = dxt1 && best.c0<=best.c1;
+        if (!refineEndpoints(block, transparent, fitThreeColour, best, endpoint0, endpoint1)) break;
+
+        ColourFit fit;
+        evaluateEndpoints(block, transparent, threeColourMode, dxt1, endpoint0, endpoint1, fit);
+        if (fit.error>=best.error) break;
+
+        best = fit;
+    }
+
+    writeColourBlock(best, output);
+}
+
+void encodeExplicitAlphaBlock(const Block& block, unsigned char* output)
+{
+    for(unsigned int i=0; i<16; i+=2)
+    {
+        unsigned int a0 = (block.alphas[i]*15+127)/255;
+        unsigned int a1 = (block.alphas[i+1]*15+127)/255;
+        output[i/2] = (unsigned char)(a0 | (a1<<4));
+    }
+}
+
+float fitInterpolatedAlpha(const Block& block, unsigned int a0, unsigned int a1, unsigned int* indices)
+{
+    int palette[8];
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0>a1)
+    {
+        for(unsigned int k=1; k<7; ++k) palette[k+1] = ((7-k)*a0 + k*a1)/7;
+    }
+    else
+    {
+        for(unsigned int k=1; k<5; ++k) palette[k+1] = ((5-k)*a0 + k*a1)/5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    float error = 0.0f;
+    for(unsigned int i=0; i<16; ++i)
+    {
+        int best = 0;
+        int bestDistance = 256*256;
+        for(unsigned int p=0; p<8; ++p)
+        {
+            int d = int(block.alphas[i])-palette[p];
+            if (d*d<bestDistance) { bestDistance = d*d; best = p; }
+        }
+        indices[i] = best;
+        error += float(bestDistance);
+    }
+    return error;
+}
+
+void encodeInterpolatedAlphaBlock(const Block& block, BuildOptions::CompressionQuality quality, unsigned char* output)
+{
+    unsigned int minAlpha = 255, maxAlpha = 0;
+    unsigned int minInnerAlpha = 255, maxInnerAlpha = 0;
+    for(unsigned int i=0; i<16; ++i)
+    {
+        unsigned int a = block.alphas[i];
+        minAlpha = osg::minimum(minAlpha, a);
+        maxAlpha = osg::maximum(maxAlpha, a);
+        if (a!=0 && a!=255)
+        {
+            minInnerAlpha = osg::minimum(minInnerAlpha, a);
+            maxInnerAlpha = osg::maximum(maxInnerAlpha, a);
+        }
+    }
+
+    // eight interpolated values across the full range.
+    unsigned int a0 = maxAlpha;
+    unsigned int a1 = minAlpha;
+    unsigned int indices[16];
+    float error = fitInterpolatedAlpha(block, a0, a1, indices);
+
+    // six interpolated values across the inner range plus exact 0 and 255, better for blocks with hard edges.
+    if (quality!=BuildOptions::FASTEST && error>0.0f && (minAlpha==0 || maxAlpha==255))
+    {
+        unsigned int innerIndices[16];
+        unsigned int inner0 = minInnerAlpha<=maxInnerAlpha ? minInnerAlpha : 0;
+        unsigned int inner1 = minInnerAlpha<=maxInnerAlpha ? maxInnerAlpha : 255;
+        float innerError = fitInterpolatedAlpha(block, inner0, inner1, innerIndices);
+        if (innerError<error)
+        {
+            a0 = inner0;
+            a1 = inner1;
+            memcpy(indices, innerIndices, sizeof(indices));
+        }
+    }
+
+    output[0] = (unsigned char)a0;
+    output[1] = (unsigned char)a1;
+
+    unsigned long long bits = 0;
+    for(unsigned int i=0; i<16; ++i) bits |= ((unsigned long long)indices[i]) << (3*i);
+    for(unsigned int b=0; b<6; ++b) output[2+b] = (unsigned char)((bits>>(8*b)) & 0xff);
+}
+
+struct Level
+{
+    const unsigned char*    source;
+    unsigned int            width;
+    unsigned int            height;
+    unsigned int            rowSize;
+    unsigned char*          destination;
+    unsigned int            numBlocksX;
+};
+
+struct Compression
+{
+    typedef std::pair<unsigned int, unsigned int> LevelBlockRow;
+    typedef std::vector<LevelBlockRow> BlockRows;
+
+    GLenum                              pixelFormat;
+    unsigned int                        pixelSize;
+    unsigned int                        blockSize;
+    BuildOptions::CompressionQuality    quality;
+    std::vector<Level>                  levels;
+    BlockRows                           blockRows;
+
+    void compressBlockRow(const LevelBlockRow& blockRow) const
+    {
+        const Level& level = levels[blockRow.first];
+        unsigned int by = blockRow.second;
+
+        bool dxt1 = pixelFormat==GL_COMPRESSED_RGB_S3TC_DXT1_EXT || pixelFormat==GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+        bool punchThroughAlpha = pixelFormat==GL_COMPRESSED_RGBA_S3TC_DXT1_EXT && pixelSize==4;
+
+        Block block;
+        unsigned char* output = level.destination + by*level.numBlocksX*blockSize;
+        for(unsigned int bx=0; bx<level.numBlocksX; ++bx, output += blockSize)
+        {
+            // edge blocks of images that aren't a multiple of 4 in size repeat their last row and column.
+            for(unsigned int j=0; j<4; ++j)
+            {
+                unsigned int y = osg::minimum(by*4+j, level.height-1);
+                const unsigned char* row = level.source + y*level.rowSize;
+                for(unsigned int i=0; i<4; ++i)
+                {
+                    unsigned int x = osg::minimum(bx*4+i, level.width-1);
+                    const unsigned char* pixel = row + x*pixelSize;
+                    unsigned int t = j*4+i;
+                    block.colours[t][0] = float(pixel[0]);
+                    block.colours[t][1] = float(pixel[1]);
+                    block.colours[t][2] = float(pixel[2]);
+                    block.alphas[t] = pixelSize==4 ? pixel[3] : 255;
+                }
+            }
+
+            if (pixelFormat==GL_COMPRESSED_RGBA_S3TC_DXT3_EXT)
+            {
+                encodeExplicitAlphaBlock(block, output);
+                encodeColourBlock(block, false, false, quality, output+8);
+            }
+            else if (pixelFormat==GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+            {
+                encodeInterpolatedAlphaBlock(block, quality, output);
+                encodeColourBlock(block, false, false, quality, output+8);
+            }
+            else
+            {
+                encodeColourBlock(block, dxt1, punchThroughAlpha, quality, output);
+            }
+        }
+    }
+
+    void compressBlockRows(unsigned int first, unsigned int stride) const
+    {
+        for(unsigned int r=first; r<blockRows.size(); r+=stride)
+        {
+            compressBlockRow(blockRows[r]);
+        }
+    }
+};
+
+class CompressionThread : public OpenThreads::Thread
+{
+    public:
+
+        CompressionThread(const Compression& compression, unsigned int first, unsigned int stride):
+            _compression(compression),
+            _first(first),
+            _stride(stride) {}
+
+        virtual void run()
+        {
+            _compression.compressBlockRows(_first, _stride);
+        }
+
+    protected:
+
+        const Compression&  _compression;
+        unsigned int        _first;
+        unsigned int        _stride;
+};
+
+}
+
+GLenum vpb::computeDXTPixelFormat(osg::Texture::InternalFormatMode compressedFormat, GLenum pixelFormat)
+{
+    bool hasAlpha = pixelFormat==GL_RGBA;
+    switch(compressedFormat)
+    {
+        case(osg::Texture::USE_S3TC_DXT1_COMPRESSION): return hasAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case(osg::Texture::USE_S3TC_DXT3_COMPRESSION): return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+        case(osg::Texture::USE_S3TC_DXT5_COMPRESSION): return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case(osg::Texture::USE_ARB_COMPRESSION): return hasAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        default: return 0;
+    }
+}
+
+bool vpb::compressDXT(osg::Image& image, GLenum compressedPixelFormat, BuildOptions::CompressionQuality quality, unsigned int numThreads)
+{
+    if (image.getPixelFormat()!=GL_RGB && image.getPixelFormat()!=GL_RGBA) return false;
+    if (image.getDataType()!=GL_UNSIGNED_BYTE || !image.data() || image.r()!=1) return false;
+
+    Compression compression;
+    compression.pixelFormat = compressedPixelFormat;
+    compression.pixelSize = image.getPixelFormat()==GL_RGBA ? 4 : 3;
+    compression.quality = quality;
+
+    switch(compressedPixelFormat)
+    {
+        case(GL_COMPRESSED_RGB_S3TC_DXT1_EXT):
+        case(GL_COMPRESSED_RGBA_S3TC_DXT1_EXT): compression.blockSize = 8; break;
+        case(GL_COMPRESSED_RGBA_S3TC_DXT3_EXT):
+        case(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT): compression.blockSize = 16; break;
+        default: return false;
+    }
+
+    unsigned int numLevels = image.isMipmap() ? image.getNumMipmapLevels() : 1;
+
+    // lay out the compressed levels one after another, as osg::Image expects its mipmaps.
+    osg::Image::MipmapDataType mipmapOffsets;
+    unsigned int totalSize = 0;
+    for(unsigned int l=0; l<numLevels; ++l)
+    {
+        Level level;
+        level.width = osg::maximum(image.s()>>l, 1);
+        level.height = osg::maximum(image.t()>>l, 1);
+        level.source = image.getMipmapData(l);
+        level.rowSize = osg::Image::computeRowWidthInBytes(level.width, image.getPixelFormat(), image.getDataType(), image.getPacking());
+        level.destination = 0;
+        level.numBlocksX = (level.width+3)/4;
+
+        unsigned int numBlocksY = (level.height+3)/4;
+        for(unsigned int by=0; by<numBlocksY; ++by)
+        {
+            compression.blockRows.push_back(Compression::LevelBlockRow(l, by));
+        }
+
+        if (l>0) mipmapOffsets.push_back(totalSize);
+        totalSize += level.numBlocksX*numBlocksY*compression.blockSize;
+
+        compression.levels.push_back(level);
+    }
+
+    unsigned char* data = new unsigned char[totalSize];
+    unsigned int offset = 0;
+    for(unsigned int l=0; l<numLevels; ++l)
+    {
+        compression.levels[l].destination = data + offset;
+        offset += compression.levels[l].numBlocksX*((compression.levels[l].height+3)/4)*compression.blockSize;
+    }
+
+    // interleave the rows of blocks between the threads so each gets a share of every level, this thread takes the first share.
+    numThreads = osg::minimum(osg::maximum(numThreads, 1u), static_cast<unsigned int>(compression.blockRows.size()));
+
+    typedef std::vector<CompressionThread*> Threads;
+    Threads threads;
+    for(unsigned int t=1; t<numThreads; ++t)
+    {
+        CompressionThread* thread = new CompressionThread(compression, t, numThreads);
+        thread->start();
+        threads.push_back(thread);
+    }
+
+    compression.compressBlockRows(0, numThreads);
+
+    for(Threads::iterator itr = threads.begin();
+        itr != threads.end();
+        ++itr)
+    {
+        (*itr)->join();
+        delete *itr;
+    }
+
+    image.setImage(image.s(), image.t(), 1,
+                   compressedPixelFormat, compressedPixelFormat, GL_UNSIGNED_BYTE,
+                   data, osg::Image::USE_NEW_DELETE);
+    image.setMipmapLevels(mipmapOffsets);
+
+    return true;
+}
@@ -28,6 +28,9 @@
 #include <osgViewer/Viewer>
 #include <osgViewer/Version>
 
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
 #include <vpb/DataSet>
 #include <vpb/DatabaseBuilder>
 #include <vpb/TaskManager>
@@ -70,6 +73,8 @@ void DataSet::init()
     
     _newDestinationGraph = false;
 
+    _tileMemory = 0;
+    _peakTileMemory = 0;
 }
 
 void DataSet::addSource(Source* source, unsigned int revisionNumber)
@@ -81,6 +86,7 @@ void DataSet::addSource(Source* source, unsigned int revisionNumber)
     source->setRevisionNumber(revisionNumber);
     
     _sourceGraph->_sourceList.push_back(source);
+    _sourceGraph->dirtySourceIndices();
 }
 #if 0
 void DataSet::addSource(CompositeSource* composite)
@@ -120,6 +126,8 @@ void DataSet::loadSources()
             }
         }
     }
+
+    if (_sourceGraph.valid()) _sourceGraph->dirtySourceIndices();
 }
 
 bool DataSet::mapLatLongsToXYZ() const
@@ -398,9 +406,15 @@ void DataSet::createNewDestinationGraph(osg::CoordinateSystemNode* cs,
     int highestLevelFound = 0;
 
     // first populate the destination graph from imagery and DEM sources extents/resolution
-    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    // only the sources that overlap the destination extents can contribute.
+    SourceIndex::Sources sources;
+    _sourceGraph->getIntersectingSources(cs, extents, sources);
+
+    for(SourceIndex::Sources::iterator itr = sources.begin();
+        itr != sources.end();
+        ++itr)
     {
-        Source* source = (*itr).get();
+        Source* source = *itr;
 
         if (source->getMinLevel()>maxNumLevels)
         {
@@ -414,13 +428,8 @@ void DataSet::createNewDestinationGraph(osg::CoordinateSystemNode* cs,
             continue;
         }
 
-        SourceData* sd = (*itr)->getSourceData();
-        if (!sd)
-        {
-            log(osg::NOTICE,"Skipping source %s as no data loaded from it.",source->getFileName().c_str());
-            continue;
-        }
-        
+        SourceData* sd = source->getSourceData();
+
         const SpatialProperties& sp = sd->computeSpatialProperties(cs);
 
         if (!sp._extents.intersects(extents))
@@ -496,93 +505,85 @@ void DataSet::createNewDestinationGraph(osg::CoordinateSystemNode* cs,
     }
     
     // now extend the sources upwards where required.
-    for(QuadMap::iterator qitr = _quadMap.begin();
-        qitr != _quadMap.end();
-        ++qitr)
+    for(unsigned int ql = 0; ql+1 < _quadMap.getNumLevels(); ++ql)
     {
-        QuadMap::iterator temp_itr = qitr;
-        ++temp_itr;
-        if (temp_itr==_quadMap.end()) continue;
-        
-        int l = qitr->first;
+        int l = ql;
         
-        Level& level = qitr->second;
-        for(Level::iterator litr = level.begin();
-            litr != level.end();
-            ++litr)
-        {
-            Row& row = litr->second;
-            for(Row::iterator ritr = row.begin();
-                ritr != row.end();
-                ++ritr)
+        // take a copy of the level as creating tiles below inserts into the quad map.
+        QuadMap::Composites level;
+        _quadMap.getComposites(ql, level);
+        for(QuadMap::Composites::iterator ritr = level.begin();
+            ritr != level.end();
+            ++ritr)
+        {
+            CompositeDestination* cd = *ritr;
+                
+            int numChildren = cd->_children.size();
+            int numChildrenExpected = (l==0) ? (_C1*_R1) : 4;
+            if (numChildren!=0 && numChildren!=numChildrenExpected)
             {
-                CompositeDestination* cd = ritr->second;
-                    
-                int numChildren = cd->_children.size();
-                int numChildrenExpected = (l==0) ? (_C1*_R1) : 4;
-                if (numChildren!=0 && numChildren!=numChildrenExpected)
-                {
 #if 0
-                    log(osg::NOTICE,"  tile (%i,%i,%i) numTiles=%i numChildren=%i",
-                        cd->_level, cd->_tileX, cd->_tileY, cd->_tiles.size(), cd->_children.size());
+                log(osg::NOTICE,"  tile (%i,%i,%i) numTiles=%i numChildren=%i",
+                    cd->_level, cd->_tileX, cd->_tileY, cd->_tiles.size(), cd->_children.size());
 #endif
-                    int i_min = (l==0) ? 0   : (cd->_tileX * 2);
-                    int j_min = (l==0) ? 0   : (cd->_tileY * 2);
-                    int i_max = (l==0) ? _C1 : i_min + 2;
-                    int j_max = (l==0) ? _R1 : j_min + 2;
-                    int new_l = l+1;
+                int i_min = (l==0) ? 0   : (cd->_tileX * 2);
+                int j_min = (l==0) ? 0   : (cd->_tileY * 2);
+                int i_max = (l==0) ? _C1 : i_min + 2;
+                int j_max = (l==0) ? _R1 : j_min + 2;
+                int new_l = l+1;
 
-                    if (getGenerateSubtile())
-                    {
-                        int i_lower, i_upper, j_lower, j_upper;
-                        
-
-                        if (l<static_cast<int>(getSubtileLevel()))
-                        {
-                            // divide by 2 to the power of ((getSubtileLevel()-new_l);
-                            int delta = getSubtileLevel()-new_l;
-                            i_lower = getSubtileX() >> delta;
-                            j_lower = getSubtileY() >> delta;
-                            i_upper = i_lower + 1;
-                            j_upper = j_lower + 1;
-                        }
-                        else
-                        {
-                            // multiply 2 to the power of ((new_l-getSubtileLevel());
-                            int f = 1 << (new_l-getSubtileLevel());
-                            i_lower = getSubtileX() * f;
-                            j_lower = getSubtileY() * f;
-                            i_upper = i_lower + f;
-                            j_upper = j_lower + f;
-                        }
+                if (getGenerateSubtile())
+                {
+                    int i_lower, i_upper, j_lower, j_upper;
+                    
 
-                        if (i_min<i_lower) i_min = i_lower;
-                        if (i_max>i_upper) i_max = i_upper;
-                        if (j_min<j_lower) j_min = j_lower;
-                        if (j_max>j_upper) j_max = j_upper;
+                    if (l<static_cast<int>(getSubtileLevel()))
+                    {
+                        // divide by 2 to the power of ((getSubtileLevel()-new_l);
+                        int delta = getSubtileLevel()-new_l;
+                        i_lower = getSubtileX() >> delta;
+                        j_lower = getSubtileY() >> delta;
+                        i_upper = i_lower + 1;
+                        j_upper = j_lower + 1;
                     }
+                    else
+                    {
+                        // multiply 2 to the power of ((new_l-getSubtileLevel());
+                        int f = 1 << (new_l-getSubtileLevel());
+                        i_lower = getSubtileX() * f;
+                        j_lower = getSubtileY() * f;
+                        i_upper = i_lower + f;
+                        j_upper = j_lower + f;
+                    }
+
+                    if (i_min<i_lower) i_min = i_lower;
+                    if (i_max>i_upper) i_max = i_upper;
+                    if (j_min<j_lower) j_min = j_lower;
+                    if (j_max>j_upper) j_max = j_upper;
+                }
 
-                    for(int j=j_min; j<j_max;++j)
+                for(int j=j_min; j<j_max;++j)
+                {
+                    for(int i=i_min; i<i_max;++i)
                     {
-                        for(int i=i_min; i<i_max;++i)
+                        CompositeDestination* cd = getComposite(new_l,i,j);
+                        if (!cd)
                         {
-                            CompositeDestination* cd = getComposite(new_l,i,j);
-                            if (!cd)
-                            {
-                                cd = createDestinationTile(new_l,i,j);
-                            }
+                            cd = createDestinationTile(new_l,i,j);
                         }
                     }
-                    
                 }
+                
             }
         }
     }
 
     // now insert the sources into the destination graph
-    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    for(SourceIndex::Sources::iterator itr = sources.begin();
+        itr != sources.end();
+        ++itr)
     {
-        Source* source = (*itr).get();
+        Source* source = *itr;
 
         if (source->getMinLevel()>maxNumLevels)
         {
@@ -596,13 +597,8 @@ void DataSet::createNewDestinationGraph(osg::CoordinateSystemNode* cs,
             continue;
         }
 
-        SourceData* sd = (*itr)->getSourceData();
-        if (!sd)
-        {
-            log(osg::NOTICE,"Skipping source %s as no data loaded from it.",source->getFileName().c_str());
-            continue;
-        }
-        
+        SourceData* sd = source->getSourceData();
+
         const SpatialProperties& sp = sd->computeSpatialProperties(cs);
 
         if (!sp._extents.intersects(extents))
@@ -1193,6 +1189,53 @@ bool DataSet::requiresReprojection()
     return false;
 }
 
+class ReprojectSourceOperation : public BuildOperation
+{
+    public:
+
+        ReprojectSourceOperation(ThreadPool* threadPool, BuildLog* buildLog, Source* source, const std::string& filename, osg::CoordinateSystemNode* cs, const BuildOptions* buildOptions, ProgressReport* progress):
+            BuildOperation(threadPool, buildLog, "ReprojectSourceOperation", false),
+            _source(source),
+            _filename(filename),
+            _cs(cs),
+            _buildOptions(buildOptions),
+            _progress(progress) {}
+
+        virtual void build()
+        {
+            log(osg::NOTICE, "   ReprojectSourceOperation: reprojecting %s to %s",_source->getFileName().c_str(),_filename.c_str());
+            _newSource = _source->doRasterReprojection(_filename, _cs.get(), 0.0, _buildOptions);
+            _progress->completed(_source->getFileName());
+        }
+
+        osg::ref_ptr<Source>                    _source;
+        std::string                             _filename;
+        osg::ref_ptr<osg::CoordinateSystemNode> _cs;
+        const BuildOptions*                     _buildOptions;
+        osg::ref_ptr<ProgressReport>            _progress;
+        osg::ref_ptr<Source>                    _newSource;
+};
+
+class BuildOverviewsOperation : public BuildOperation
+{
+    public:
+
+        BuildOverviewsOperation(ThreadPool* threadPool, BuildLog* buildLog, Source* source, ProgressReport* progress):
+            BuildOperation(threadPool, buildLog, "BuildOverviewsOperation", false),
+            _source(source),
+            _progress(progress) {}
+
+        virtual void build()
+        {
+            log(osg::NOTICE, "   BuildOverviewsOperation: building overviews of %s",_source->getFileName().c_str());
+            _source->buildOverviews();
+            _progress->completed(_source->getFileName());
+        }
+
+        osg::ref_ptr<Source>            _source;
+        osg::ref_ptr<ProgressReport>    _progress;
+};
+
 void DataSet::reprojectSourcesAndGenerateOverviews()
 {
     if (!_sourceGraph) return;
@@ -1201,35 +1244,65 @@ void DataSet::reprojectSourcesAndGenerateOverviews()
 
     osg::Timer_t before_reproject = osg::Timer::instance()->tick();
 
+    // sources whose overviews were built as part of their reprojection.
+    std::set<Source*> sourcesWithOverviews;
+
     // do standardisation of coordinates systems.
     // do any reprojection if required.
     {
+        // all sources are reprojected to the one intermediate coordinate system, so a source file listed more
+        // than once, i.e. in several layers, only needs warping once if it's georeferenced the same way each time.
+        typedef std::pair<Source*, std::string> Reprojection;
+        typedef std::vector<Reprojection> Reprojections;
+        typedef std::map<std::string, unsigned int> ReprojectionKeyMap;
+        typedef std::map<Source*, unsigned int> SourceReprojectionMap;
+        Reprojections reprojections;
+        ReprojectionKeyMap reprojectionKeyMap;
+        SourceReprojectionMap sourceReprojectionMap;
+        std::set<std::string> newFileNames;
+
         for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
         {
             Source* source = itr->get();
-            
+            if (!source) continue;
+
             log(osg::INFO, "Checking %s",source->getFileName().c_str());
-            
-            if (source && source->needReproject(_intermediateCoordinateSystem.get()))
+
+            if (source->needReproject(_intermediateCoordinateSystem.get()))
             {
             
                 if (getReprojectSources())
                 {
-                    if (source->isRaster())
+                    if (source->isRaster() && getVirtualReprojection())
                     {
-                
-                        // do the reprojection to a tempory file.
-                        std::string newFileName = temporyFilePrefix + osgDB::getStrippedName(source->getFileName()) + ".tif";
-
-                        Source* newSource = source->doRasterReprojection(newFileName,_intermediateCoordinateSystem.get());
+                        // tiles read through a warped VRT, so there is nothing to write up front.
+                        osg::ref_ptr<Source> newSource = source->doVirtualRasterReprojection(_intermediateCoordinateSystem.get(), this);
+                        if (!newSource) log(osg::WARN, "Failed to reproject %s",source->getFileName().c_str());
 
                         // replace old source by new one.
-                        if (newSource) *itr = newSource;
-                        else
+                        *itr = newSource;
+                    }
+                    else if (source->isRaster())
+                    {
+                        std::string reprojectionKey = source->computeReprojectionKey();
+                        ReprojectionKeyMap::iterator fitr = reprojectionKeyMap.find(reprojectionKey);
+                        if (fitr == reprojectionKeyMap.end())
                         {
-                            log(osg::WARN, "Failed to reproject %s",source->getFileName().c_str());
-                            *itr = 0;
+                            // do the reprojection to a tempory file, keeping the names of files with the same stripped name distinct.
+                            std::string strippedName = temporyFilePrefix + osgDB::getStrippedName(source->getFileName());
+                            std::string newFileName = strippedName + ".tif";
+                            for(unsigned int i=1; newFileNames.count(newFileName)!=0; ++i)
+                            {
+                                std::ostringstream str;
+                                str<<strippedName<<"_"<<i<<".tif";
+                                newFileName = str.str();
+                            }
+                            newFileNames.insert(newFileName);
+
+                            fitr = reprojectionKeyMap.insert(ReprojectionKeyMap::value_type(reprojectionKey, reprojections.size())).first;
+                            reprojections.push_back(Reprojection(source, newFileName));
                         }
+                        sourceReprojectionMap[source] = fitr->second;
                     }
                     else
                     {
@@ -1242,6 +1315,58 @@ void DataSet::reprojectSourcesAndGenerateOverviews()
                 }
             }
         }
+
+        typedef std::vector< osg::ref_ptr<ReprojectSourceOperation> > Operations;
+        Operations operations;
+
+        if (!reprojections.empty())
+        {
+            unsigned int numThreads = osg::minimum(computeNumConcurrentReprojections(), static_cast<unsigned int>(reprojections.size()));
+
+            log(osg::NOTICE,"Reprojecting %u source files, %u at a time",static_cast<unsigned int>(reprojections.size()),numThreads);
+
+            osg::ref_ptr<ProgressReport> progress = new ProgressReport("Reprojection", reprojections.size());
+            osg::ref_ptr<ThreadPool> threadPool = new ThreadPool(numThreads, false);
+            threadPool->startThreads();
+
+            for(Reprojections::iterator ritr = reprojections.begin();
+                ritr != reprojections.end();
+                ++ritr)
+            {
+                operations.push_back(new ReprojectSourceOperation(threadPool.get(), getBuildLog(), ritr->first, ritr->second, _intermediateCoordinateSystem.get(), this, progress.get()));
+                threadPool->run(operations.back().get());
+            }
+
+            threadPool->waitForCompletion();
+            threadPool->reportStatistics("Reprojection");
+        }
+
+        // replace old sources by the new ones, sources sharing a file get their own Source of the shared reprojected file.
+        for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+        {
+            Source* source = itr->get();
+
+            SourceReprojectionMap::iterator sitr = sourceReprojectionMap.find(source);
+            if (sitr == sourceReprojectionMap.end()) continue;
+
+            ReprojectSourceOperation* operation = operations[sitr->second].get();
+            Source* newSource = operation->_newSource.get();
+            if (newSource && operation->_source != source)
+            {
+                newSource = source->createReprojectedSource(newSource->getFileName(), _intermediateCoordinateSystem.get(), true);
+            }
+
+            if (newSource)
+            {
+                *itr = newSource;
+                if (getBuildOverlays()) sourcesWithOverviews.insert(newSource);
+            }
+            else
+            {
+                log(osg::WARN, "Failed to reproject %s",source->getFileName().c_str());
+                *itr = 0;
+            }
+        }
     }
     
     osg::Timer_t after_reproject = osg::Timer::instance()->tick();
@@ -1251,13 +1376,43 @@ void DataSet::reprojectSourcesAndGenerateOverviews()
     // do sampling of data to required values.
     if (getBuildOverlays())
     {
+        // build the overviews of each file once, even when it's shared by several sources.
+        typedef std::vector<Source*> Sources;
+        Sources sources;
+        std::set<std::string> fileNames;
+
         for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
         {
             Source* source = itr->get();
-            if (source) source->buildOverviews();
+            if (source && sourcesWithOverviews.count(source)==0 && fileNames.insert(source->getFileName()).second)
+            {
+                sources.push_back(source);
+            }
+        }
+
+        if (!sources.empty())
+        {
+            unsigned int numThreads = osg::minimum(computeNumConcurrentOverviewBuilds(), static_cast<unsigned int>(sources.size()));
+
+            log(osg::NOTICE,"Building overviews of %u source files, %u at a time",static_cast<unsigned int>(sources.size()),numThreads);
+
+            osg::ref_ptr<ProgressReport> progress = new ProgressReport("Overviews", sources.size());
+            osg::ref_ptr<ThreadPool> threadPool = new ThreadPool(numThreads, false);
+            threadPool->startThreads();
+
+            for(Sources::iterator sitr = sources.begin();
+                sitr != sources.end();
+                ++sitr)
+            {
+                threadPool->run(new BuildOverviewsOperation(threadPool.get(), getBuildLog(), *sitr, progress.get()));
+            }
+
+            threadPool->waitForCompletion();
         }
     }
 
+    _sourceGraph->dirtySourceIndices();
+
     // osg::Timer_t after_sourceGraphsort = osg::Timer::instance()->tick();
 }
 
@@ -1366,87 +1521,392 @@ void DataSet::populateDestinationGraphFromSources()
 }
 
 
+// Tiles whose reads have completed, handed from the read threads back to the thread driving the build.
+class TileReadQueue : public osg::Referenced
+{
+    public:
+
+        void push(DestinationTile* tile)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _tiles.push_back(tile);
+            _condition.signal();
+        }
+
+        /** Wait until at least one tile has been read, then move all the read tiles into tiles.*/
+        void waitAndTake(std::vector<DestinationTile*>& tiles)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            while(_tiles.empty()) _condition.wait(&_mutex);
+            tiles.insert(tiles.end(), _tiles.begin(), _tiles.end());
+            _tiles.clear();
+        }
+
+    protected:
+
+        OpenThreads::Mutex              _mutex;
+        OpenThreads::Condition          _condition;
+        std::vector<DestinationTile*>   _tiles;
+};
+
 class ReadFromOperation : public BuildOperation
 {
     public:
 
-        ReadFromOperation(ThreadPool* threadPool, BuildLog* buildLog, DestinationTile* tile, CompositeSource* sourceGraph):
+        ReadFromOperation(ThreadPool* threadPool, BuildLog* buildLog, DestinationTile* tile, CompositeSource* sourceGraph, bool fromChildren, TileReadQueue* readQueue):
             BuildOperation(threadPool, buildLog, "ReadFromOperation", false),
             _tile(tile),
-            _sourceGraph(sourceGraph) {}
+            _sourceGraph(sourceGraph),
+            _fromChildren(fromChildren),
+            _readQueue(readQueue) {}
 
         virtual void build()
         {
+            // downsample from the completed children where possible, readFrom() then only reads what they couldn't provide.
+            if (_fromChildren) _tile->readFromChildren(_sourceGraph.get());
+
             log(osg::NOTICE, "   ReadFromOperation: reading tile level=%u X=%u Y=%u",_tile->_level,_tile->_tileX,_tile->_tileY);
             _tile->readFrom(_sourceGraph.get());
+            _tile->_readWorker = _threadPool ? _threadPool->getCurrentWorker() : -1;
+            _readQueue->push(_tile.get());
         }
-      
+
         osg::ref_ptr<DestinationTile> _tile;
         osg::ref_ptr<CompositeSource> _sourceGraph;
+        bool                          _fromChildren;
+        osg::ref_ptr<TileReadQueue>   _readQueue;
 };
 
-void DataSet::_readRow(Row& row)
+// the pool thread that read the child tiles of cd, or -1 if they weren't read on a pool thread.
+static int getChildrenReadWorker(CompositeDestination* cd)
+{
+    for(CompositeDestination::ChildList::iterator citr=cd->_children.begin();
+        citr!=cd->_children.end();
+        ++citr)
+    {
+        for(CompositeDestination::TileList::iterator titr=(*citr)->_tiles.begin();
+            titr!=(*citr)->_tiles.end();
+            ++titr)
+        {
+            if ((*titr)->_readWorker>=0) return (*titr)->_readWorker;
+        }
+    }
+    return -1;
+}
+
+// gather the tiles of the levels being built depth first, each composite's tiles following those of its children.
+static void collectTilesDepthFirst(CompositeDestination* cd, const std::set<unsigned int>& levels, std::vector<DestinationTile*>& tiles)
+{
+    for(CompositeDestination::ChildList::iterator citr=cd->_children.begin();
+        citr!=cd->_children.end();
+        ++citr)
+    {
+        collectTilesDepthFirst(citr->get(), levels, tiles);
+    }
+
+    if (levels.count(cd->_level)==0) return;
+
+    for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
+        titr!=cd->_tiles.end();
+        ++titr)
+    {
+        tiles.push_back(titr->get());
+    }
+}
+
+void DataSet::_buildTiles(const LevelNumbers& levelNumbers, bool writeToDisk)
 {
-    log(osg::NOTICE, "_readRow %u",row.size());
-    
     CompositeSource* sourceGraph = _newDestinationGraph ? 0 : _sourceGraph.get();
+    bool bottomUp = getBottomUpPyramid();
 
-    if (_readThreadPool.valid())
+    // gather the tiles in the order they are to be read, level by level and row by row.
+    Tiles tiles;
+    unsigned int maxRowSize = 0;
+    for(LevelNumbers::const_iterator litr=levelNumbers.begin();
+        litr!=levelNumbers.end();
+        ++litr)
     {
-        for(Row::iterator citr=row.begin();
-            citr!=row.end();
+        QuadMap::Composites level;
+        _quadMap.getComposites(*litr, level);
+
+        unsigned int rowSize = 0;
+        for(QuadMap::Composites::iterator citr=level.begin();
+            citr!=level.end();
             ++citr)
         {
-            CompositeDestination* cd = citr->second;
+            CompositeDestination* cd = *citr;
+
+            // composites come in row order, so a change in Y starts a new row.
+            if (citr!=level.begin() && cd->_tileY!=(*(citr-1))->_tileY)
+            {
+                maxRowSize = osg::maximum(maxRowSize, rowSize);
+                rowSize = 0;
+            }
+
             for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
                 titr!=cd->_tiles.end();
                 ++titr)
             {
-                _readThreadPool->run(new ReadFromOperation(_readThreadPool.get(), getBuildLog(), titr->get(), sourceGraph));
+                tiles.push_back(titr->get());
+                ++rowSize;
             }
         }
+        maxRowSize = osg::maximum(maxRowSize, rowSize);
+    }
 
-        // wait for the threads to complete.
-        _readThreadPool->waitForCompletion();
+    LevelSet levelsBuilt(levelNumbers.begin(), levelNumbers.end());
 
+    // building bottom up, go depth first so each parent is downsampled, and its children written and released, as soon
+    // as the children are complete, rather than holding a whole level in memory while the level below it is built.
+    if (bottomUp && _destinationGraph.valid())
+    {
+        tiles.clear();
+        collectTilesDepthFirst(_destinationGraph.get(), levelsBuilt, tiles);
     }
-    else
+
+    // a tile can be equalized once the row above it has been read up to its right hand neighbour, so
+    // just over two rows of tiles in flight keeps the pipeline moving while bounding the memory held.
+    unsigned int numThreads = _readThreadPool.valid() ? osg::maximum(_readThreadPool->getNumThreads(), 1u) : 1;
+    unsigned int maxNumTilesInFlight = 2*maxRowSize + 2*numThreads;
+
+    unsigned long long memoryBudget = (unsigned long long)getMemoryBudget()*1024*1024;
+    unsigned int numThrottled = 0;
+
+    log(osg::NOTICE, "_buildTiles %u tiles, up to %u in flight",tiles.size(),maxNumTilesInFlight);
+
+    osg::ref_ptr<TileReadQueue> readQueue = new TileReadQueue;
+    TileSet readTiles;
+    Tiles tilesRead;
+    TilesWaitingOnChildren waitingOnChildren;
+    unsigned int nextTile = 0;
+    unsigned int numTilesInFlight = 0;
+    unsigned int numReadsPending = 0;
+
+    while(nextTile<tiles.size() || !waitingOnChildren.waiting.empty() || !waitingOnChildren.ready.empty() || numTilesInFlight>0)
     {
-        for(Row::iterator citr=row.begin();
-            citr!=row.end();
-            ++citr)
+        bool waitingOnWrites = false;
+
+        // dispatch reads in order, as long as the tile limit, memory budget and any bottom up dependency allow.
+        for(;;)
         {
-            CompositeDestination* cd = citr->second;
-            for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
-                titr!=cd->_tiles.end();
-                ++titr)
+            // parents whose children have since completed go first, so the children can be written and released.
+            DestinationTile* tile = 0;
+            bool ready = !waitingOnChildren.ready.empty();
+            if (ready)
+            {
+                tile = waitingOnChildren.ready.front();
+            }
+            else if (nextTile<tiles.size())
             {
-                DestinationTile* tile = titr->get();
+                tile = tiles[nextTile];
+
+                // set aside parents whose children aren't complete yet, and carry on reading the tiles the children are waiting on.
+                if (_isBuiltFromChildren(tile->_parent, levelsBuilt) && !tile->_parent->areSubTilesComplete())
+                {
+                    waitingOnChildren.waiting[tile->_parent].push_back(tile);
+                    ++nextTile;
+                    continue;
+                }
+            }
+            else
+            {
+                break;
+            }
+
+            // if no reads are outstanding no tiles will complete, so carry on past the limit rather than stall.
+            if (numTilesInFlight>=maxNumTilesInFlight && numReadsPending>0) break;
+
+            // over budget, hold back until completing reads hand tiles on to be written, or pending writes release their data.
+            // If neither is possible the remaining tiles need more reads before anything can be released, so carry on.
+            if (memoryBudget!=0 && getTileMemory()>=memoryBudget)
+            {
+                if (numReadsPending>0) { ++numThrottled; break; }
+
+                if (_writeThreadPool.valid() &&
+                    (_writeThreadPool->getNumOperationsQueued()>0 || _writeThreadPool->getNumOperationsRunning()>0))
+                {
+                    ++numThrottled;
+                    waitingOnWrites = true;
+                    break;
+                }
+            }
+
+            if (ready) waitingOnChildren.ready.pop_front();
+            else ++nextTile;
+
+            ++numTilesInFlight;
+
+            bool fromChildren = _isBuiltFromChildren(tile->_parent, levelsBuilt);
+
+            if (_readThreadPool.valid())
+            {
+                ++numReadsPending;
+                osg::ref_ptr<ReadFromOperation> operation = new ReadFromOperation(_readThreadPool.get(), getBuildLog(), tile, sourceGraph, fromChildren, readQueue.get());
+
+                // downsample on the thread that read the children, while their data is still in its cache.
+                if (fromChildren) operation->setAffinityHint(getChildrenReadWorker(tile->_parent));
+
+                _readThreadPool->run(operation.get());
+            }
+            else
+            {
+                if (fromChildren) tile->readFromChildren(sourceGraph);
+
                 log(osg::NOTICE, "   reading tile level=%u X=%u Y=%u",tile->_level,tile->_tileX,tile->_tileY);
                 tile->readFrom(sourceGraph);
+                numTilesInFlight -= _tileRead(tile, readTiles, waitingOnChildren, levelsBuilt, writeToDisk);
+            }
+        }
+
+        if (numReadsPending>0)
+        {
+            tilesRead.clear();
+            readQueue->waitAndTake(tilesRead);
+            numReadsPending -= tilesRead.size();
+
+            for(Tiles::iterator titr=tilesRead.begin();
+                titr!=tilesRead.end();
+                ++titr)
+            {
+                numTilesInFlight -= _tileRead(*titr, readTiles, waitingOnChildren, levelsBuilt, writeToDisk);
+            }
+        }
+        else if (waitingOnWrites)
+        {
+            _waitForTileMemoryRelease(100);
+        }
+        else if (numTilesInFlight>0)
+        {
+            // all the dispatched tiles have been read, so any tile still waiting has a neighbour that isn't part of this build.
+            for(TileSet::iterator titr=readTiles.begin();
+                titr!=readTiles.end();
+                ++titr)
+            {
+                if (!(*titr)->getTileComplete())
+                {
+                    _completeTile(*titr, waitingOnChildren, levelsBuilt, writeToDisk);
+                    --numTilesInFlight;
+                }
             }
         }
     }
+
+    log(osg::NOTICE, "_buildTiles peak tile memory %lluMB, reads held back %u times for the %lluMB memory budget",
+        getPeakTileMemory()/(1024*1024), numThrottled, memoryBudget/(1024*1024));
 }
 
-void DataSet::_equalizeRow(Row& row)
+void DataSet::_waitForTileMemoryRelease(unsigned long ms)
 {
-    log(osg::NOTICE, "_equalizeRow %d",row.size());
-    for(Row::iterator citr=row.begin();
-        citr!=row.end();
-        ++citr)
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_tileMemoryMutex);
+    _tileMemoryCondition.wait(&_tileMemoryMutex, ms);
+}
+
+void DataSet::accountTileMemory(long long numBytes)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_tileMemoryMutex);
+
+    if (numBytes<0 && (unsigned long long)(-numBytes)>_tileMemory) _tileMemory = 0;
+    else _tileMemory += numBytes;
+
+    if (_tileMemory>_peakTileMemory) _peakTileMemory = _tileMemory;
+
+    if (numBytes<0) _tileMemoryCondition.broadcast();
+}
+
+unsigned long long DataSet::getTileMemory() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_tileMemoryMutex);
+    return _tileMemory;
+}
+
+unsigned long long DataSet::getPeakTileMemory() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_tileMemoryMutex);
+    return _peakTileMemory;
+}
+
+unsigned int DataSet::_tileRead(DestinationTile* tile, TileSet& readTiles, TilesWaitingOnChildren& waitingOnChildren, const LevelSet& levelsBuilt, bool writeToDisk)
+{
+    readTiles.insert(tile);
+
+    // the children of a composite built from them are held until all its tiles have been read, so can now be written and released.
+    CompositeDestination* cd = tile->_parent;
+    if (writeToDisk && _isBuiltFromChildren(cd, levelsBuilt))
     {
-        CompositeDestination* cd = citr->second;
+        bool tilesRead = true;
         for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
-            titr!=cd->_tiles.end();
+            titr!=cd->_tiles.end() && tilesRead;
             ++titr)
         {
-            DestinationTile* tile = titr->get();
-            log(osg::NOTICE, "   equalizing tile level=%u X=%u Y=%u",tile->_level,tile->_tileX,tile->_tileY);
-            tile->equalizeBoundaries();
-            tile->setTileComplete(true);
+            if (readTiles.count(titr->get())==0) tilesRead = false;
         }
+
+        if (tilesRead) _writeCompositeDestination(cd->_children.front().get());
+    }
+
+    // the tile itself, or any of its neighbours, may now have all their neighbours read and be ready to equalize.
+    DestinationTile* candidates[DestinationTile::NUMBER_OF_POSITIONS+1];
+    candidates[0] = tile;
+    for(unsigned int i=0; i<DestinationTile::NUMBER_OF_POSITIONS; ++i)
+    {
+        candidates[i+1] = tile->_neighbour[i];
+    }
+
+    unsigned int numCompleted = 0;
+    for(unsigned int c=0; c<DestinationTile::NUMBER_OF_POSITIONS+1; ++c)
+    {
+        DestinationTile* candidate = candidates[c];
+        if (!candidate || candidate->getTileComplete() || readTiles.count(candidate)==0) continue;
+
+        bool neighboursRead = true;
+        for(unsigned int i=0; i<DestinationTile::NUMBER_OF_POSITIONS && neighboursRead; ++i)
+        {
+            DestinationTile* neighbour = candidate->_neighbour[i];
+            if (neighbour && readTiles.count(neighbour)==0) neighboursRead = false;
+        }
+
+        if (neighboursRead)
+        {
+            _completeTile(candidate, waitingOnChildren, levelsBuilt, writeToDisk);
+            ++numCompleted;
+        }
+    }
+
+    return numCompleted;
+}
+
+void DataSet::_completeTile(DestinationTile* tile, TilesWaitingOnChildren& waitingOnChildren, const LevelSet& levelsBuilt, bool writeToDisk)
+{
+    // equalization modifies the neighbouring tiles too, so it's always done from the thread driving the build.
+    log(osg::NOTICE, "   equalizing tile level=%u X=%u Y=%u",tile->_level,tile->_tileX,tile->_tileY);
+    tile->equalizeBoundaries();
+    tile->setTileComplete(true);
+
+    CompositeDestination* cd = tile->_parent;
+    for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
+        titr!=cd->_tiles.end();
+        ++titr)
+    {
+        if (!(*titr)->getTileComplete()) return;
+    }
+
+    // with the last of the composite's tiles complete, the parent's set aside tiles are ready to read once all its children are.
+    TilesWaitingOnChildren::WaitingMap::iterator witr = waitingOnChildren.waiting.find(cd->_parent);
+    if (witr!=waitingOnChildren.waiting.end() && cd->_parent->areSubTilesComplete())
+    {
+        waitingOnChildren.ready.insert(waitingOnChildren.ready.end(), witr->second.begin(), witr->second.end());
+        waitingOnChildren.waiting.erase(witr);
     }
+
+    // a parent built from its children needs their data until it has been read, _tileRead() writes them after that.
+    if (writeToDisk && !_isBuiltFromChildren(cd->_parent, levelsBuilt)) _writeCompositeDestination(cd);
+}
+
+bool DataSet::_isBuiltFromChildren(CompositeDestination* cd, const LevelSet& levelsBuilt) const
+{
+    // only when building bottom up, and both the composite's level and its children's are being built.
+    return getBottomUpPyramid() && cd && !cd->_children.empty() &&
+           levelsBuilt.count(cd->_level)!=0 && levelsBuilt.count(cd->_level+1)!=0;
 }
 
 void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename)
@@ -1747,6 +2207,9 @@ class WriteOperation : public BuildOperation
                 
                 _dataset->_writeNodeFileAndImages(*node,_filename);
 
+                // let go of the written scene so the tiles' buffers can go back to the pool.
+                node = 0;
+
                 _cd->setSubTilesGenerated(true);
                 _cd->unrefSubTileData();
             }
@@ -1763,120 +2226,116 @@ class WriteOperation : public BuildOperation
 
 #define NEW_NAMING
 
-void DataSet::_writeRow(Row& row)
+void DataSet::_writeCompositeDestination(CompositeDestination* cd)
 {
-    log(osg::NOTICE, "_writeRow %u",row.size());
-    for(Row::iterator citr=row.begin();
-        citr!=row.end();
-        ++citr)
+    CompositeDestination* parent = cd->_parent;
+    
+    if (parent)
     {
-        CompositeDestination* cd = citr->second;
-        CompositeDestination* parent = cd->_parent;
-        
-        if (parent)
+        if (!parent->getSubTilesGenerated() && parent->areSubTilesComplete())
         {
-            if (!parent->getSubTilesGenerated() && parent->areSubTilesComplete())
-            {
-                parent->setSubTilesGenerated(true);
+            parent->setSubTilesGenerated(true);
 
 #ifdef NEW_NAMING
-                std::string filename = cd->getTileFileName();
+            std::string filename = cd->getTileFileName();
 #else
-                std::string filename = _taskOutputDirectory+parent->getSubTileName();
+            std::string filename = _taskOutputDirectory+parent->getSubTileName();
 #endif
-                log(osg::NOTICE, "       _taskOutputDirectory= %s",_taskOutputDirectory.c_str());
+            log(osg::NOTICE, "       _taskOutputDirectory= %s",_taskOutputDirectory.c_str());
 
-                if (_writeThreadPool.valid())
-                {
-                    _writeThreadPool->run(new WriteOperation(_writeThreadPool.get(), this, parent, filename));
-                }
-                else
+            if (_writeThreadPool.valid())
+            {
+                osg::ref_ptr<WriteOperation> operation = new WriteOperation(_writeThreadPool.get(), this, parent, filename);
+
+                // compress and write the tiles on the write thread paired with the read thread that read them, so the
+                // tiles each read thread works through, neighbours and siblings alike, stay together.
+                operation->setAffinityHint(getChildrenReadWorker(parent));
+
+                _writeThreadPool->run(operation.get());
+            }
+            else
+            {
+                osg::ref_ptr<osg::Node> node = parent->createSubTileScene();
+                if (node.valid())
                 {
-                    osg::ref_ptr<osg::Node> node = parent->createSubTileScene();
-                    if (node.valid())
-                    {
-                        log(osg::NOTICE, "   writeSubTile filename= %s",filename.c_str());
-                        _writeNodeFileAndImages(*node,filename);
+                    log(osg::NOTICE, "   writeSubTile filename= %s",filename.c_str());
+                    _writeNodeFileAndImages(*node,filename);
 
+                    // let go of the written scene so the tiles' buffers can go back to the pool.
+                    node = 0;
 
-                        parent->setSubTilesGenerated(true);
-                        parent->unrefSubTileData();
+                    parent->setSubTilesGenerated(true);
+                    parent->unrefSubTileData();
 
-                    }
-                    else
-                    {
-                        log(osg::WARN, "   failed to writeSubTile node for tile, filename=%s",filename.c_str());
-                    }
+                }
+                else
+                {
+                    log(osg::WARN, "   failed to writeSubTile node for tile, filename=%s",filename.c_str());
                 }
             }
         }
-        else
-        {
-            osg::ref_ptr<osg::Node> node = cd->createPagedLODScene();
-            
+    }
+    else
+    {
+        osg::ref_ptr<osg::Node> node = cd->createPagedLODScene();
+        
 #ifdef NEW_NAMING
-            std::string filename = cd->getTileFileName();
+        std::string filename = cd->getTileFileName();
 #else
-            std::string filename;
+        std::string filename;
 #endif
 
-            if (cd->_level==0)
-            {
+        if (cd->_level==0)
+        {
 
 #ifndef NEW_NAMING
-                filename = getDirectory() + _tileBasename + _tileExtension;
+            filename = getDirectory() + _tileBasename + _tileExtension;
 #endif
-                if (_decorateWithMultiTextureControl)
-                {
-                    node = decorateWithMultiTextureControl(node.get());
-                }
-
-                if (getGeometryType()==TERRAIN)
-                {
-                    node = decorateWithTerrain(node.get());
-                }
-                else if (_decorateWithCoordinateSystemNode)
-                {
-                    node = decorateWithCoordinateSystemNode(node.get());
-                }
-
-                if (!_comment.empty())
-                {
-                    node->addDescription(_comment);
-                }
-
-                log(osg::NOTICE, "       getDirectory()= %s",getDirectory().c_str());
-            }
-            else
+            if (_decorateWithMultiTextureControl)
             {
-#ifndef NEW_NAMING
-                filename = _taskOutputDirectory + _tileBasename + _tileExtension;
-#endif
-
-                log(osg::NOTICE, "       _taskOutputDirectory= %s",_taskOutputDirectory.c_str());
+                node = decorateWithMultiTextureControl(node.get());
             }
 
-            if (node.valid())
+            if (getGeometryType()==TERRAIN)
             {
-                log(osg::NOTICE, "   writeNodeFile = %u X=%u Y=%u filename=%s",cd->_level,cd->_tileX,cd->_tileY,filename.c_str());
-
-                _writeNodeFileAndImages(*node,filename);
+                node = decorateWithTerrain(node.get());
             }
-            else
+            else if (_decorateWithCoordinateSystemNode)
             {
-                log(osg::WARN, "   faild to write node for tile = %u X=%u Y=%u filename=%s",cd->_level,cd->_tileX,cd->_tileY,filename.c_str());
+                node = decorateWithCoordinateSystemNode(node.get());
             }
 
-            // record the top nodes as the rootNode of the database
-            _rootNode = node;
+            if (!_comment.empty())
+            {
+                node->addDescription(_comment);
+            }
 
+            log(osg::NOTICE, "       getDirectory()= %s",getDirectory().c_str());
         }
-    }
-
-#if 0
-    if (_writeThreadPool.valid()) _writeThreadPool->waitForCompletion();
+        else
+        {
+#ifndef NEW_NAMING
+            filename = _taskOutputDirectory + _tileBasename + _tileExtension;
 #endif
 
+            log(osg::NOTICE, "       _taskOutputDirectory= %s",_taskOutputDirectory.c_str());
+        }
+
+        if (node.valid())
+        {
+            log(osg::NOTICE, "   writeNodeFile = %u X=%u Y=%u filename=%s",cd->_level,cd->_tileX,cd->_tileY,filename.c_str());
+
+            _writeNodeFileAndImages(*node,filename);
+        }
+        else
+        {
+            log(osg::WARN, "   faild to write node for tile = %u X=%u Y=%u filename=%s",cd->_level,cd->_tileX,cd->_tileY,filename.c_str());
+        }
+
+        // record the top nodes as the rootNode of the database
+        _rootNode = node;
+
+    }
 }
 
 void DataSet::createDestination(unsigned int numLevels)
@@ -2031,51 +2490,24 @@ void DataSet::_buildDestination(bool writeToDisk)
         else  // _databaseType==PagedLOD_DATABASE
         {
 
-            // for each level build read and write the rows.
-            for(QuadMap::iterator qitr=_quadMap.begin();
-                qitr!=_quadMap.end();
-                ++qitr)
+            LevelNumbers levelNumbers;
+            for(unsigned int l=0; l<_quadMap.getNumLevels(); ++l)
             {
-                Level& level = qitr->second;
-                
                 // skip is level is empty.
-                if (level.empty()) continue;
+                if (_quadMap.getNumComposites(l)==0) continue;
                 
                 // skip lower levels if we are generating subtiles
-                if (getGenerateSubtile() && qitr->first<=getSubtileLevel()) continue;
+                if (getGenerateSubtile() && l<=getSubtileLevel()) continue;
                 
-                if (getRecordSubtileFileNamesOnLeafTile() && qitr->first>=getMaximumNumOfLevels()) continue;
+                if (getRecordSubtileFileNamesOnLeafTile() && l>=getMaximumNumOfLevels()) continue;
 
-                log(osg::INFO, "New level");
-
-                Level::iterator prev_itr = level.begin();
-                _readRow(prev_itr->second);
-                Level::iterator curr_itr = prev_itr;
-                ++curr_itr;
-                for(;
-                    curr_itr!=level.end();
-                    ++curr_itr)
-                {
-                    _readRow(curr_itr->second);
-                    
-                    _equalizeRow(prev_itr->second);
-                    if (writeToDisk) _writeRow(prev_itr->second);
-                    
-                    prev_itr = curr_itr;
-                }
-                
-                _equalizeRow(prev_itr->second);
-                
-                if (writeToDisk)
-                {
-                    if (writeToDisk) _writeRow(prev_itr->second);
-                }
-
-#if 0
-                if (_writeThreadPool.valid()) _writeThreadPool->waitForCompletion();
-#endif
+                levelNumbers.push_back(l);
             }
 
+            // read, equalize and write the tiles of all the levels, each tile moving on as soon as its neighbours
+            // have been read rather than waiting on whole rows.
+            _buildTiles(levelNumbers, writeToDisk);
+
         }
 
         if (_archive.valid())
@@ -2575,9 +3007,15 @@ bool DataSet::createTileMap(unsigned int level, TilePairMap& tilepairMap)
     unsigned int maxNumLevels = getMaximumNumOfLevels();
                                   
     // first populate the destination graph from imagery and DEM sources extents/resolution
-    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    // only the sources that overlap the destination extents can contribute.
+    SourceIndex::Sources sources;
+    _sourceGraph->getIntersectingSources(cs, extents, sources);
+
+    for(SourceIndex::Sources::iterator itr = sources.begin();
+        itr != sources.end();
+        ++itr)
     {
-        Source* source = (*itr).get();
+        Source* source = *itr;
 
 #if 1
         if (source->getPatchStatus()==Source::UNCHANGED)
@@ -2592,13 +3030,8 @@ bool DataSet::createTileMap(unsigned int level, TilePairMap& tilepairMap)
             continue;
         }
 
-        SourceData* sd = (*itr)->getSourceData();
-        if (!sd)
-        {
-            log(osg::NOTICE,"Skipping source %s as no data loaded from it.",source->getFileName().c_str());
-            continue;
-        }
-        
+        SourceData* sd = source->getSourceData();
+
         const SpatialProperties& sp = sd->computeSpatialProperties(cs);
 
         if (!sp._extents.intersects(extents))
@@ -3132,6 +3565,37 @@ int DataSet::run()
     return result;
 }
 
+// return true if any layer's imagery is compressed, or mipmapped by the compressor rather than on the CPU.
+static bool imageryRequiresCompressor(const BuildOptions& buildOptions)
+{
+    std::vector<const ImageOptions*> imageOptionsList;
+    imageOptionsList.push_back(&buildOptions);
+    for(unsigned int i=0; i<buildOptions.getNumLayerImageOptions(); ++i)
+    {
+        if (buildOptions.getLayerImageOptions(i)) imageOptionsList.push_back(buildOptions.getLayerImageOptions(i));
+    }
+
+    for(std::vector<const ImageOptions*>::iterator itr = imageOptionsList.begin();
+        itr != imageOptionsList.end();
+        ++itr)
+    {
+        switch((*itr)->getTextureType())
+        {
+            case(BuildOptions::RGB_24):
+            case(BuildOptions::RGBA):
+            case(BuildOptions::RGB_16):
+            case(BuildOptions::RGBA_16):
+                break;
+            default:
+                return true;
+        }
+
+        if ((*itr)->getMipMappingMode()==BuildOptions::MIP_MAPPING_IMAGERY &&
+            buildOptions.getMipMapMethod()==BuildOptions::COMPRESSOR_MIPMAPS) return true;
+    }
+    return false;
+}
+
 int DataSet::_run()
 {
     
@@ -3141,12 +3605,19 @@ int DataSet::_run()
     bool requiresGraphicsContextInWritingThread = true;
 
     osgDB::ImageProcessor* imageProcessor = osgDB::Registry::instance()->getImageProcessor();
-    if (imageProcessor)
+    if (getCompressionMethod() == vpb::BuildOptions::CPU || !imageryRequiresCompressor(*this))
+    {
+        requiresGraphicsContextInMainThread = false;
+        requiresGraphicsContextInWritingThread = false;
+    }
+    else if (imageProcessor)
     {
         requiresGraphicsContextInMainThread = (getCompressionMethod() == vpb::BuildOptions::GL_DRIVER);
         requiresGraphicsContextInWritingThread = (getCompressionMethod() == vpb::BuildOptions::GL_DRIVER);
     }
 
+    System::instance()->getSourceBlockCache()->setMaximumNumBytes((unsigned long long)getSourceBlockCacheSize()*1024*1024);
+
     int numProcessors = OpenThreads::GetNumberOfProcessors();
 #if 0
     if (numProcessors>1)
@@ -3316,6 +3787,13 @@ int DataSet::_run()
         log(osg::NOTICE,"Task output directory = %s", _taskOutputDirectory.c_str());
 
         writeDestination();
+
+        System::instance()->getDatasetCache()->reportStatistics();
+        System::instance()->getSourceBlockCache()->reportStatistics();
+        System::instance()->getBufferPool()->reportStatistics();
+
+        if (_readThreadPool.valid()) _readThreadPool->reportStatistics("Read");
+        if (_writeThreadPool.valid()) _writeThreadPool->reportStatistics("Write");
     }
 
     return 0;
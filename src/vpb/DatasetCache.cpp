@@ -0,0 +1,437 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/DatasetCache>
+#include <vpb/BuildLog>
+#include <vpb/System>
+
+#include <osg/Math>
+
+#include <OpenThreads/ScopedLock>
+
+#include <sstream>
+
+using namespace vpb;
+
+DatasetCache::DatasetCache(unsigned int numShards):
+    _maxNumDatasets(1024),
+    _maxNumDatasetsPerFile(1),
+    _maxNumBytes(0),
+    _numDatasetsToTrim(10),
+    _trimOldest(true),
+    _numDatasets(0),
+    _numBytes(0),
+    _nextShardToTrim(0)
+{
+    if (numShards==0) numShards = 1;
+    for(unsigned int i=0; i<numShards; ++i)
+    {
+        _shards.push_back(new Shard);
+    }
+}
+
+DatasetCache::~DatasetCache()
+{
+    for(Shards::iterator itr = _shards.begin();
+        itr != _shards.end();
+        ++itr)
+    {
+        delete *itr;
+    }
+}
+
+unsigned int DatasetCache::computeHash(const FileNameAccessModePair& key)
+{
+    // simple FNV-1a hash of the filename and access mode
+    unsigned int hash = 2166136261u;
+    for(std::string::const_iterator itr = key.first.begin();
+        itr != key.first.end();
+        ++itr)
+    {
+        hash = (hash ^ (unsigned char)(*itr)) * 16777619u;
+    }
+    return (hash ^ (unsigned int)key.second) * 16777619u;
+}
+
+DatasetCache::Shard& DatasetCache::getShard(unsigned int hash)
+{
+    return *_shards[hash % _shards.size()];
+}
+
+static unsigned int computeBucket(unsigned int hash, unsigned int mask)
+{
+    // the low bits of the hash pick the shard, so Fibonacci hashing takes the bucket from all of them.
+    return static_cast<unsigned int>(((unsigned long long)hash * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+DatasetCache::KeyEntries* DatasetCache::getKeyEntries(Shard& shard, const FileNameAccessModePair& key, unsigned int hash)
+{
+    if (!shard._keyTable.empty())
+    {
+        KeyEntriesList& bucket = shard._keyTable[computeBucket(hash, shard._keyTable.size()-1)];
+        for(KeyEntriesList::iterator itr = bucket.begin();
+            itr != bucket.end();
+            ++itr)
+        {
+            if (itr->_hash==hash && itr->_key==key) return &(*itr);
+        }
+    }
+
+    // keep at most one key per bucket on average so chains stay short.
+    if (shard._numKeys+1 > shard._keyTable.size())
+    {
+        KeyEntriesTable keyTable(osg::maximum(static_cast<unsigned int>(shard._keyTable.size())*2, 16u));
+        for(KeyEntriesTable::iterator titr = shard._keyTable.begin();
+            titr != shard._keyTable.end();
+            ++titr)
+        {
+            while(!titr->empty())
+            {
+                KeyEntriesList& bucket = keyTable[computeBucket(titr->front()._hash, keyTable.size()-1)];
+                bucket.splice(bucket.end(), *titr, titr->begin());
+            }
+        }
+        shard._keyTable.swap(keyTable);
+    }
+
+    KeyEntriesList& bucket = shard._keyTable[computeBucket(hash, shard._keyTable.size()-1)];
+    bucket.push_back(KeyEntries(key, hash));
+    ++shard._numKeys;
+
+    return &(bucket.back());
+}
+
+void DatasetCache::releaseKeyEntries(Shard& shard, KeyEntries* keyEntries)
+{
+    if (!keyEntries->_entries.empty() || keyEntries->_numOpening!=0) return;
+
+    KeyEntriesList& bucket = shard._keyTable[computeBucket(keyEntries->_hash, shard._keyTable.size()-1)];
+    for(KeyEntriesList::iterator itr = bucket.begin();
+        itr != bucket.end();
+        ++itr)
+    {
+        if (&(*itr)==keyEntries)
+        {
+            bucket.erase(itr);
+            --shard._numKeys;
+            return;
+        }
+    }
+}
+
+void DatasetCache::addToTotals(int numDatasets, long long numBytes)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_totalsMutex);
+    _numDatasets += numDatasets;
+    _numBytes += numBytes;
+}
+
+bool DatasetCache::overBudget() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_totalsMutex);
+    if (_numDatasets>=_maxNumDatasets) return true;
+    return (_maxNumBytes!=0 && _numBytes>=_maxNumBytes);
+}
+
+void DatasetCache::erase(Shard& shard, EntryList::iterator itr)
+{
+    KeyEntries* keyEntries = itr->_keyEntries;
+    EntryIterators& entries = keyEntries->_entries;
+    for(EntryIterators::iterator eitr = entries.begin();
+        eitr != entries.end();
+        ++eitr)
+    {
+        if (*eitr == itr)
+        {
+            entries.erase(eitr);
+            break;
+        }
+    }
+
+    addToTotals(-1, -(long long)(itr->_numBytes));
+
+    shard._entries.erase(itr);
+
+    releaseKeyEntries(shard, keyEntries);
+}
+
+osg::ref_ptr<GeospatialDataset> DatasetCache::open(const std::string& filename, AccessMode accessMode)
+{
+    return open(FileNameAccessModePair(filename, accessMode), filename, std::string(), std::string(), 0.0);
+}
+
+osg::ref_ptr<GeospatialDataset> DatasetCache::openWarped(const std::string& filename, const std::string& sourceWKT, const std::string& destinationWKT, double errorThreshold)
+{
+    // newlines can't appear in filenames, so this key can't collide with that of an unwarped file.
+    std::ostringstream keyName;
+    keyName<<filename<<"\n"<<sourceWKT<<"\n"<<destinationWKT<<"\n"<<errorThreshold;
+
+    return open(FileNameAccessModePair(keyName.str(), READ_ONLY), filename, sourceWKT, destinationWKT, errorThreshold);
+}
+
+osg::ref_ptr<GeospatialDataset> DatasetCache::open(const FileNameAccessModePair& key, const std::string& filename,
+                                                   const std::string& sourceWKT, const std::string& destinationWKT, double errorThreshold)
+{
+    AccessMode accessMode = key.second;
+    unsigned int hash = computeHash(key);
+    Shard& shard = getShard(hash);
+
+    // handles that are being opened count towards the limit, so there's always at least one per file.
+    unsigned int maxNumDatasetsPerFile = osg::maximum(_maxNumDatasetsPerFile, 1u);
+
+    KeyEntries* keyEntries = 0;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard._mutex);
+
+        for(;;)
+        {
+            keyEntries = getKeyEntries(shard, key, hash);
+
+            EntryIterators& entries = keyEntries->_entries;
+            EntryIterators::iterator leastUsed = entries.end();
+            for(EntryIterators::iterator eitr = entries.begin();
+                eitr != entries.end();
+                ++eitr)
+            {
+                GeospatialDataset* dataset = (*eitr)->_dataset.get();
+
+                // only the cache holds a reference so it's free for this thread to use
+                if (dataset->referenceCount()==1)
+                {
+                    leastUsed = eitr;
+                    break;
+                }
+
+                if (leastUsed==entries.end() || dataset->referenceCount()<(*leastUsed)->_dataset->referenceCount()) leastUsed = eitr;
+            }
+
+            // writable datasets are always shared, as are read only datasets once the per file limit is reached,
+            // callers serialize their access to shared handles via GeospatialDataset::getMutex().
+            unsigned int numHandles = entries.size() + keyEntries->_numOpening;
+            bool share = accessMode==READ_AND_WRITE ? numHandles>0 : numHandles>=maxNumDatasetsPerFile;
+
+            if (leastUsed!=entries.end() && ((*leastUsed)->_dataset->referenceCount()==1 || share))
+            {
+                ++shard._numHits;
+
+                // move to the front of the LRU list.
+                shard._entries.splice(shard._entries.begin(), shard._entries, *leastUsed);
+
+                return (*leastUsed)->_dataset;
+            }
+
+            if (!share) break;
+
+            // the only handles to share are still being opened by other threads, so wait for them.
+            shard._opened.wait(&shard._mutex);
+        }
+
+        // reserve the handle while the shard is locked so that concurrent opens can't exceed the per file limit.
+        ++keyEntries->_numOpening;
+        ++shard._numMisses;
+    }
+
+    // make sure there is room available for this new dataset
+    if (overBudget()) trim(_numDatasetsToTrim);
+
+    // double check to make sure there is room to open a new dataset, opening it outside of the shard lock as
+    // GDALOpen can be slow.
+    osg::ref_ptr<GeospatialDataset> dataset;
+    unsigned long long numBytes = 0;
+    if (!overBudget())
+    {
+        dataset = destinationWKT.empty() ?
+            new GeospatialDataset(filename, accessMode) :
+            new GeospatialDataset(filename, sourceWKT, destinationWKT, errorThreshold);
+
+        if (dataset->getGDALDataset()) numBytes = System::instance()->getFileSize(filename);
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard._mutex);
+
+    --keyEntries->_numOpening;
+    shard._opened.broadcast();
+
+    if (!dataset)
+    {
+        // fall back to sharing any existing handle on this file.
+        if (!keyEntries->_entries.empty()) return keyEntries->_entries.front()->_dataset;
+
+        releaseKeyEntries(shard, keyEntries);
+
+        log(osg::NOTICE,"Error: System::GDALOpen(%s) unable to open file as unsufficient file handles available.",filename.c_str());
+        return 0;
+    }
+
+    // don't hold on to file handles that failed to open.
+    if (!dataset->getGDALDataset())
+    {
+        releaseKeyEntries(shard, keyEntries);
+        return dataset;
+    }
+
+    // the key includes any warp, so a warped dataset's blocks are never confused with those of the file or other warps.
+    dataset->setBlockCacheKey(key.first);
+
+    shard._entries.push_front(Entry(keyEntries, dataset.get(), numBytes));
+    keyEntries->_entries.push_back(shard._entries.begin());
+
+    addToTotals(1, (long long)numBytes);
+
+    return dataset;
+}
+
+DatasetCache::TrimResult DatasetCache::trimOne(Shard& shard)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard._mutex);
+
+    if (shard._entries.empty()) return SHARD_EMPTY;
+
+    EntryList::iterator itr = _trimOldest ? --shard._entries.end() : shard._entries.begin();
+    if (itr->_dataset->referenceCount()==1)
+    {
+        erase(shard, itr);
+        ++shard._numEvictions;
+        return ENTRY_EVICTED;
+    }
+
+    // still in use, so move it out of the way of the entries that may not be.
+    if (_trimOldest) shard._entries.splice(shard._entries.begin(), shard._entries, itr);
+    else shard._entries.splice(shard._entries.end(), shard._entries, itr);
+
+    return ENTRY_IN_USE;
+}
+
+unsigned int DatasetCache::trim(unsigned int numToTrim)
+{
+    unsigned int startShard;
+    unsigned int maxNumExamined;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_totalsMutex);
+        startShard = _nextShardToTrim;
+        _nextShardToTrim = (_nextShardToTrim+1) % _shards.size();
+        maxNumExamined = _numDatasets;
+    }
+
+    // visit the shards round robin, looking at one entry from each per pass so that no single shard is emptied first,
+    // only one shard lock is held at any time. Entries in use are moved out of the way as they're looked at, so
+    // give up once as many entries as are open have been looked at.
+    unsigned int numTrimmed = 0;
+    unsigned int numExamined = 0;
+    bool examinedInPass = true;
+    while(numTrimmed<numToTrim && numExamined<maxNumExamined && examinedInPass)
+    {
+        examinedInPass = false;
+        for(unsigned int i=0; i<_shards.size() && numTrimmed<numToTrim && numExamined<maxNumExamined; ++i)
+        {
+            TrimResult result = trimOne(*_shards[(startShard+i) % _shards.size()]);
+            if (result==SHARD_EMPTY) continue;
+
+            if (result==ENTRY_EVICTED) ++numTrimmed;
+            ++numExamined;
+            examinedInPass = true;
+        }
+    }
+
+    return numTrimmed;
+}
+
+void DatasetCache::clear()
+{
+    for(Shards::iterator itr = _shards.begin();
+        itr != _shards.end();
+        ++itr)
+    {
+        Shard& shard = *(*itr);
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard._mutex);
+
+        unsigned long long numBytes = 0;
+        for(EntryList::iterator eitr = shard._entries.begin();
+            eitr != shard._entries.end();
+            ++eitr)
+        {
+            numBytes += eitr->_numBytes;
+        }
+
+        addToTotals(-(int)shard._entries.size(), -(long long)numBytes);
+
+        shard._entries.clear();
+
+        // keep the keys that handles are being opened on, open() still refers to them.
+        for(KeyEntriesTable::iterator titr = shard._keyTable.begin();
+            titr != shard._keyTable.end();
+            ++titr)
+        {
+            for(KeyEntriesList::iterator kitr = titr->begin();
+                kitr != titr->end();)
+            {
+                kitr->_entries.clear();
+                if (kitr->_numOpening==0)
+                {
+                    kitr = titr->erase(kitr);
+                    --shard._numKeys;
+                }
+                else
+                {
+                    ++kitr;
+                }
+            }
+        }
+    }
+}
+
+DatasetCache::Statistics DatasetCache::getStatistics() const
+{
+    Statistics statistics;
+    for(Shards::const_iterator itr = _shards.begin();
+        itr != _shards.end();
+        ++itr)
+    {
+        const Shard& shard = *(*itr);
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard._mutex);
+        statistics.numHits += shard._numHits;
+        statistics.numMisses += shard._numMisses;
+        statistics.numEvictions += shard._numEvictions;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_totalsMutex);
+    statistics.numDatasets = _numDatasets;
+    statistics.numBytes = _numBytes;
+
+    return statistics;
+}
+
+void DatasetCache::resetStatistics()
+{
+    for(Shards::iterator itr = _shards.begin();
+        itr != _shards.end();
+        ++itr)
+    {
+        Shard& shard = *(*itr);
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard._mutex);
+        shard._numHits = 0;
+        shard._numMisses = 0;
+        shard._numEvictions = 0;
+    }
+}
+
+void DatasetCache::reportStatistics() const
+{
+    Statistics statistics = getStatistics();
+    unsigned int numRequests = statistics.numHits + statistics.numMisses;
+    double hitRatio = numRequests>0 ? double(statistics.numHits)/double(numRequests) : 0.0;
+
+    log(osg::NOTICE,"Dataset cache: hits=%u misses=%u (hit ratio %.1f%%) evictions=%u open datasets=%u open bytes=%llu",
+        statistics.numHits, statistics.numMisses, hitRatio*100.0, statistics.numEvictions,
+        statistics.numDatasets, statistics.numBytes);
+}
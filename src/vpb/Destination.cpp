@@ -16,6 +16,10 @@
 #include <vpb/Destination>
 #include <vpb/DataSet>
 #include <vpb/TextureUtils>
+#include <vpb/ImageUtils>
+#include <vpb/HeightFieldSimplifier>
+#include <vpb/GeometryOptimizer>
+#include <vpb/System>
 
 #include <osg/Texture2D>
 #include <osg/ShapeDrawable>
@@ -31,7 +35,8 @@
 #include <osgDB/FileNameUtils>
 
 #include <osgUtil/SmoothingVisitor>
-#include <osgUtil/Simplifier>
+
+#include <algorithm>
 
 using namespace vpb;
 
@@ -84,7 +89,10 @@ DestinationTile::DestinationTile():
     _terrain_maxNumRows(1024),
     _terrain_maxSourceResolutionX(0.0f),
     _terrain_maxSourceResolutionY(0.0f),
-    _complete(false)
+    _complete(false),
+    _dataFromChildren(false),
+    _readWorker(-1),
+    _numBytesAccounted(0)
 {
     for(int i=0;i<NUMBER_OF_POSITIONS;++i)
     {
@@ -216,10 +224,16 @@ void DestinationTile::computeMaximumSourceResolution(Source* source)
 
 void DestinationTile::computeMaximumSourceResolution(CompositeSource* sourceGraph)
 {
-    for(CompositeSource::source_iterator itr(sourceGraph);itr.valid();++itr)
+    if (!sourceGraph) return;
+
+    SourceIndex::Sources sources;
+    sourceGraph->getIntersectingSources(_cs.get(), _extents, sources);
+
+    for(SourceIndex::Sources::iterator itr = sources.begin();
+        itr != sources.end();
+        ++itr)
     {
-        Source* source = itr->get();
-        computeMaximumSourceResolution(source);
+        computeMaximumSourceResolution(*itr);
     }
 }
 
@@ -373,8 +387,6 @@ void DestinationTile::allocate()
                                             _extents.xMin(), _extents.yMax(),   0.0,1.0);
 
 
-                imageData._imageDestination->_image = new osg::Image;
-
                 osg::Image::WriteHint writeHint = osg::Image::NO_PREFERENCE;
                 std::string imageName = _name;
                 
@@ -409,16 +421,11 @@ void DestinationTile::allocate()
 
                 _dataSet->log(osg::NOTICE,"imageName = %s",imageName.c_str());
 
+                // take zeroed storage from the pool, it's handed back when the image is deleted.
+                imageData._imageDestination->_image = new PooledImage(System::instance()->getBufferPool(),
+                                                                      texture_numColumns,texture_numRows,getPixelFormat(layerNum),GL_UNSIGNED_BYTE);
                 imageData._imageDestination->_image->setFileName(imageName.c_str());
                 imageData._imageDestination->_image->setWriteHint(writeHint);
-
-                imageData._imageDestination->_image->allocateImage(texture_numColumns,texture_numRows,1,getPixelFormat(layerNum),GL_UNSIGNED_BYTE);
-                unsigned char* data = imageData._imageDestination->_image->data();
-                unsigned int totalSize = imageData._imageDestination->_image->getTotalSizeInBytesIncludingMipmaps();
-                for(unsigned int i=0;i<totalSize;++i)
-                {
-                    *(data++) = 0;
-                }
             }
         }
     }
@@ -435,6 +442,7 @@ void DestinationTile::allocate()
                                     0.0,             0.0,               1.0,1.0,
                                     _extents.xMin(), _extents.yMax(),   0.0,1.0);
         _terrain->_heightField = new osg::HeightField;
+        _terrain->_heightField->setFloatArray(System::instance()->getBufferPool()->acquireFloatArray(dem_numColumns*dem_numRows));
         _terrain->_heightField->allocate(dem_numColumns,dem_numRows);
         _terrain->_heightField->setOrigin(osg::Vec3(_extents.xMin(),_extents.yMin(),0.0f));
         _terrain->_heightField->setXInterval(dem_dx);
@@ -448,6 +456,34 @@ void DestinationTile::allocate()
 
     }
 
+    // account for the tile's data against the build's memory budget, until unrefData() releases it.
+    unsigned long long numBytes = getNumBytesAllocated();
+    _dataSet->accountTileMemory((long long)numBytes - (long long)_numBytesAccounted);
+    _numBytesAccounted = numBytes;
+}
+
+unsigned long long DestinationTile::getNumBytesAllocated() const
+{
+    unsigned long long numBytes = 0;
+    for(std::vector<ImageSet>::const_iterator litr = _imageLayerSet.begin();
+        litr != _imageLayerSet.end();
+        ++litr)
+    {
+        for(ImageSet::LayerSetImageDataMap::const_iterator itr = litr->_layerSetImageDataMap.begin();
+            itr != litr->_layerSetImageDataMap.end();
+            ++itr)
+        {
+            const DestinationData* data = itr->second._imageDestination.get();
+            if (data && data->_image.valid()) numBytes += data->_image->getTotalSizeInBytesIncludingMipmaps();
+        }
+    }
+
+    if (_terrain.valid() && _terrain->_heightField.valid())
+    {
+        numBytes += _terrain->_heightField->getHeightList().size()*sizeof(float);
+    }
+
+    return numBytes;
 }
 
 void DestinationTile::computeNeighboursFromQuadMap()
@@ -1224,6 +1260,13 @@ struct QuantizeOperator
     mutable Errors              _nextRow;
 };
 
+// hand a pooled image's buffer back as soon as quantization, compression or mipmapping have replaced its data.
+static void releaseReplacedImageData(osg::Image* image)
+{
+    PooledImage* pooledImage = dynamic_cast<PooledImage*>(image);
+    if (pooledImage) pooledImage->releaseReplacedData();
+}
+
 osg::StateSet* DestinationTile::createStateSet()
 {
     if (_stateset.valid()) return _stateset.get();
@@ -1297,15 +1340,6 @@ osg::StateSet* DestinationTile::createStateSet()
         bool compressedImageSupported = inlineImageFile || imageExtension=="dds";
         bool mipmapImageSupported = compressedImageSupported; // inlineImageFile;
         
-        
-        if (getImageOptions(layerNum)->getImageryQuantization()!=0 &&
-            getImageOptions(layerNum)->getImageryQuantization()<8)
-        {
-            
-            log(osg::NOTICE,"Quantize image to %i bits",getImageOptions(layerNum)->getImageryQuantization());
-            osg::modifyImage(image, QuantizeOperator(image->s(), getImageOptions(layerNum)->getImageryQuantization(), getImageOptions(layerNum)->getImageryErrorDiffusion()));
-        }
-        
         // int minumCompressedTextureSize = 64;
         // int minumDXT3CompressedTextureSize = 256;
         
@@ -1325,14 +1359,47 @@ osg::StateSet* DestinationTile::createStateSet()
         bool compressedImageRequired = (internalFormatMode != osg::Texture::USE_IMAGE_DATA_FORMAT);
         //  image->s()>=minumCompressedTextureSize && image->t()>=minumCompressedTextureSize &&
 
-        if (compressedImageSupported && compressedImageRequired &&
-           (image->getPixelFormat()==GL_RGB || image->getPixelFormat()==GL_RGBA))
+        bool compressImage = compressedImageSupported && compressedImageRequired &&
+                             (image->getPixelFormat()==GL_RGB || image->getPixelFormat()==GL_RGBA);
+
+        // 16 bit textures are packed in the same pass as any quantization.
+        GLenum packedDataType = GL_UNSIGNED_BYTE;
+        if (!compressImage)
+        {
+            if (_dataSet->getTextureType()==DataSet::RGB_16 && image->getPixelFormat()==GL_RGB) packedDataType = GL_UNSIGNED_SHORT_5_6_5;
+            else if (_dataSet->getTextureType()==DataSet::RGBA_16 && image->getPixelFormat()==GL_RGBA) packedDataType = GL_UNSIGNED_SHORT_5_5_5_1;
+        }
+
+        unsigned int quantization = getImageOptions(layerNum)->getImageryQuantization();
+        if (quantization>=8) quantization = 0;
+
+        if (quantization!=0 || packedDataType!=GL_UNSIGNED_BYTE)
+        {
+            if (quantization!=0) log(osg::NOTICE,"Quantize image to %i bits",quantization);
+
+            if (!vpb::quantizeImage(*image, quantization, getImageOptions(layerNum)->getImageryErrorDiffusion(), packedDataType))
+            {
+                if (quantization!=0)
+                {
+                    osg::modifyImage(image, QuantizeOperator(image->s(), quantization, getImageOptions(layerNum)->getImageryErrorDiffusion()));
+                }
+                if (packedDataType!=GL_UNSIGNED_BYTE)
+                {
+                    image->scaleImage(image->s(),image->t(),image->r(),packedDataType);
+                }
+            }
+
+            releaseReplacedImageData(image);
+        }
+
+        if (compressImage)
         {
             log(osg::NOTICE,"Compressed image");
         
             bool generateMiMap = getImageOptions(layerNum)->getMipMappingMode()==DataSet::MIP_MAPPING_IMAGERY;
             bool resizePowerOfTwo = getImageOptions(layerNum)->getPowerOfTwoImages();
-            vpb::compress(*_dataSet->getState(),*texture,internalFormatMode,generateMiMap,resizePowerOfTwo,_dataSet->getCompressionMethod(),_dataSet->getCompressionQuality());
+            vpb::compress(*_dataSet->getState(),*texture,internalFormatMode,generateMiMap,resizePowerOfTwo,_dataSet->getCompressionMethod(),_dataSet->getCompressionQuality(),_dataSet->getCompressionNumThreads(),
+                          _dataSet->getMipMapFilter(),_dataSet->getMipMapLinearLight(),_dataSet->getMipMapNumThreads(),_dataSet->getMipMapMethod());
 
             log(osg::INFO,">>>>>>>>>>>>>>>compressed image.<<<<<<<<<<<<<<");
 
@@ -1341,26 +1408,20 @@ osg::StateSet* DestinationTile::createStateSet()
         {
             log(osg::NOTICE,"Non compressed image mipmapImageSupported=%i imageExtension=%s",mipmapImageSupported,imageExtension.c_str());
 
-            if (_dataSet->getTextureType()==DataSet::RGB_16 && image->getPixelFormat()==GL_RGB)
-            {
-                image->scaleImage(image->s(),image->t(),image->r(),GL_UNSIGNED_SHORT_5_6_5);
-            }
-            else if (_dataSet->getTextureType()==DataSet::RGBA_16 && image->getPixelFormat()==GL_RGBA)
-            {
-                image->scaleImage(image->s(),image->t(),image->r(),GL_UNSIGNED_SHORT_5_5_5_1);
-            }
-
             if (mipmapImageSupported && getImageOptions(layerNum)->getMipMappingMode()==DataSet::MIP_MAPPING_IMAGERY)
             {
                 log(osg::NOTICE,"Doing mipmapping");
 
                 bool resizePowerOfTwo = getImageOptions(layerNum)->getPowerOfTwoImages();
-                vpb::generateMipMap(*_dataSet->getState(),*texture,resizePowerOfTwo,_dataSet->getCompressionMethod());
+                vpb::generateMipMap(*_dataSet->getState(),*texture,resizePowerOfTwo,_dataSet->getCompressionMethod(),
+                                    _dataSet->getMipMapFilter(),_dataSet->getMipMapLinearLight(),_dataSet->getMipMapNumThreads(),_dataSet->getMipMapMethod());
 
                 log(osg::INFO,">>>>>>>>>>>>>>>mip mapped image.<<<<<<<<<<<<<<");
 
             }
         }
+
+        releaseReplacedImageData(image);
     }
     
     switch(_dataSet->getLayerInheritance())
@@ -1822,6 +1883,46 @@ static inline osg::Vec3 computeLocalSkirtVector(const osg::EllipsoidModel* et, c
     return gravitationVector * -length;
 }
 
+static osg::Vec3 computeGridVertex(const osg::EllipsoidModel* et, bool mapLatLongsToXYZ, bool useLocalToTileTransform, const osg::Matrixd& worldToLocal, double X, double Y, double Z)
+{
+    if (mapLatLongsToXYZ)
+    {
+        et->convertLatLongHeightToXYZ(osg::DegreesToRadians(Y),osg::DegreesToRadians(X),Z,
+                                     X,Y,Z);
+    }
+
+    if (useLocalToTileTransform) return computeLocalPosition(worldToLocal,X,Y,Z);
+    else return osg::Vec3(X,Y,Z);
+}
+
+// radius of the bounds of the grid's corners, edge midpoints and centre at its lowest and highest heights.
+static double computeGridRadius(const osg::EllipsoidModel* et, bool mapLatLongsToXYZ, const osg::HeightField* grid)
+{
+    float minHeight = grid->getHeight(0,0);
+    float maxHeight = minHeight;
+    for(unsigned int r=0; r<grid->getNumRows(); ++r)
+    {
+        for(unsigned int c=0; c<grid->getNumColumns(); ++c)
+        {
+            minHeight = osg::minimum(minHeight, grid->getHeight(c,r));
+            maxHeight = osg::maximum(maxHeight, grid->getHeight(c,r));
+        }
+    }
+
+    osg::BoundingBoxd bb;
+    for(unsigned int j=0; j<3; ++j)
+    {
+        for(unsigned int i=0; i<3; ++i)
+        {
+            double X = grid->getOrigin().x()+grid->getXInterval()*double(grid->getNumColumns()-1)*double(i)*0.5;
+            double Y = grid->getOrigin().y()+grid->getYInterval()*double(grid->getNumRows()-1)*double(j)*0.5;
+            bb.expandBy(computeGridVertex(et, mapLatLongsToXYZ, false, osg::Matrixd(), X, Y, minHeight));
+            bb.expandBy(computeGridVertex(et, mapLatLongsToXYZ, false, osg::Matrixd(), X, Y, maxHeight));
+        }
+    }
+    return bb.radius();
+}
+
 osg::Node* DestinationTile::createPolygonal()
 {
     log(osg::INFO,"--------- DestinationTile::createDrawableGeometry() ------------- ");
@@ -1886,8 +1987,35 @@ osg::Node* DestinationTile::createPolygonal()
     // compute sizes.
     unsigned int numColumns = grid->getNumColumns();
     unsigned int numRows = grid->getNumRows();
-    unsigned int numVerticesInBody = numColumns*numRows;
     unsigned int numVerticesInSkirt = createSkirt ? numColumns*2 + numRows*2 - 4 : 0;
+
+    // the vertex of each grid sample, a simplified terrain is triangulated straight from the grid and only uses some of them.
+    const unsigned int unusedSample = ~0u;
+    std::vector<unsigned int> vertexIndices(numColumns*numRows);
+    std::vector<unsigned int> gridTriangles;
+    bool simplifyTerrain = _dataSet->getSimplifyTerrain();
+    if (simplifyTerrain)
+    {
+        double maximumError = computeGridRadius(et, mapLatLongsToXYZ, grid.get()) / 2000.0;
+        triangulateHeightField(*grid, maximumError, gridTriangles);
+
+        std::fill(vertexIndices.begin(), vertexIndices.end(), unusedSample);
+        for(std::vector<unsigned int>::iterator itr = gridTriangles.begin();
+            itr != gridTriangles.end();
+            ++itr)
+        {
+            vertexIndices[*itr] = 0;
+        }
+    }
+
+    unsigned int numVerticesInBody = 0;
+    for(std::vector<unsigned int>::iterator itr = vertexIndices.begin();
+        itr != vertexIndices.end();
+        ++itr)
+    {
+        if (*itr!=unusedSample) *itr = numVerticesInBody++;
+    }
+
     unsigned int numVertices = numVerticesInBody+numVerticesInSkirt;
 
 
@@ -1997,25 +2125,14 @@ osg::Node* DestinationTile::createPolygonal()
     {
         for(c=0;c<numColumns;++c)
         {
+            if (vertexIndices[r*numColumns+c]==unusedSample) continue;
+
             double X = orig_X + delta_X*(double)c;
             double Y = orig_Y + delta_Y*(double)r;
             double Z = orig_Z + grid->getHeight(c,r);
             double height = Z;
 
-            if (mapLatLongsToXYZ)
-            {
-                et->convertLatLongHeightToXYZ(osg::DegreesToRadians(Y),osg::DegreesToRadians(X),Z,
-                                             X,Y,Z);
-            }
-
-            if (useLocalToTileTransform)
-            {
-                v[vi] = computeLocalPosition(_worldToLocal,X,Y,Z);
-            }
-            else
-            {
-                v[vi].set(X,Y,Z);
-            }
+            v[vi] = computeGridVertex(et, mapLatLongsToXYZ, useLocalToTileTransform, _worldToLocal, X, Y, Z);
 
 
             if (useClusterCullingCallback)
@@ -2047,8 +2164,28 @@ osg::Node* DestinationTile::createPolygonal()
             // note normal will need rotating.
             if (n.valid())
             {
-                (*n)[vi] = grid->getNormal(c,r);
-                
+                if (simplifyTerrain)
+                {
+                    // the simplified mesh is too coarse to smooth, so sum the normals of the grid cells around the sample.
+                    osg::Vec3 normal(0.0f,0.0f,0.0f);
+                    for(unsigned int cr=(r>0 ? r-1 : r); cr<=r && cr+1<numRows; ++cr)
+                    {
+                        for(unsigned int cc=(c>0 ? c-1 : c); cc<=c && cc+1<numColumns; ++cc)
+                        {
+                            osg::Vec3 v00 = computeGridVertex(et, mapLatLongsToXYZ, useLocalToTileTransform, _worldToLocal, orig_X + delta_X*(double)cc, orig_Y + delta_Y*(double)cr, orig_Z + grid->getHeight(cc,cr));
+                            osg::Vec3 v10 = computeGridVertex(et, mapLatLongsToXYZ, useLocalToTileTransform, _worldToLocal, orig_X + delta_X*(double)(cc+1), orig_Y + delta_Y*(double)cr, orig_Z + grid->getHeight(cc+1,cr));
+                            osg::Vec3 v01 = computeGridVertex(et, mapLatLongsToXYZ, useLocalToTileTransform, _worldToLocal, orig_X + delta_X*(double)cc, orig_Y + delta_Y*(double)(cr+1), orig_Z + grid->getHeight(cc,cr+1));
+                            osg::Vec3 v11 = computeGridVertex(et, mapLatLongsToXYZ, useLocalToTileTransform, _worldToLocal, orig_X + delta_X*(double)(cc+1), orig_Y + delta_Y*(double)(cr+1), orig_Z + grid->getHeight(cc+1,cr+1));
+                            normal += (v11-v00)^(v01-v10);
+                        }
+                    }
+                    normal.normalize();
+                    (*n)[vi] = normal;
+                }
+                else
+                {
+                    (*n)[vi] = grid->getNormal(c,r);
+                }
             }
 
             t[vi].x() = (c==numColumns-1)? 1.0f : (float)(c)/(float)(numColumns-1);
@@ -2100,53 +2237,66 @@ osg::Node* DestinationTile::createPolygonal()
         }
     }
     
-    osg::DrawElementsUInt& drawElements = *(new osg::DrawElementsUInt(GL_TRIANGLES,2*3*(numColumns-1)*(numRows-1)));
-    geometry->addPrimitiveSet(&drawElements);
-    int ei=0;
-    for(r=0;r<numRows-1;++r)
+    if (simplifyTerrain)
     {
-        for(c=0;c<numColumns-1;++c)
+        osg::DrawElementsUInt& drawElements = *(new osg::DrawElementsUInt(GL_TRIANGLES,gridTriangles.size()));
+        geometry->addPrimitiveSet(&drawElements);
+        for(unsigned int ei=0; ei<gridTriangles.size(); ++ei)
         {
-            unsigned int i00 = (r)*numColumns+c;
-            unsigned int i10 = (r)*numColumns+c+1;
-            unsigned int i01 = (r+1)*numColumns+c;
-            unsigned int i11 = (r+1)*numColumns+c+1;
-
-            float diff_00_11 = fabsf(v[i00].z()-v[i11].z());
-            float diff_01_10 = fabsf(v[i01].z()-v[i10].z());
-            if (diff_00_11<diff_01_10)
-            {
-                // diagonal between 00 and 11
-                drawElements[ei++] = i00;
-                drawElements[ei++] = i10;
-                drawElements[ei++] = i11;
-
-                drawElements[ei++] = i00;
-                drawElements[ei++] = i11;
-                drawElements[ei++] = i01;
-            }
-            else
+            drawElements[ei] = vertexIndices[gridTriangles[ei]];
+        }
+    }
+    else
+    {
+        osg::DrawElementsUInt& drawElements = *(new osg::DrawElementsUInt(GL_TRIANGLES,2*3*(numColumns-1)*(numRows-1)));
+        geometry->addPrimitiveSet(&drawElements);
+        int ei=0;
+        for(r=0;r<numRows-1;++r)
+        {
+            for(c=0;c<numColumns-1;++c)
             {
-                // diagonal between 01 and 10
-                drawElements[ei++] = i01;
-                drawElements[ei++] = i00;
-                drawElements[ei++] = i10;
-
-                drawElements[ei++] = i01;
-                drawElements[ei++] = i10;
-                drawElements[ei++] = i11;
+                unsigned int i00 = (r)*numColumns+c;
+                unsigned int i10 = (r)*numColumns+c+1;
+                unsigned int i01 = (r+1)*numColumns+c;
+                unsigned int i11 = (r+1)*numColumns+c+1;
+
+                float diff_00_11 = fabsf(v[i00].z()-v[i11].z());
+                float diff_01_10 = fabsf(v[i01].z()-v[i10].z());
+                if (diff_00_11<diff_01_10)
+                {
+                    // diagonal between 00 and 11
+                    drawElements[ei++] = i00;
+                    drawElements[ei++] = i10;
+                    drawElements[ei++] = i11;
+
+                    drawElements[ei++] = i00;
+                    drawElements[ei++] = i11;
+                    drawElements[ei++] = i01;
+                }
+                else
+                {
+                    // diagonal between 01 and 10
+                    drawElements[ei++] = i01;
+                    drawElements[ei++] = i00;
+                    drawElements[ei++] = i10;
+
+                    drawElements[ei++] = i01;
+                    drawElements[ei++] = i10;
+                    drawElements[ei++] = i11;
+                }
             }
         }
-    }
 
 #if 1
-    osgUtil::SmoothingVisitor sv;
-    sv.smooth(*geometry);  // this will replace the normal vector with a new one
+        osgUtil::SmoothingVisitor sv;
+        sv.smooth(*geometry);  // this will replace the normal vector with a new one
 
-    // now we have to reassign the normals back to the orignal pointer.
-    n = dynamic_cast<osg::Vec3Array*>(geometry->getNormalArray());
-    if (n.valid() && n->size()!=numVertices) n->resize(numVertices);
+        // now we have to reassign the normals back to the orignal pointer.
+        n = dynamic_cast<osg::Vec3Array*>(geometry->getNormalArray());
+        if (n.valid() && n->size()!=numVertices) n->resize(numVertices);
 #endif
+    }
+
     // now apply the normals computed through equalization
     for(unsigned int position=0; position<NUMBER_OF_POSITIONS; ++position)
     {
@@ -2215,7 +2365,7 @@ osg::Node* DestinationTile::createPolygonal()
                 itr != _heightDeltas[position].end();
                 ++itr, i += deltai, j += deltaj)
             {
-                osg::Vec3& normal = (*n)[i + j*numColumns];
+                osg::Vec3& normal = (*n)[vertexIndices[i + j*numColumns]];
                 osg::Vec2 heightDelta = *itr;
 
                 if (mapLatLongsToXYZ)
@@ -2298,8 +2448,6 @@ osg::Node* DestinationTile::createPolygonal()
         geometry->setCullCallback(ccc);
     }
     
-    osgUtil::Simplifier::IndexList pointsToProtectDuringSimplification;
-
     if (numVerticesInSkirt>0)
     {
         osg::DrawElementsUInt& skirtDrawElements = *(new osg::DrawElementsUInt(GL_QUAD_STRIP,2*numVerticesInSkirt+2));
@@ -2311,86 +2459,70 @@ osg::Node* DestinationTile::createPolygonal()
         for(c=0;c<numColumns-1;++c)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
+            skirtDrawElements[ei++] = vertexIndices[(r)*numColumns+c];
             skirtDrawElements[ei++] = vi;
-            
-            // mark these points as protected to prevent them from being removed during simplification
-            pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
-            pointsToProtectDuringSimplification.push_back(vi);
                
             osg::Vec3 localSkirtVector = !mapLatLongsToXYZ ? 
                                             skirtVector :
                                             computeLocalSkirtVector(et, grid.get(), c, r, skirtLength, useLocalToTileTransform, _localToWorld);
             
             // add in the new point on the bottom of the skirt
-            v[vi] = v[(r)*numColumns+c]+localSkirtVector;
-            if (n.valid()) (*n)[vi] = (*n)[r*numColumns+c];
-            t[vi++] = t[(r)*numColumns+c];
+            v[vi] = v[vertexIndices[(r)*numColumns+c]]+localSkirtVector;
+            if (n.valid()) (*n)[vi] = (*n)[vertexIndices[(r)*numColumns+c]];
+            t[vi++] = t[vertexIndices[(r)*numColumns+c]];
         }
         // create right skirt vertices
         c=numColumns-1;
         for(r=0;r<numRows-1;++r)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
+            skirtDrawElements[ei++] = vertexIndices[(r)*numColumns+c];
             skirtDrawElements[ei++] = vi;
-            
-            // mark these points as protected to prevent them from being removed during simplification
-            pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
-            pointsToProtectDuringSimplification.push_back(vi);
 
             osg::Vec3 localSkirtVector = !mapLatLongsToXYZ ? 
                                             skirtVector :
                                             computeLocalSkirtVector(et, grid.get(), c, r, skirtLength, useLocalToTileTransform, _localToWorld);
             
             // add in the new point on the bottom of the skirt
-            v[vi] = v[(r)*numColumns+c]+localSkirtVector;
-            if (n.valid()) (*n)[vi] = (*n)[(r)*numColumns+c];
-            t[vi++] = t[(r)*numColumns+c];
+            v[vi] = v[vertexIndices[(r)*numColumns+c]]+localSkirtVector;
+            if (n.valid()) (*n)[vi] = (*n)[vertexIndices[(r)*numColumns+c]];
+            t[vi++] = t[vertexIndices[(r)*numColumns+c]];
         }
         // create top skirt vertices
         r=numRows-1;
         for(c=numColumns-1;c>0;--c)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
+            skirtDrawElements[ei++] = vertexIndices[(r)*numColumns+c];
             skirtDrawElements[ei++] = vi;
-            
-            // mark these points as protected to prevent them from being removed during simplification
-            pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
-            pointsToProtectDuringSimplification.push_back(vi);
 
             osg::Vec3 localSkirtVector = !mapLatLongsToXYZ ? 
                                             skirtVector :
                                             computeLocalSkirtVector(et, grid.get(), c, r, skirtLength, useLocalToTileTransform, _localToWorld);
             
             // add in the new point on the bottom of the skirt
-            v[vi] = v[(r)*numColumns+c]+localSkirtVector;
-            if (n.valid()) (*n)[vi] = (*n)[(r)*numColumns+c];
-            t[vi++] = t[(r)*numColumns+c];
+            v[vi] = v[vertexIndices[(r)*numColumns+c]]+localSkirtVector;
+            if (n.valid()) (*n)[vi] = (*n)[vertexIndices[(r)*numColumns+c]];
+            t[vi++] = t[vertexIndices[(r)*numColumns+c]];
         }
         // create left skirt vertices
         c=0;
         for(r=numRows-1;r>0;--r)
         {
             // assign indices to primitive set
-            skirtDrawElements[ei++] = (r)*numColumns+c;
+            skirtDrawElements[ei++] = vertexIndices[(r)*numColumns+c];
             skirtDrawElements[ei++] = vi;
-            
-            // mark these points as protected to prevent them from being removed during simplification
-            pointsToProtectDuringSimplification.push_back((r)*numColumns+c);
-            pointsToProtectDuringSimplification.push_back(vi);
 
             osg::Vec3 localSkirtVector = !mapLatLongsToXYZ ? 
                                             skirtVector :
                                             computeLocalSkirtVector(et, grid.get(), c, r, skirtLength, useLocalToTileTransform, _localToWorld);
             
             // add in the new point on the bottom of the skirt
-            v[vi] = v[(r)*numColumns+c]+localSkirtVector;
-            if (n.valid()) (*n)[vi] = (*n)[(r)*numColumns+c];
-            t[vi++] = t[(r)*numColumns+c];
+            v[vi] = v[vertexIndices[(r)*numColumns+c]]+localSkirtVector;
+            if (n.valid()) (*n)[vi] = (*n)[vertexIndices[(r)*numColumns+c]];
+            t[vi++] = t[vertexIndices[(r)*numColumns+c]];
         }
-        skirtDrawElements[ei++] = 0;
+        skirtDrawElements[ei++] = vertexIndices[0];
         skirtDrawElements[ei++] = firstSkirtVertexIndex;
     }
 
@@ -2400,6 +2532,12 @@ osg::Node* DestinationTile::createPolygonal()
         geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
     }
 
+    if (_dataSet->getOptimizeTileGeometry())
+    {
+        // merge the skirt into the body's triangles and reorder them, and the vertices, for the GPU's vertex cache and fetch.
+        optimizeGeometry(*geometry);
+    }
+
 
     osg::StateSet* stateset = createStateSet();
     if (stateset)
@@ -2424,21 +2562,6 @@ osg::Node* DestinationTile::createPolygonal()
         osgDB::writeNodeFile(*geode,"NodeBeforeSimplification.osg");
     }
 
-    if (_dataSet->getSimplifyTerrain())
-    {
-        unsigned int targetMaxNumVertices = 512;
-        double sample_ratio = (numVertices <= targetMaxNumVertices) ? 1.0 : (double)targetMaxNumVertices/(double)numVertices;
-        double radius = double(geometry->getBound().radius());
-        double maximumError = radius / 2000.0;
-    
-        osgUtil::Simplifier simplifier(sample_ratio,maximumError);
-
-        simplifier.setDoTriStrip(false);
-        simplifier.setSmoothing(false);
-    
-        simplifier.simplify(*geometry, pointsToProtectDuringSimplification);  // this will replace the normal vector with a new one
-    }
-
     if (useLocalToTileTransform)
     {
         osg::MatrixTransform* mt = new osg::MatrixTransform;
@@ -2465,6 +2588,10 @@ osg::Node* DestinationTile::createPolygonal()
 
 void DestinationTile::readFrom(Source* source)
 {
+    // imagery and terrain downsampled from the children are already complete.
+    if (_dataFromChildren && source &&
+        (source->getType()==Source::IMAGE || source->getType()==Source::HEIGHT_FIELD)) return;
+
     bool optionalLayerSet = _dataSet->isOptionalLayerSet(source->getSetName());
     log(osg::NOTICE,"DestinationTile::readFrom(SetName=%s, FileName=%s)",source->getSetName().c_str(), source->getFileName().c_str());
     if (optionalLayerSet) log(osg::NOTICE,"  is an optional layer set");
@@ -2581,18 +2708,24 @@ void DestinationTile::readFrom(CompositeSource* sourceGraph)
     if (sourceGraph)
     {
 
-        allocate();
+        if (!_dataFromChildren) allocate();
+
+        // only visit the sources that overlap this tile, in the same order a full traversal would.
+        SourceIndex::Sources sources;
+        sourceGraph->getIntersectingSources(_cs.get(), _extents, sources);
 
-        unsigned int numChecked = 0;
-        for(CompositeSource::source_iterator itr(sourceGraph);itr.valid();++itr)
+        for(SourceIndex::Sources::iterator itr = sources.begin();
+            itr != sources.end();
+            ++itr)
         {
-            ++numChecked;
-            readFrom(itr->get());
+            readFrom(*itr);
         }
         
-        log(osg::INFO,"DestinationTile::readFrom(CompositeSource* ) numChecked %i",numChecked);
+        log(osg::INFO,"DestinationTile::readFrom(CompositeSource* ) numChecked %u",(unsigned int)sources.size());
 
         optimizeResolution();
+
+        log(osg::NOTICE,"   tile level=%u X=%u Y=%u decoded %llu bytes of source data",_level,_tileX,_tileY,getNumBytesDecoded());
     }
     else
     {
@@ -2603,7 +2736,7 @@ void DestinationTile::readFrom(CompositeSource* sourceGraph)
 
 void DestinationTile::readFrom()
 {
-    allocate();
+    if (!_dataFromChildren) allocate();
 
     log(osg::INFO,"DestinationTile::readFrom() %i",_sources.size());
     for(Sources::iterator itr = _sources.begin();
@@ -2615,48 +2748,262 @@ void DestinationTile::readFrom()
 
     optimizeResolution();
 
+    log(osg::NOTICE,"   tile level=%u X=%u Y=%u decoded %llu bytes of source data",_level,_tileX,_tileY,getNumBytesDecoded());
 }
 
+unsigned long long DestinationTile::getNumBytesDecoded() const
+{
+    unsigned long long numBytesDecoded = 0;
+    for(std::vector<ImageSet>::const_iterator litr = _imageLayerSet.begin();
+        litr != _imageLayerSet.end();
+        ++litr)
+    {
+        for(ImageSet::LayerSetImageDataMap::const_iterator itr = litr->_layerSetImageDataMap.begin();
+            itr != litr->_layerSetImageDataMap.end();
+            ++itr)
+        {
+            if (itr->second._imageDestination.valid()) numBytesDecoded += itr->second._imageDestination->_numBytesDecoded;
+        }
+    }
+
+    if (_terrain.valid()) numBytesDecoded += _terrain->_numBytesDecoded;
+
+    return numBytesDecoded;
+}
+
+
+
+// Return true if the source contributes to tiles at level but not at level+1, or vice versa.
+static bool contributionDiffersAtChildLevel(Source* source, unsigned int level)
+{
+    if (source->getType()!=Source::IMAGE && source->getType()!=Source::HEIGHT_FIELD) return false;
+
+    bool atLevel = level>=source->getMinLevel() && level<=source->getMaxLevel();
+    bool atChildLevel = level+1>=source->getMinLevel() && level+1<=source->getMaxLevel();
+    return atLevel!=atChildLevel;
+}
+
+static float interpolateHeight(const osg::HeightField& hf, double x, double y)
+{
+    double c = osg::clampBetween((x-hf.getOrigin().x())/hf.getXInterval(), 0.0, double(hf.getNumColumns()-1));
+    double r = osg::clampBetween((y-hf.getOrigin().y())/hf.getYInterval(), 0.0, double(hf.getNumRows()-1));
+
+    unsigned int c0 = (unsigned int)floor(c);
+    unsigned int r0 = (unsigned int)floor(r);
+    unsigned int c1 = osg::minimum(c0+1, hf.getNumColumns()-1);
+    unsigned int r1 = osg::minimum(r0+1, hf.getNumRows()-1);
+    float fc = float(c-double(c0));
+    float fr = float(r-double(r0));
+
+    float bottom = hf.getHeight(c0,r0)*(1.0f-fc) + hf.getHeight(c1,r0)*fc;
+    float top = hf.getHeight(c0,r1)*(1.0f-fc) + hf.getHeight(c1,r1)*fc;
+    return bottom*(1.0f-fr) + top*fr;
+}
+
+bool DestinationTile::readFromChildren(CompositeSource* sourceGraph)
+{
+    if (!_parent || _parent->_children.empty()) return false;
+
+    // collect the child tiles, which together must cover this tile.
+    typedef std::vector<DestinationTile*> ChildTiles;
+    ChildTiles childTiles;
+    double coveredArea = 0.0;
+    for(CompositeDestination::ChildList::iterator citr=_parent->_children.begin();
+        citr!=_parent->_children.end();
+        ++citr)
+    {
+        for(CompositeDestination::TileList::iterator titr=(*citr)->_tiles.begin();
+            titr!=(*citr)->_tiles.end();
+            ++titr)
+        {
+            DestinationTile* child = titr->get();
+            if (!child->getTileComplete()) return false;
+
+            double width = osg::minimum(child->_extents.xMax(),_extents.xMax()) - osg::maximum(child->_extents.xMin(),_extents.xMin());
+            double height = osg::minimum(child->_extents.yMax(),_extents.yMax()) - osg::maximum(child->_extents.yMin(),_extents.yMin());
+            if (width<=0.0 || height<=0.0) continue;
+
+            childTiles.push_back(child);
+            coveredArea += width*height;
+        }
+    }
+
+    double area = (_extents.xMax()-_extents.xMin())*(_extents.yMax()-_extents.yMin());
+    if (childTiles.empty() || coveredArea<area*0.999) return false;
+
+    // sources limited to this level, or starting at the child level, mean the children can't stand in for the sources.
+    if (sourceGraph)
+    {
+        SourceIndex::Sources sources;
+        sourceGraph->getIntersectingSources(_cs.get(), _extents, sources);
+
+        for(SourceIndex::Sources::iterator itr = sources.begin();
+            itr != sources.end();
+            ++itr)
+        {
+            if (contributionDiffersAtChildLevel(*itr, _level)) return false;
+        }
+    }
+    else
+    {
+        for(Sources::iterator itr = _sources.begin();
+            itr != _sources.end();
+            ++itr)
+        {
+            if ((*itr)->intersects(*this) && contributionDiffersAtChildLevel(itr->get(), _level)) return false;
+        }
+    }
+
+    log(osg::NOTICE,"   reading tile level=%u X=%u Y=%u from %u child tiles",_level,_tileX,_tileY,(unsigned int)childTiles.size());
 
+    allocate();
+
+    double extentsWidth = _extents.xMax()-_extents.xMin();
+    double extentsHeight = _extents.yMax()-_extents.yMin();
+
+    for(unsigned int layerNum=0;
+        layerNum<getNumLayers();
+        ++layerNum)
+    {
+        ImageSet& imageSet = getImageSet(layerNum);
+        for(ImageSet::LayerSetImageDataMap::iterator itr = imageSet._layerSetImageDataMap.begin();
+            itr != imageSet._layerSetImageDataMap.end();
+            ++itr)
+        {
+            DestinationData* imageDestination = itr->second._imageDestination.get();
+            osg::Image* image = imageDestination ? imageDestination->_image.get() : 0;
+            if (!image || image->getDataType()!=GL_UNSIGNED_BYTE) continue;
+
+            unsigned int numComponents = osg::Image::computeNumComponents(image->getPixelFormat());
+
+            for(ChildTiles::iterator citr = childTiles.begin();
+                citr != childTiles.end();
+                ++citr)
+            {
+                DestinationTile* child = *citr;
+                if (layerNum>=child->getNumLayers()) continue;
+
+                ImageSet::LayerSetImageDataMap& childImageDataMap = child->getImageSet(layerNum)._layerSetImageDataMap;
+                ImageSet::LayerSetImageDataMap::iterator childItr = childImageDataMap.find(itr->first);
+                if (childItr==childImageDataMap.end() || !childItr->second._imageDestination.valid()) continue;
+
+                osg::Image* childImage = childItr->second._imageDestination->_image.get();
+                if (!childImage ||
+                    childImage->getPixelFormat()!=image->getPixelFormat() ||
+                    childImage->getDataType()!=GL_UNSIGNED_BYTE) continue;
+
+                // the region of this tile's image that the child covers, image rows run from yMin upwards.
+                int destX = osg::maximum((int)floor(double(image->s())*(child->_extents.xMin()-_extents.xMin())/extentsWidth+0.5),0);
+                int destY = osg::maximum((int)floor(double(image->t())*(child->_extents.yMin()-_extents.yMin())/extentsHeight+0.5),0);
+                int destWidth = osg::minimum((int)floor(double(image->s())*(child->_extents.xMax()-_extents.xMin())/extentsWidth+0.5),image->s())-destX;
+                int destHeight = osg::minimum((int)floor(double(image->t())*(child->_extents.yMax()-_extents.yMin())/extentsHeight+0.5),image->t())-destY;
+                if (destWidth<=0 || destHeight<=0) continue;
+
+                resampleImage(childImage->data(), childImage->s(), childImage->t(), childImage->getRowSizeInBytes(),
+                              image->data(destX,destY), destWidth, destHeight, image->getRowSizeInBytes(),
+                              numComponents, RESAMPLE_BICUBIC);
+            }
+        }
+    }
+
+    if (_terrain.valid() && _terrain->_heightField.valid())
+    {
+        osg::HeightField* hf = _terrain->_heightField.get();
+        for(unsigned int r=0;r<hf->getNumRows();++r)
+        {
+            double y = hf->getOrigin().y() + hf->getYInterval()*double(r);
+            for(unsigned int c=0;c<hf->getNumColumns();++c)
+            {
+                double x = hf->getOrigin().x() + hf->getXInterval()*double(c);
+
+                // sample the child containing the vertex, or failing that the nearest one.
+                osg::HeightField* childHF = 0;
+                double nearest = DBL_MAX;
+                for(ChildTiles::iterator citr = childTiles.begin();
+                    citr != childTiles.end();
+                    ++citr)
+                {
+                    DestinationTile* child = *citr;
+                    if (!child->_terrain.valid() || !child->_terrain->_heightField.valid()) continue;
+
+                    double dx = osg::maximum(osg::maximum(child->_extents.xMin()-x, x-child->_extents.xMax()), 0.0);
+                    double dy = osg::maximum(osg::maximum(child->_extents.yMin()-y, y-child->_extents.yMax()), 0.0);
+                    double distance2 = dx*dx+dy*dy;
+                    if (distance2<nearest)
+                    {
+                        nearest = distance2;
+                        childHF = child->_terrain->_heightField.get();
+                    }
+                }
+
+                if (childHF) hf->setHeight(c,r,interpolateHeight(*childHF,x,y));
+            }
+        }
+    }
+
+    _dataFromChildren = true;
+
+    return true;
+}
 
 void DestinationTile::unrefData()
 {
+    // release the scene first so it no longer holds on to the images.
+    _createdScene = 0;
+    _stateset = 0;
+
+    if (_numBytesAccounted!=0)
+    {
+        _dataSet->accountTileMemory(-(long long)_numBytesAccounted);
+        _numBytesAccounted = 0;
+    }
+
+    // hand the height field storage back to the pool where nothing else still holds on to it, the images hand
+    // their storage back themselves when they're deleted.
+    BufferPool* bufferPool = System::instance()->getBufferPool();
+    if (_terrain.valid() && _terrain->referenceCount()==1 &&
+        _terrain->_heightField.valid() && _terrain->_heightField->referenceCount()==1)
+    {
+        bufferPool->recycleHeightField(_terrain->_heightField.get());
+    }
+
     _imageLayerSet.clear();
     _terrain = 0;
     _models = 0;
-    
-    _createdScene = 0;
-    _stateset = 0;
+    _dataFromChildren = false;
 }
 
 void DestinationTile::addRequiredResolutions(CompositeSource* sourceGraph)
 {
-    for(CompositeSource::source_iterator itr(sourceGraph);itr.valid();++itr)
+    if (!sourceGraph) return;
+
+    SourceIndex::Sources sources;
+    sourceGraph->getIntersectingSources(_cs.get(), _extents, sources);
+
+    for(SourceIndex::Sources::iterator itr = sources.begin();
+        itr != sources.end();
+        ++itr)
     {
-        Source* source = itr->get();
-        if (source && source->intersects(*this))
+        Source* source = *itr;
+        if (source->getType()==Source::IMAGE)
         {
-            if (source->getType()==Source::IMAGE)
+            unsigned int numCols,numRows;
+            double resX, resY;
+            if (computeImageResolution(source->getLayer(),source->getSwitchSetName(), numCols,numRows,resX,resY))
             {
-                unsigned int numCols,numRows;
-                double resX, resY;
-                if (computeImageResolution(source->getLayer(),source->getSwitchSetName(), numCols,numRows,resX,resY))
-                {
-                    source->addRequiredResolution(resX,resY);
-                }
+                source->addRequiredResolution(resX,resY);
             }
+        }
 
-            if (source->getType()==Source::HEIGHT_FIELD)
+        if (source->getType()==Source::HEIGHT_FIELD)
+        {
+            unsigned int numCols,numRows;
+            double resX, resY;
+            if (computeTerrainResolution(numCols,numRows,resX,resY))
             {
-                unsigned int numCols,numRows;
-                double resX, resY;
-                if (computeTerrainResolution(numCols,numRows,resX,resY))
-                {
-                    source->addRequiredResolution(resX,resY);
-                }
+                source->addRequiredResolution(resX,resY);
             }
         }
-
     }
 }
 
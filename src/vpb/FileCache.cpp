@@ -14,6 +14,7 @@
 #include <vpb/FileCache>
 #include <vpb/System>
 #include <vpb/BuildLog>
+#include <vpb/BuildOperation>
 #include <vpb/DataSet>
 
 #include <osg/io_utils>
@@ -486,6 +487,53 @@ void FileCache::addSource(osgTerrain::TerrainTile* source)
     log(osg::NOTICE,"FileCache::addSource()");
 }
 
+class CacheReprojectionOperation : public BuildOperation
+{
+    public:
+
+        CacheReprojectionOperation(ThreadPool* threadPool, FileCache* fileCache, Source* source, const std::string& filename, osg::CoordinateSystemNode* cs, const BuildOptions* buildOptions, const std::string& hostName, ProgressReport* progress):
+            BuildOperation(threadPool, 0, "CacheReprojectionOperation", false),
+            _fileCache(fileCache),
+            _source(source),
+            _filename(filename),
+            _cs(cs),
+            _buildOptions(buildOptions),
+            _hostName(hostName),
+            _progress(progress) {}
+
+        virtual void build()
+        {
+            log(osg::NOTICE,"     reprojecting file=%s, reprojected file will be = %s",_source->getFileName().c_str(), _filename.c_str());
+
+            _newSource = _source->doRasterReprojection(_filename, _cs.get(), 0.0, _buildOptions);
+
+            if (_newSource.valid())
+            {
+                SourceData* sd = _newSource->getSourceData();
+
+                FileDetails* fd = new FileDetails;
+                fd->setOriginalSourceFileName(_source->getFileName());
+                fd->setFileName(_newSource->getFileName());
+                fd->setSpatialProperties(*sd);
+
+                fd->setHostName(_hostName);
+
+                _fileCache->addFileDetails(fd);
+            }
+
+            _progress->completed(_source->getFileName());
+        }
+
+        FileCache*                              _fileCache;
+        osg::ref_ptr<Source>                    _source;
+        std::string                             _filename;
+        osg::ref_ptr<osg::CoordinateSystemNode> _cs;
+        const BuildOptions*                     _buildOptions;
+        std::string                             _hostName;
+        osg::ref_ptr<ProgressReport>            _progress;
+        osg::ref_ptr<Source>                    _newSource;
+};
+
 void FileCache::buildRequiredReprojections(osgTerrain::TerrainTile* source)
 {
     if (!source) return;
@@ -518,40 +566,127 @@ void FileCache::buildRequiredReprojections(osgTerrain::TerrainTile* source)
 
     if (dataset->requiresReprojection())
     {
+        osg::CoordinateSystemNode* cs = dataset->getIntermediateCoordinateSystem();
+
+        // a file used by several sources is only reprojected once if they read it with the same coordinate system
+        // and geotransform, as they all share the intermediate coordinate system.
+        typedef std::pair<Source*, std::string> Reprojection;
+        typedef std::vector<Reprojection> Reprojections;
+        typedef std::map<std::string, unsigned int> ReprojectionKeyMap;
+        typedef std::map<Source*, unsigned int> SourceReprojectionMap;
+        Reprojections reprojections;
+        ReprojectionKeyMap reprojectionKeyMap;
+        SourceReprojectionMap sourceReprojectionMap;
+        std::set<std::string> newFileNames;
+
         for(CompositeSource::source_iterator itr(dataset->getSourceGraph());itr.valid();++itr)
         {
             Source* source = itr->get();
-            if (source->needReproject(dataset->getIntermediateCoordinateSystem()) && source->isRaster())
+            if (source->needReproject(cs) && source->isRaster())
             {
-                std::string newFileName = filePrefix + osgDB::getStrippedName(source->getFileName()) + ".tif";
+                std::string reprojectionKey = source->computeReprojectionKey();
+                ReprojectionKeyMap::iterator fitr = reprojectionKeyMap.find(reprojectionKey);
+                if (fitr == reprojectionKeyMap.end())
+                {
+                    std::string strippedName = filePrefix + osgDB::getStrippedName(source->getFileName());
+                    std::string newFileName = strippedName + ".tif";
+                    for(unsigned int i=1; newFileNames.count(newFileName)!=0; ++i)
+                    {
+                        std::ostringstream str;
+                        str<<strippedName<<"_"<<i<<".tif";
+                        newFileName = str.str();
+                    }
+                    newFileNames.insert(newFileName);
 
-                log(osg::NOTICE,"     reprojecting file=%s, reprojected file will be = %s",source->getFileName().c_str(), newFileName.c_str());
+                    fitr = reprojectionKeyMap.insert(ReprojectionKeyMap::value_type(reprojectionKey, reprojections.size())).first;
+                    reprojections.push_back(Reprojection(source, newFileName));
+                }
+                sourceReprojectionMap[source] = fitr->second;
+            }
+        }
 
-                osg::ref_ptr<Source> newSource = source->doRasterReprojection(newFileName,dataset->getIntermediateCoordinateSystem());
+        typedef std::vector< osg::ref_ptr<CacheReprojectionOperation> > Operations;
+        Operations operations;
 
-                if (newSource.valid())
-                {
-                
-                    SourceData* sd = newSource->getSourceData();
+        if (!reprojections.empty())
+        {
+            unsigned int numThreads = osg::minimum(dataset->computeNumConcurrentReprojections(), static_cast<unsigned int>(reprojections.size()));
 
-                    FileDetails* fd = new FileDetails;
-                    fd->setOriginalSourceFileName(source->getFileName());
-                    fd->setFileName(newSource->getFileName());
-                    fd->setSpatialProperties(*sd);
+            log(osg::NOTICE,"FileCache::buildRequiredReprojections() : reprojecting %u files, %u at a time",static_cast<unsigned int>(reprojections.size()),numThreads);
 
-                    fd->setHostName(localHostName);
+            osg::ref_ptr<ProgressReport> progress = new ProgressReport("FileCache reprojection", reprojections.size());
+            osg::ref_ptr<ThreadPool> threadPool = new ThreadPool(numThreads, false);
+            threadPool->startThreads();
 
-                    addFileDetails(fd);
-                    
-                    *itr = newSource;
-                }
+            for(Reprojections::iterator ritr = reprojections.begin();
+                ritr != reprojections.end();
+                ++ritr)
+            {
+                operations.push_back(new CacheReprojectionOperation(threadPool.get(), this, ritr->first, ritr->second, cs, dataset.get(), localHostName, progress.get()));
+                threadPool->run(operations.back().get());
             }
+
+            threadPool->waitForCompletion();
         }
+
+        for(CompositeSource::source_iterator itr(dataset->getSourceGraph());itr.valid();++itr)
+        {
+            SourceReprojectionMap::iterator sitr = sourceReprojectionMap.find(itr->get());
+            if (sitr == sourceReprojectionMap.end()) continue;
+
+            CacheReprojectionOperation* operation = operations[sitr->second].get();
+            if (!operation->_newSource) continue;
+
+            if (operation->_source == itr->get())
+            {
+                *itr = operation->_newSource.get();
+            }
+            else
+            {
+                *itr = (*itr)->createReprojectedSource(operation->_newSource->getFileName(), cs, true);
+            }
+        }
+
+        dataset->getSourceGraph()->dirtySourceIndices();
     }
 
 }
 
 
+class CacheOverviewsOperation : public BuildOperation
+{
+    public:
+
+        CacheOverviewsOperation(ThreadPool* threadPool, const std::string& filename, ProgressReport* progress):
+            BuildOperation(threadPool, 0, "CacheOverviewsOperation", false),
+            _filename(filename),
+            _progress(progress) {}
+
+        virtual void build()
+        {
+            osg::ref_ptr<GeospatialDataset> dataset = System::instance()->openGeospatialDataset(_filename, READ_AND_WRITE);
+            if (dataset.valid() )
+            {
+                if (!dataset->containsOverviews())
+                {
+                    log(osg::NOTICE, "     need to build mipmaps for %s",_filename.c_str());
+
+                    // several files are built at once so leave the progress reporting to the ProgressReport.
+                    int anOverviewList[5] = { 2, 4, 8, 16, 32 };
+                    dataset->BuildOverviews( "AVERAGE", 5, anOverviewList, 0, NULL,
+                                             GDALDummyProgress, NULL );
+
+                }
+
+            }
+
+            _progress->completed(_filename);
+        }
+
+        std::string                     _filename;
+        osg::ref_ptr<ProgressReport>    _progress;
+};
+
 void FileCache::buildOverviews(osgTerrain::TerrainTile* source)
 {
 
@@ -588,10 +723,17 @@ void FileCache::buildOverviews(osgTerrain::TerrainTile* source)
 
     osg::CoordinateSystemNode* csn = dataset->getIntermediateCoordinateSystem();
 
+    // collect each file once, even when several sources use it.
+    typedef std::vector<std::string> FileNames;
+    FileNames fileNames;
+    std::set<std::string> fileNameSet;
+
     for(CompositeSource::source_iterator itr(dataset->getSourceGraph());itr.valid();++itr)
     {
         Source* source = itr->get();
 
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+
         VariantMap::iterator vmitr = _variantMap.find(source->getFileName());
         if (vmitr != _variantMap.end())
         {
@@ -615,28 +757,36 @@ void FileCache::buildOverviews(osgTerrain::TerrainTile* source)
             if (fileDetailsWithRequiredCoordinateSystem.size()==1)
             {
                 FileDetails* fd = fileDetailsWithRequiredCoordinateSystem.front();
-
-                osg::ref_ptr<GeospatialDataset> dataset = System::instance()->openGeospatialDataset(fd->getFileName(), READ_AND_WRITE);
-                if (dataset.valid() )
+                if (fileNameSet.insert(fd->getFileName()).second)
                 {
-                    if (!dataset->containsOverviews())
-                    {
-                        log(osg::NOTICE, "     need to build mipmaps for %s",fd->getFileName().c_str());
-
-                        int anOverviewList[5] = { 2, 4, 8, 16, 32 };
-                        dataset->BuildOverviews( "AVERAGE", 5, anOverviewList, 0, NULL,
-                                                 GDALTermProgress/*GDALDummyProgress*/, NULL );
-
-                    }
-
+                    fileNames.push_back(fd->getFileName());
                 }
-                
             }
             
         }
 
     }
 
+    if (!fileNames.empty())
+    {
+        unsigned int numThreads = osg::minimum(dataset->computeNumConcurrentOverviewBuilds(), static_cast<unsigned int>(fileNames.size()));
+
+        log(osg::NOTICE,"FileCache::buildOverviews() : checking %u files, %u at a time",static_cast<unsigned int>(fileNames.size()),numThreads);
+
+        osg::ref_ptr<ProgressReport> progress = new ProgressReport("FileCache overviews", fileNames.size());
+        osg::ref_ptr<ThreadPool> threadPool = new ThreadPool(numThreads, false);
+        threadPool->startThreads();
+
+        for(FileNames::iterator fitr = fileNames.begin();
+            fitr != fileNames.end();
+            ++fitr)
+        {
+            threadPool->run(new CacheOverviewsOperation(threadPool.get(), *fitr, progress.get()));
+        }
+
+        threadPool->waitForCompletion();
+    }
+
 }
 
 void FileCache::mirror(Machine* machine, osgTerrain::TerrainTile* source)
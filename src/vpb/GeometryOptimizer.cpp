@@ -0,0 +1,352 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/GeometryOptimizer>
+
+#include <osg/TriangleIndexFunctor>
+
+#include <math.h>
+#include <set>
+
+using namespace vpb;
+
+namespace
+{
+
+struct CollectTriangleIndices
+{
+    CollectTriangleIndices(): _triangles(0) {}
+
+    void operator() (unsigned int p1, unsigned int p2, unsigned int p3)
+    {
+        // drop the degenerate triangles of strips
+        if (p1==p2 || p2==p3 || p1==p3) return;
+
+        _triangles->push_back(p1);
+        _triangles->push_back(p2);
+        _triangles->push_back(p3);
+    }
+
+    std::vector<unsigned int>* _triangles;
+};
+
+// Tom Forsyth's linear speed vertex cache optimisation, scoring vertices against an emulated LRU cache. Its order isn't
+// tuned to one cache size so suits the FIFO caches of all the hardware the tiles may be drawn on.
+const unsigned int cacheSize = 32;
+const float cacheDecayPower = 1.5f;
+const float lastTriangleScore = 0.75f;
+const float valenceBoostScale = 2.0f;
+const float valenceBoostPower = 0.5f;
+
+const unsigned int invalidIndex = ~0u;
+
+struct VertexData
+{
+    VertexData():
+        cachePosition(-1),
+        numActiveTriangles(0),
+        firstTriangle(0),
+        score(0.0f) {}
+
+    int             cachePosition;
+    unsigned int    numActiveTriangles;
+    unsigned int    firstTriangle;
+    float           score;
+};
+
+float computeVertexScore(const VertexData& vertex)
+{
+    // no triangles left to draw, so the vertex is of no use.
+    if (vertex.numActiveTriangles==0) return -1.0f;
+
+    float score = 0.0f;
+    if (vertex.cachePosition>=0)
+    {
+        if (vertex.cachePosition<3)
+        {
+            // used by the last triangle, a fixed score stops the next triangle simply reusing its edge to form strips.
+            score = lastTriangleScore;
+        }
+        else
+        {
+            score = powf(1.0f - float(vertex.cachePosition-3)/float(cacheSize-3), cacheDecayPower);
+        }
+    }
+
+    // boost vertices with few triangles left so lone triangles aren't left behind to be drawn later on a cache miss.
+    score += valenceBoostScale * powf(float(vertex.numActiveTriangles), -valenceBoostPower);
+
+    return score;
+}
+
+// reorder the triangles, triples of indices into numVertices vertices, for the vertex cache.
+void optimizeTriangleOrder(std::vector<unsigned int>& triangles, unsigned int numVertices)
+{
+    unsigned int numTriangles = triangles.size()/3;
+    if (numTriangles==0) return;
+
+    std::vector<VertexData> vertices(numVertices);
+    for(unsigned int i=0; i<triangles.size(); ++i)
+    {
+        ++vertices[triangles[i]].numActiveTriangles;
+    }
+
+    // the triangles of each vertex, those still to be drawn are kept at the start of each vertex's range.
+    unsigned int offset = 0;
+    for(unsigned int v=0; v<numVertices; ++v)
+    {
+        vertices[v].firstTriangle = offset;
+        offset += vertices[v].numActiveTriangles;
+        vertices[v].numActiveTriangles = 0;
+    }
+
+    std::vector<unsigned int> vertexTriangles(triangles.size());
+    for(unsigned int i=0; i<triangles.size(); ++i)
+    {
+        VertexData& vertex = vertices[triangles[i]];
+        vertexTriangles[vertex.firstTriangle + vertex.numActiveTriangles++] = i/3;
+    }
+
+    for(unsigned int v=0; v<numVertices; ++v)
+    {
+        vertices[v].score = computeVertexScore(vertices[v]);
+    }
+
+    std::vector<float> triangleScores(numTriangles);
+    std::vector<bool> triangleAdded(numTriangles, false);
+    unsigned int bestTriangle = 0;
+    for(unsigned int t=0; t<numTriangles; ++t)
+    {
+        triangleScores[t] = vertices[triangles[t*3]].score + vertices[triangles[t*3+1]].score + vertices[triangles[t*3+2]].score;
+        if (triangleScores[t]>triangleScores[bestTriangle]) bestTriangle = t;
+    }
+
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> newCache;
+    cache.reserve(cacheSize+3);
+    newCache.reserve(cacheSize+3);
+
+    std::vector<unsigned int> orderedTriangles;
+    orderedTriangles.reserve(triangles.size());
+
+    unsigned int nextUnaddedTriangle = 0;
+    for(unsigned int numAdded=0; numAdded<numTriangles; ++numAdded)
+    {
+        if (bestTriangle==invalidIndex)
+        {
+            // nothing left around the cache, carry on from the next triangle in the original order.
+            while(triangleAdded[nextUnaddedTriangle]) ++nextUnaddedTriangle;
+            bestTriangle = nextUnaddedTriangle;
+        }
+
+        const unsigned int* triangle = &triangles[bestTriangle*3];
+        triangleAdded[bestTriangle] = true;
+
+        newCache.clear();
+        for(unsigned int i=0; i<3; ++i)
+        {
+            orderedTriangles.push_back(triangle[i]);
+            newCache.push_back(triangle[i]);
+
+            // remove the triangle from its vertex's active triangles
+            VertexData& vertex = vertices[triangle[i]];
+            unsigned int* activeTriangles = &vertexTriangles[vertex.firstTriangle];
+            for(unsigned int j=0; j<vertex.numActiveTriangles; ++j)
+            {
+                if (activeTriangles[j]==bestTriangle)
+                {
+                    activeTriangles[j] = activeTriangles[vertex.numActiveTriangles-1];
+                    activeTriangles[vertex.numActiveTriangles-1] = bestTriangle;
+                    break;
+                }
+            }
+            --vertex.numActiveTriangles;
+        }
+
+        // the triangle's vertices move to the front of the cache, pushing back the rest.
+        for(std::vector<unsigned int>::iterator itr = cache.begin();
+            itr != cache.end();
+            ++itr)
+        {
+            if (*itr!=triangle[0] && *itr!=triangle[1] && *itr!=triangle[2]) newCache.push_back(*itr);
+        }
+
+        for(unsigned int i=0; i<newCache.size(); ++i)
+        {
+            VertexData& vertex = vertices[newCache[i]];
+            vertex.cachePosition = (i<cacheSize) ? int(i) : -1;
+            vertex.score = computeVertexScore(vertex);
+        }
+
+        // rescore the triangles of the vertices whose score has changed, including those just pushed out of the cache.
+        bestTriangle = invalidIndex;
+        float bestScore = -1.0f;
+        for(unsigned int i=0; i<newCache.size(); ++i)
+        {
+            const VertexData& vertex = vertices[newCache[i]];
+            for(unsigned int j=0; j<vertex.numActiveTriangles; ++j)
+            {
+                unsigned int t = vertexTriangles[vertex.firstTriangle + j];
+                triangleScores[t] = vertices[triangles[t*3]].score + vertices[triangles[t*3+1]].score + vertices[triangles[t*3+2]].score;
+                if (triangleScores[t]>bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        if (newCache.size()>cacheSize) newCache.resize(cacheSize);
+        cache.swap(newCache);
+    }
+
+    triangles.swap(orderedTriangles);
+}
+
+class RemapArrayVisitor : public osg::ArrayVisitor
+{
+    public:
+
+        RemapArrayVisitor(const std::vector<unsigned int>& remap): _remap(remap) {}
+
+        template <typename ArrayType>
+        void remap(ArrayType& array)
+        {
+            std::vector<typename ArrayType::value_type> original(array.begin(), array.end());
+            for(unsigned int i=0; i<_remap.size(); ++i)
+            {
+                array[_remap[i]] = original[i];
+            }
+            array.dirty();
+        }
+
+        virtual void apply(osg::ByteArray& array) { remap(array); }
+        virtual void apply(osg::ShortArray& array) { remap(array); }
+        virtual void apply(osg::IntArray& array) { remap(array); }
+        virtual void apply(osg::UByteArray& array) { remap(array); }
+        virtual void apply(osg::UShortArray& array) { remap(array); }
+        virtual void apply(osg::UIntArray& array) { remap(array); }
+        virtual void apply(osg::FloatArray& array) { remap(array); }
+
+        virtual void apply(osg::Vec2Array& array) { remap(array); }
+        virtual void apply(osg::Vec3Array& array) { remap(array); }
+        virtual void apply(osg::Vec4Array& array) { remap(array); }
+        virtual void apply(osg::Vec4ubArray& array) { remap(array); }
+
+        virtual void apply(osg::Vec2dArray& array) { remap(array); }
+        virtual void apply(osg::Vec3dArray& array) { remap(array); }
+        virtual void apply(osg::Vec4dArray& array) { remap(array); }
+
+    protected:
+
+        const std::vector<unsigned int>& _remap;
+};
+
+void addPerVertexArray(std::set<osg::Array*>& arrays, osg::Array* array, osg::Geometry::AttributeBinding binding, unsigned int numVertices)
+{
+    // arrays may be shared between texture units so collect them into a set to only remap each once.
+    if (array && binding==osg::Geometry::BIND_PER_VERTEX && array->getNumElements()==numVertices) arrays.insert(array);
+}
+
+}
+
+bool vpb::optimizeGeometry(osg::Geometry& geometry)
+{
+    osg::Array* vertexArray = geometry.getVertexArray();
+    if (!vertexArray || vertexArray->getNumElements()==0) return false;
+
+    // suitableForOptimization() reports whether the geometry uses the deprecated per vertex index arrays.
+    if (geometry.suitableForOptimization()) return false;
+
+    for(unsigned int i=0; i<geometry.getNumPrimitiveSets(); ++i)
+    {
+        switch(geometry.getPrimitiveSet(i)->getMode())
+        {
+            case(GL_TRIANGLES):
+            case(GL_TRIANGLE_STRIP):
+            case(GL_TRIANGLE_FAN):
+            case(GL_QUADS):
+            case(GL_QUAD_STRIP):
+            case(GL_POLYGON):
+                break;
+            default:
+                return false;
+        }
+    }
+
+    // gather the triangles of all the primitive sets, so skirts and the like share the one index list.
+    std::vector<unsigned int> triangles;
+    osg::TriangleIndexFunctor<CollectTriangleIndices> collectTriangles;
+    collectTriangles._triangles = &triangles;
+    geometry.accept(collectTriangles);
+
+    if (triangles.empty()) return false;
+
+    unsigned int numVertices = vertexArray->getNumElements();
+
+    optimizeTriangleOrder(triangles, numVertices);
+
+    // number the vertices in the order the triangles first use them, any unused vertices are moved to the end.
+    std::vector<unsigned int> remap(numVertices, invalidIndex);
+    unsigned int numRemapped = 0;
+    for(std::vector<unsigned int>::iterator itr = triangles.begin();
+        itr != triangles.end();
+        ++itr)
+    {
+        if (remap[*itr]==invalidIndex) remap[*itr] = numRemapped++;
+        *itr = remap[*itr];
+    }
+
+    for(unsigned int v=0; v<numVertices; ++v)
+    {
+        if (remap[v]==invalidIndex) remap[v] = numRemapped++;
+    }
+
+    std::set<osg::Array*> arrays;
+    arrays.insert(vertexArray);
+    addPerVertexArray(arrays, geometry.getNormalArray(), geometry.getNormalBinding(), numVertices);
+    addPerVertexArray(arrays, geometry.getColorArray(), geometry.getColorBinding(), numVertices);
+    addPerVertexArray(arrays, geometry.getSecondaryColorArray(), geometry.getSecondaryColorBinding(), numVertices);
+    addPerVertexArray(arrays, geometry.getFogCoordArray(), geometry.getFogCoordBinding(), numVertices);
+    for(unsigned int unit=0; unit<geometry.getNumTexCoordArrays(); ++unit)
+    {
+        addPerVertexArray(arrays, geometry.getTexCoordArray(unit), osg::Geometry::BIND_PER_VERTEX, numVertices);
+    }
+    for(unsigned int index=0; index<geometry.getNumVertexAttribArrays(); ++index)
+    {
+        addPerVertexArray(arrays, geometry.getVertexAttribArray(index), geometry.getVertexAttribBinding(index), numVertices);
+    }
+
+    RemapArrayVisitor remapArray(remap);
+    for(std::set<osg::Array*>::iterator itr = arrays.begin();
+        itr != arrays.end();
+        ++itr)
+    {
+        (*itr)->accept(remapArray);
+    }
+
+    geometry.removePrimitiveSet(0, geometry.getNumPrimitiveSets());
+
+    if (numVertices<65536)
+    {
+        geometry.addPrimitiveSet(new osg::DrawElementsUShort(GL_TRIANGLES, triangles.begin(), triangles.end()));
+    }
+    else
+    {
+        geometry.addPrimitiveSet(new osg::DrawElementsUInt(GL_TRIANGLES, triangles.begin(), triangles.end()));
+    }
+
+    geometry.dirtyDisplayList();
+
+    return true;
+}
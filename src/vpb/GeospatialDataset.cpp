@@ -15,17 +15,24 @@
 #include <osg/Notify>
 #include <OpenThreads/ScopedLock>
 
+#include <gdalwarper.h>
+
 using namespace vpb;
 
-GeospatialDataset::GeospatialDataset(const std::string& filename, AccessMode accessMode)
+GeospatialDataset::GeospatialDataset(const std::string& filename, AccessMode accessMode):
+    _sourceDataset(0)
 {
     updateTimeStamp();
     _dataset = (GDALDataset*)GDALOpen(filename.c_str(), accessMode==READ_ONLY ? GA_ReadOnly : GA_Update);
+
+    // the data read is just that of the file, so the filename identifies it.
+    _blockCacheKey = filename;
     
     //osg::notify(osg::NOTICE)<<"GDALOpen("<<filename<<") = "<<_dataset<<std::endl;
 }
 
-GeospatialDataset::GeospatialDataset(GDALDataset* dataset)
+GeospatialDataset::GeospatialDataset(GDALDataset* dataset):
+    _sourceDataset(0)
 {
     //osg::notify(osg::NOTICE)<<"GDALOpen(dataset)="<<_dataset<<std::endl;
 
@@ -33,10 +40,30 @@ GeospatialDataset::GeospatialDataset(GDALDataset* dataset)
     _dataset = dataset;
 }
 
+GeospatialDataset::GeospatialDataset(const std::string& filename, const std::string& sourceWKT, const std::string& destinationWKT, double errorThreshold):
+    _dataset(0)
+{
+    updateTimeStamp();
+    _sourceDataset = (GDALDataset*)GDALOpen(filename.c_str(), GA_ReadOnly);
+    if (!_sourceDataset) return;
+
+    // nearest neighbour sampling matches the temporary files written by Source::doRasterReprojection().
+    _dataset = (GDALDataset*)GDALAutoCreateWarpedVRT(_sourceDataset,
+                                                     sourceWKT.empty() ? NULL : sourceWKT.c_str(),
+                                                     destinationWKT.c_str(),
+                                                     GRA_NearestNeighbour, errorThreshold, NULL);
+
+    // the VRT's description is just that of the source file, so leave the block cache key to the creator, which
+    // knows the warp, see DatasetCache::openWarped().
+}
+
 GeospatialDataset::~GeospatialDataset()
 {
     //osg::notify(osg::NOTICE)<<"GDALClose("<<_dataset<<")"<<std::endl;
     if (_dataset) GDALClose(_dataset);
+
+    // a warped VRT only references its source, so close the source after it.
+    if (_sourceDataset) GDALClose(_sourceDataset);
 }
 
 CPLErr GeospatialDataset::GetGeoTransform( double * ptr)
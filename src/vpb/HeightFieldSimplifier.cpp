@@ -0,0 +1,373 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/HeightFieldSimplifier>
+
+#include <osg/Math>
+
+#include <math.h>
+
+using namespace vpb;
+
+namespace
+{
+
+// The sample boundaries of the intervals along one axis at each depth of the quadtree. Each interval of two or more
+// samples is halved at the next depth, single sample intervals carry on unchanged, so every node at a depth shares
+// its column interval with the nodes above and below it and its row interval with the nodes to either side.
+struct Axis
+{
+    typedef std::vector<unsigned int> Boundaries;
+    typedef std::vector<unsigned int> Parents;
+
+    std::vector<Boundaries>     boundaries;
+    std::vector<Parents>        parents;
+
+    void build(unsigned int numSamples)
+    {
+        Boundaries level;
+        level.push_back(0);
+        level.push_back(numSamples-1);
+        boundaries.push_back(level);
+        parents.push_back(Parents(1, 0));
+
+        while(!isFinest(boundaries.back())) subdivide();
+    }
+
+    static bool isFinest(const Boundaries& level)
+    {
+        for(unsigned int i=0; i+1<level.size(); ++i)
+        {
+            if (level[i+1]-level[i]>=2) return false;
+        }
+        return true;
+    }
+
+    void subdivide()
+    {
+        const Boundaries& level = boundaries.back();
+
+        Boundaries next;
+        Parents nextParents;
+        for(unsigned int i=0; i+1<level.size(); ++i)
+        {
+            next.push_back(level[i]);
+            nextParents.push_back(i);
+            if (level[i+1]-level[i]>=2)
+            {
+                next.push_back((level[i]+level[i+1])/2);
+                nextParents.push_back(i);
+            }
+        }
+        next.push_back(level.back());
+
+        boundaries.push_back(next);
+        parents.push_back(nextParents);
+    }
+
+    unsigned int getNumIntervals(unsigned int depth) const { return boundaries[depth].size()-1; }
+    unsigned int getStart(unsigned int depth, unsigned int i) const { return boundaries[depth][i]; }
+    unsigned int getEnd(unsigned int depth, unsigned int i) const { return boundaries[depth][i+1]; }
+    bool canSplit(unsigned int depth, unsigned int i) const { return getEnd(depth,i)-getStart(depth,i)>=2; }
+};
+
+class RestrictedQuadtree
+{
+    public:
+
+        RestrictedQuadtree(const osg::HeightField& grid):
+            _grid(grid),
+            _numColumns(grid.getNumColumns())
+        {
+            _columns.build(grid.getNumColumns());
+            _rows.build(grid.getNumRows());
+
+            // pad the axis that reaches single samples first so both have an entry at every depth.
+            padAxis(_columns, _rows.boundaries.size());
+            padAxis(_rows, _columns.boundaries.size());
+
+            unsigned int numDepths = _columns.boundaries.size();
+            _errors.resize(numDepths);
+            _split.resize(numDepths);
+            for(unsigned int d=0; d<numDepths; ++d)
+            {
+                _errors[d].assign(_columns.getNumIntervals(d)*_rows.getNumIntervals(d), 0.0f);
+                _split[d].assign(_columns.getNumIntervals(d)*_rows.getNumIntervals(d), false);
+            }
+        }
+
+        void selectNodes(float maximumError)
+        {
+            unsigned int numDepths = _errors.size();
+
+            // each node's error is the larger of its own and its children's, so splitting any node splits all its ancestors.
+            for(unsigned int d=numDepths; d>0; --d)
+            {
+                unsigned int depth = d-1;
+                unsigned int nc = _columns.getNumIntervals(depth);
+                unsigned int nr = _rows.getNumIntervals(depth);
+                for(unsigned int j=0; j<nr; ++j)
+                {
+                    for(unsigned int i=0; i<nc; ++i)
+                    {
+                        float& error = _errors[depth][i+j*nc];
+                        error = osg::maximum(error, computeError(depth, i, j));
+
+                        if (depth>0)
+                        {
+                            unsigned int parentIndex = _columns.parents[depth][i] + _rows.parents[depth][j]*_columns.getNumIntervals(depth-1);
+                            _errors[depth-1][parentIndex] = osg::maximum(_errors[depth-1][parentIndex], error);
+                        }
+                    }
+                }
+            }
+
+            for(unsigned int depth=0; depth<numDepths; ++depth)
+            {
+                unsigned int nc = _columns.getNumIntervals(depth);
+                unsigned int nr = _rows.getNumIntervals(depth);
+                for(unsigned int j=0; j<nr; ++j)
+                {
+                    for(unsigned int i=0; i<nc; ++i)
+                    {
+                        _split[depth][i+j*nc] = canSplit(depth, i, j) &&
+                                                (_errors[depth][i+j*nc]>maximumError || isOnEdge(depth, i, j));
+                    }
+                }
+            }
+
+            // restrict the tree, a split node needs the edge neighbours of its parent split so leaves differ by at most one level.
+            for(unsigned int depth=numDepths-1; depth>0; --depth)
+            {
+                unsigned int nc = _columns.getNumIntervals(depth);
+                unsigned int nr = _rows.getNumIntervals(depth);
+                unsigned int pnc = _columns.getNumIntervals(depth-1);
+                unsigned int pnr = _rows.getNumIntervals(depth-1);
+                for(unsigned int j=0; j<nr; ++j)
+                {
+                    for(unsigned int i=0; i<nc; ++i)
+                    {
+                        if (!_split[depth][i+j*nc]) continue;
+
+                        unsigned int pi = _columns.parents[depth][i];
+                        unsigned int pj = _rows.parents[depth][j];
+                        _split[depth-1][pi+pj*pnc] = true;
+                        if (pi>0) forceSplit(depth-1, pi-1, pj);
+                        if (pi+1<pnc) forceSplit(depth-1, pi+1, pj);
+                        if (pj>0) forceSplit(depth-1, pi, pj-1);
+                        if (pj+1<pnr) forceSplit(depth-1, pi, pj+1);
+                    }
+                }
+            }
+        }
+
+        void triangulate(std::vector<unsigned int>& triangles) const
+        {
+            unsigned int numDepths = _split.size();
+            for(unsigned int depth=0; depth<numDepths; ++depth)
+            {
+                unsigned int nc = _columns.getNumIntervals(depth);
+                unsigned int nr = _rows.getNumIntervals(depth);
+                for(unsigned int j=0; j<nr; ++j)
+                {
+                    for(unsigned int i=0; i<nc; ++i)
+                    {
+                        if (_split[depth][i+j*nc]) continue;
+                        if (depth>0 && !_split[depth-1][_columns.parents[depth][i] + _rows.parents[depth][j]*_columns.getNumIntervals(depth-1)]) continue;
+
+                        triangulateLeaf(depth, i, j, triangles);
+                    }
+                }
+            }
+        }
+
+    protected:
+
+        static void padAxis(Axis& axis, unsigned int numDepths)
+        {
+            while(axis.boundaries.size()<numDepths)
+            {
+                Axis::Parents parents;
+                for(unsigned int i=0; i+1<axis.boundaries.back().size(); ++i) parents.push_back(i);
+                axis.boundaries.push_back(axis.boundaries.back());
+                axis.parents.push_back(parents);
+            }
+        }
+
+        bool canSplit(unsigned int depth, unsigned int i, unsigned int j) const
+        {
+            return _columns.canSplit(depth, i) || _rows.canSplit(depth, j);
+        }
+
+        bool isOnEdge(unsigned int depth, unsigned int i, unsigned int j) const
+        {
+            return i==0 || j==0 || i+1==_columns.getNumIntervals(depth) || j+1==_rows.getNumIntervals(depth);
+        }
+
+        void forceSplit(unsigned int depth, unsigned int i, unsigned int j)
+        {
+            if (canSplit(depth, i, j)) _split[depth][i+j*_columns.getNumIntervals(depth)] = true;
+        }
+
+        float getHeight(unsigned int c, unsigned int r) const { return _grid.getHeight(c, r); }
+
+        unsigned int getIndex(unsigned int c, unsigned int r) const { return r*_numColumns+c; }
+
+        // the diagonal the dense mesh would use, the one between the corners closest in height.
+        bool useDiagonal00To11(unsigned int c0, unsigned int r0, unsigned int c1, unsigned int r1) const
+        {
+            return fabsf(getHeight(c0,r0)-getHeight(c1,r1)) < fabsf(getHeight(c0,r1)-getHeight(c1,r0));
+        }
+
+        // largest vertical distance of the node's samples from its two triangles.
+        float computeError(unsigned int depth, unsigned int i, unsigned int j) const
+        {
+            if (!canSplit(depth, i, j)) return 0.0f;
+
+            unsigned int c0 = _columns.getStart(depth, i);
+            unsigned int c1 = _columns.getEnd(depth, i);
+            unsigned int r0 = _rows.getStart(depth, j);
+            unsigned int r1 = _rows.getEnd(depth, j);
+
+            float h00 = getHeight(c0,r0);
+            float h10 = getHeight(c1,r0);
+            float h01 = getHeight(c0,r1);
+            float h11 = getHeight(c1,r1);
+            bool diagonal00To11 = useDiagonal00To11(c0, r0, c1, r1);
+
+            float invWidth = 1.0f/float(c1-c0);
+            float invHeight = 1.0f/float(r1-r0);
+
+            float error = 0.0f;
+            for(unsigned int r=r0; r<=r1; ++r)
+            {
+                float v = float(r-r0)*invHeight;
+                for(unsigned int c=c0; c<=c1; ++c)
+                {
+                    float u = float(c-c0)*invWidth;
+                    float z;
+                    if (diagonal00To11)
+                    {
+                        if (u>=v) z = h00 + u*(h10-h00) + v*(h11-h10);
+                        else z = h00 + v*(h01-h00) + u*(h11-h01);
+                    }
+                    else
+                    {
+                        if (u+v<=1.0f) z = h00 + u*(h10-h00) + v*(h01-h00);
+                        else z = h11 + (1.0f-u)*(h01-h11) + (1.0f-v)*(h10-h11);
+                    }
+                    error = osg::maximum(error, fabsf(getHeight(c,r)-z));
+                }
+            }
+            return error;
+        }
+
+        bool isSplit(unsigned int depth, int i, int j) const
+        {
+            if (i<0 || j<0 || i>=static_cast<int>(_columns.getNumIntervals(depth)) || j>=static_cast<int>(_rows.getNumIntervals(depth))) return false;
+            return _split[depth][i+j*_columns.getNumIntervals(depth)];
+        }
+
+        void triangulateLeaf(unsigned int depth, unsigned int i, unsigned int j, std::vector<unsigned int>& triangles) const
+        {
+            unsigned int c0 = _columns.getStart(depth, i);
+            unsigned int c1 = _columns.getEnd(depth, i);
+            unsigned int r0 = _rows.getStart(depth, j);
+            unsigned int r1 = _rows.getEnd(depth, j);
+            unsigned int cm = (c0+c1)/2;
+            unsigned int rm = (r0+r1)/2;
+
+            // a neighbour one level finer puts a sample at the middle of the shared edge.
+            bool below = c1-c0>=2 && isSplit(depth, i, int(j)-1);
+            bool right = r1-r0>=2 && isSplit(depth, i+1, j);
+            bool above = c1-c0>=2 && isSplit(depth, i, j+1);
+            bool left = r1-r0>=2 && isSplit(depth, int(i)-1, j);
+
+            if (!below && !right && !above && !left)
+            {
+                unsigned int i00 = getIndex(c0,r0);
+                unsigned int i10 = getIndex(c1,r0);
+                unsigned int i01 = getIndex(c0,r1);
+                unsigned int i11 = getIndex(c1,r1);
+                if (useDiagonal00To11(c0, r0, c1, r1))
+                {
+                    addTriangle(triangles, i00, i10, i11);
+                    addTriangle(triangles, i00, i11, i01);
+                }
+                else
+                {
+                    addTriangle(triangles, i01, i00, i10);
+                    addTriangle(triangles, i01, i10, i11);
+                }
+                return;
+            }
+
+            // boundary of the leaf counter clockwise from its lower left corner.
+            unsigned int boundary[8];
+            unsigned int numBoundary = 0;
+            int firstMidpoint = -1;
+            boundary[numBoundary++] = getIndex(c0,r0);
+            if (below) { if (firstMidpoint<0) firstMidpoint = numBoundary; boundary[numBoundary++] = getIndex(cm,r0); }
+            boundary[numBoundary++] = getIndex(c1,r0);
+            if (right) { if (firstMidpoint<0) firstMidpoint = numBoundary; boundary[numBoundary++] = getIndex(c1,rm); }
+            boundary[numBoundary++] = getIndex(c1,r1);
+            if (above) { if (firstMidpoint<0) firstMidpoint = numBoundary; boundary[numBoundary++] = getIndex(cm,r1); }
+            boundary[numBoundary++] = getIndex(c0,r1);
+            if (left) { if (firstMidpoint<0) firstMidpoint = numBoundary; boundary[numBoundary++] = getIndex(c0,rm); }
+
+            if (c1-c0>=2 && r1-r0>=2)
+            {
+                // fan around the centre sample.
+                unsigned int centre = getIndex(cm,rm);
+                for(unsigned int k=0; k<numBoundary; ++k)
+                {
+                    addTriangle(triangles, centre, boundary[k], boundary[(k+1)%numBoundary]);
+                }
+            }
+            else
+            {
+                // a leaf one sample wide has no centre, fan from a midpoint which never lies in line with the triangles opposite it.
+                for(unsigned int k=1; k+1<numBoundary; ++k)
+                {
+                    addTriangle(triangles, boundary[firstMidpoint],
+                                boundary[(firstMidpoint+k)%numBoundary],
+                                boundary[(firstMidpoint+k+1)%numBoundary]);
+                }
+            }
+        }
+
+        static void addTriangle(std::vector<unsigned int>& triangles, unsigned int a, unsigned int b, unsigned int c)
+        {
+            triangles.push_back(a);
+            triangles.push_back(b);
+            triangles.push_back(c);
+        }
+
+        const osg::HeightField&             _grid;
+        unsigned int                        _numColumns;
+        Axis                                _columns;
+        Axis                                _rows;
+        std::vector< std::vector<float> >   _errors;
+        std::vector< std::vector<bool> >    _split;
+};
+
+}
+
+void vpb::triangulateHeightField(const osg::HeightField& grid, float maximumError, std::vector<unsigned int>& triangles)
+{
+    if (grid.getNumColumns()<2 || grid.getNumRows()<2) return;
+
+    RestrictedQuadtree quadtree(grid);
+    quadtree.selectNodes(maximumError);
+    quadtree.triangulate(triangles);
+}
@@ -0,0 +1,957 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/ImageUtils>
+#include <vpb/BuildLog>
+
+#include <osg/Math>
+
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define VPB_SSE41_KERNELS 1
+    #define VPB_TARGET_SSE41 __attribute__((target("sse4.1")))
+    #define VPB_TARGET_AVX2 __attribute__((target("avx2")))
+    #include <immintrin.h>
+#endif
+
+using namespace vpb;
+
+enum ImageKernelLevel
+{
+    SCALAR_IMAGE_KERNELS,
+    SSE41_IMAGE_KERNELS,
+    AVX2_IMAGE_KERNELS
+};
+
+static ImageKernelLevel detectImageKernelLevel()
+{
+    ImageKernelLevel level = SCALAR_IMAGE_KERNELS;
+#ifdef VPB_SSE41_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) level = SSE41_IMAGE_KERNELS;
+    if (level==SSE41_IMAGE_KERNELS && __builtin_cpu_supports("avx2")) level = AVX2_IMAGE_KERNELS;
+#endif
+    const char* str = getenv("VPB_IMAGE_KERNELS");
+    if (str)
+    {
+        if (strcmp(str,"SCALAR")==0 || strcmp(str,"scalar")==0) level = SCALAR_IMAGE_KERNELS;
+        else if ((strcmp(str,"SSE41")==0 || strcmp(str,"sse41")==0) && level>SSE41_IMAGE_KERNELS) level = SSE41_IMAGE_KERNELS;
+    }
+
+    log(osg::INFO,"Image kernels using %s",
+        level==AVX2_IMAGE_KERNELS ? "AVX2" : (level==SSE41_IMAGE_KERNELS ? "SSE4.1" : "scalar code"));
+
+    return level;
+}
+
+static ImageKernelLevel getImageKernelLevel()
+{
+    // initialized once, safely, on first use by whichever read thread gets here first.
+    static const ImageKernelLevel s_level = detectImageKernelLevel();
+    return s_level;
+}
+
+bool vpb::useSIMDImageKernels()
+{
+    return getImageKernelLevel()>=SSE41_IMAGE_KERNELS;
+}
+
+bool vpb::useAVX2ImageKernels()
+{
+    return getImageKernelLevel()>=AVX2_IMAGE_KERNELS;
+}
+
+namespace
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Bilinear resampling in 8 bit fixed point, done as a vertical pass that blends the two source rows into
+//  a row of 16 bit intermediates followed by a horizontal pass over that row. The intermediates are stored
+//  offset by -32768 so they fit a signed short, which lets the SIMD kernels use 16 bit multiplies and
+//  multiply-adds while producing exactly the same results as the scalar code.
+
+const int WEIGHT_ONE = 256;
+const int INTERMEDIATE_OFFSET = 32768;
+
+// spare intermediates at the end of the row so the SIMD kernels can load 4 components of a 3 component pixel.
+const int INTERMEDIATE_ROW_PADDING = 4;
+
+struct BilinearAxis
+{
+    // destination pixel i samples the source at origin + i*step, in source pixels.
+    BilinearAxis(int sourceSize, int destinationSize, double origin, double step):
+        index0(destinationSize),
+        index1(destinationSize),
+        weight(destinationSize)
+    {
+        for(int i=0; i<destinationSize; ++i)
+        {
+            double f = osg::clampBetween(origin + double(i)*step, 0.0, double(sourceSize-1));
+
+            int i0 = (int)f;
+            if (i0>=sourceSize) i0 = sourceSize-1;
+
+            index0[i] = i0;
+            index1[i] = osg::minimum(i0+1, sourceSize-1);
+            weight[i] = (i0==sourceSize-1) ? 0 : (int)((f-double(i0))*double(WEIGHT_ONE) + 0.5);
+        }
+    }
+
+    std::vector<int> index0;
+    std::vector<int> index1;
+    std::vector<int> weight;
+};
+
+struct BilinearColumns : public BilinearAxis
+{
+    BilinearColumns(int sourceSize, int destinationSize, double origin, double step, unsigned int numComponents):
+        BilinearAxis(sourceSize, destinationSize, origin, step),
+        offset0(destinationSize),
+        offset1(destinationSize),
+        packedWeight(destinationSize)
+    {
+        for(int i=0; i<destinationSize; ++i)
+        {
+            offset0[i] = index0[i]*numComponents;
+            offset1[i] = index1[i]*numComponents;
+            // the pair of weights as the two shorts the multiply-add kernels expect, low short weighting offset0.
+            packedWeight[i] = (WEIGHT_ONE-weight[i]) | (weight[i]<<16);
+        }
+
+        // the step is never negative so the columns used are the span from the first to the last index.
+        begin = index0.empty() ? 0 : index0.front()*numComponents;
+        end = index1.empty() ? 0 : (index1.back()+1)*numComponents;
+    }
+
+    std::vector<int> offset0;
+    std::vector<int> offset1;
+    std::vector<int> packedWeight;
+    int begin;
+    int end;
+};
+
+void blendRows(const unsigned char* row0, const unsigned char* row1, int wy, short* intermediate, int begin, int end)
+{
+    int wy0 = WEIGHT_ONE-wy;
+    for(int k=begin; k<end; ++k)
+    {
+        intermediate[k] = (short)(row0[k]*wy0 + row1[k]*wy - INTERMEDIATE_OFFSET);
+    }
+}
+
+void blendColumns(const short* intermediate, const BilinearColumns& columns, int first, int last,
+                  unsigned char* dest, unsigned int numComponents)
+{
+    dest += first*numComponents;
+    for(int i=first; i<last; ++i, dest+=numComponents)
+    {
+        const short* a = intermediate + columns.offset0[i];
+        const short* b = intermediate + columns.offset1[i];
+        int wx1 = columns.weight[i];
+        int wx0 = WEIGHT_ONE-wx1;
+        for(unsigned int k=0; k<numComponents; ++k)
+        {
+            dest[k] = (unsigned char)((a[k]*wx0 + b[k]*wx1 + INTERMEDIATE_OFFSET*WEIGHT_ONE + 32768)>>16);
+        }
+    }
+}
+
+#ifdef VPB_SSE41_KERNELS
+
+VPB_TARGET_SSE41 void blendRowsSSE41(const unsigned char* row0, const unsigned char* row1, int wy, short* intermediate, int begin, int end)
+{
+    const __m128i wy0 = _mm_set1_epi16((short)(WEIGHT_ONE-wy));
+    const __m128i wy1 = _mm_set1_epi16((short)wy);
+    const __m128i offset = _mm_set1_epi16((short)0x8000);
+
+    int k = begin;
+    for(; k+16<=end; k+=16)
+    {
+        __m128i r0 = _mm_loadu_si128((const __m128i*)(row0+k));
+        __m128i r1 = _mm_loadu_si128((const __m128i*)(row1+k));
+
+        // the unsigned 16 bit sums wrap correctly, flipping the top bit then applies the offset.
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(r0), wy0), _mm_mullo_epi16(_mm_cvtepu8_epi16(r1), wy1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(r0, 8)), wy0),
+                                   _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(r1, 8)), wy1));
+        lo = _mm_xor_si128(lo, offset);
+        hi = _mm_xor_si128(hi, offset);
+
+        _mm_storeu_si128((__m128i*)(intermediate+k), lo);
+        _mm_storeu_si128((__m128i*)(intermediate+k+8), hi);
+    }
+
+    blendRows(row0, row1, wy, intermediate, k, end);
+}
+
+// interleave the 4 intermediates of one pixel's pair of source columns and weight them with a single multiply-add.
+VPB_TARGET_SSE41 inline __m128i blendPixelSSE41(const short* intermediate, const BilinearColumns& columns, int i, __m128i weights)
+{
+    __m128i a = _mm_loadl_epi64((const __m128i*)(intermediate + columns.offset0[i]));
+    __m128i b = _mm_loadl_epi64((const __m128i*)(intermediate + columns.offset1[i]));
+    return _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights);
+}
+
+VPB_TARGET_SSE41 void blendColumnsSSE41(const short* intermediate, const BilinearColumns& columns, int destinationWidth,
+                                        unsigned char* dest, unsigned int numComponents)
+{
+    const __m128i rounding = _mm_set1_epi32(INTERMEDIATE_OFFSET*WEIGHT_ONE + 32768);
+    // drops the unused fourth byte of each pixel when writing 3 component pixels.
+    const __m128i compactRGB = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+
+    int i = 0;
+    for(; i+4<=destinationWidth; i+=4)
+    {
+        __m128i weights = _mm_loadu_si128((const __m128i*)(&columns.packedWeight[i]));
+
+        __m128i p0 = blendPixelSSE41(intermediate, columns, i,   _mm_shuffle_epi32(weights, 0x00));
+        __m128i p1 = blendPixelSSE41(intermediate, columns, i+1, _mm_shuffle_epi32(weights, 0x55));
+        __m128i p2 = blendPixelSSE41(intermediate, columns, i+2, _mm_shuffle_epi32(weights, 0xaa));
+        __m128i p3 = blendPixelSSE41(intermediate, columns, i+3, _mm_shuffle_epi32(weights, 0xff));
+
+        p0 = _mm_srai_epi32(_mm_add_epi32(p0, rounding), 16);
+        p1 = _mm_srai_epi32(_mm_add_epi32(p1, rounding), 16);
+        p2 = _mm_srai_epi32(_mm_add_epi32(p2, rounding), 16);
+        p3 = _mm_srai_epi32(_mm_add_epi32(p3, rounding), 16);
+
+        __m128i result = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+
+        if (numComponents==4)
+        {
+            _mm_storeu_si128((__m128i*)(dest + i*4), result);
+        }
+        else
+        {
+            result = _mm_shuffle_epi8(result, compactRGB);
+            _mm_storel_epi64((__m128i*)(dest + i*3), result);
+            int value = _mm_cvtsi128_si32(_mm_srli_si128(result, 8));
+            memcpy(dest + i*3 + 8, &value, 4);
+        }
+    }
+
+    blendColumns(intermediate, columns, i, destinationWidth, dest, numComponents);
+}
+
+VPB_TARGET_AVX2 void blendRowsAVX2(const unsigned char* row0, const unsigned char* row1, int wy, short* intermediate, int begin, int end)
+{
+    const __m256i wy0 = _mm256_set1_epi16((short)(WEIGHT_ONE-wy));
+    const __m256i wy1 = _mm256_set1_epi16((short)wy);
+    const __m256i offset = _mm256_set1_epi16((short)0x8000);
+
+    int k = begin;
+    for(; k+32<=end; k+=32)
+    {
+        __m256i r0lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row0+k)));
+        __m256i r1lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row1+k)));
+        __m256i r0hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row0+k+16)));
+        __m256i r1hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row1+k+16)));
+
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(r0lo, wy0), _mm256_mullo_epi16(r1lo, wy1));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(r0hi, wy0), _mm256_mullo_epi16(r1hi, wy1));
+
+        _mm256_storeu_si256((__m256i*)(intermediate+k), _mm256_xor_si256(lo, offset));
+        _mm256_storeu_si256((__m256i*)(intermediate+k+16), _mm256_xor_si256(hi, offset));
+    }
+
+    blendRows(row0, row1, wy, intermediate, k, end);
+}
+
+// blend pixel i in the low lane and pixel i+4 in the high lane.
+VPB_TARGET_AVX2 inline __m256i blendPixelPairAVX2(const short* intermediate, const BilinearColumns& columns, int i, __m256i weights)
+{
+    __m128i lo = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(intermediate + columns.offset0[i])),
+                                    _mm_loadl_epi64((const __m128i*)(intermediate + columns.offset1[i])));
+    __m128i hi = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(intermediate + columns.offset0[i+4])),
+                                    _mm_loadl_epi64((const __m128i*)(intermediate + columns.offset1[i+4])));
+    __m256i ab = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    return _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ab, weights), _mm256_set1_epi32(INTERMEDIATE_OFFSET*WEIGHT_ONE + 32768)), 16);
+}
+
+VPB_TARGET_AVX2 void blendColumnsAVX2(const short* intermediate, const BilinearColumns& columns, int destinationWidth,
+                                      unsigned char* dest, unsigned int numComponents)
+{
+    const __m256i compactRGB = _mm256_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1,
+                                                0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+
+    int i = 0;
+    for(; i+8<=destinationWidth; i+=8)
+    {
+        __m256i weights = _mm256_loadu_si256((const __m256i*)(&columns.packedWeight[i]));
+
+        __m256i p04 = blendPixelPairAVX2(intermediate, columns, i,   _mm256_permutevar8x32_epi32(weights, _mm256_setr_epi32(0,0,0,0,4,4,4,4)));
+        __m256i p15 = blendPixelPairAVX2(intermediate, columns, i+1, _mm256_permutevar8x32_epi32(weights, _mm256_setr_epi32(1,1,1,1,5,5,5,5)));
+        __m256i p26 = blendPixelPairAVX2(intermediate, columns, i+2, _mm256_permutevar8x32_epi32(weights, _mm256_setr_epi32(2,2,2,2,6,6,6,6)));
+        __m256i p37 = blendPixelPairAVX2(intermediate, columns, i+3, _mm256_permutevar8x32_epi32(weights, _mm256_setr_epi32(3,3,3,3,7,7,7,7)));
+
+        // the packs work within each lane, leaving pixels 0 to 3 in the low lane and 4 to 7 in the high lane.
+        __m256i result = _mm256_packus_epi16(_mm256_packs_epi32(p04, p15), _mm256_packs_epi32(p26, p37));
+
+        if (numComponents==4)
+        {
+            _mm256_storeu_si256((__m256i*)(dest + i*4), result);
+        }
+        else
+        {
+            result = _mm256_shuffle_epi8(result, compactRGB);
+            __m128i lo = _mm256_castsi256_si128(result);
+            __m128i hi = _mm256_extracti128_si256(result, 1);
+            int value;
+
+            _mm_storel_epi64((__m128i*)(dest + i*3), lo);
+            value = _mm_cvtsi128_si32(_mm_srli_si128(lo, 8));
+            memcpy(dest + i*3 + 8, &value, 4);
+
+            _mm_storel_epi64((__m128i*)(dest + i*3 + 12), hi);
+            value = _mm_cvtsi128_si32(_mm_srli_si128(hi, 8));
+            memcpy(dest + i*3 + 20, &value, 4);
+        }
+    }
+
+    blendColumns(intermediate, columns, i, destinationWidth, dest, numComponents);
+}
+
+#endif
+
+void resampleBilinear(const unsigned char* source, int sourceWidth, int sourceHeight, int sourceRowStride,
+                      double sourceX, double sourceY, double sourceStepX, double sourceStepY,
+                      unsigned char* destination, int destinationWidth, int destinationHeight, int destinationRowStride,
+                      unsigned int numComponents)
+{
+    BilinearColumns columns(sourceWidth, destinationWidth, sourceX, sourceStepX, numComponents);
+    BilinearAxis rows(sourceHeight, destinationHeight, sourceY, sourceStepY);
+
+    std::vector<short> intermediate(sourceWidth*numComponents + INTERMEDIATE_ROW_PADDING, 0);
+
+#ifdef VPB_SSE41_KERNELS
+    ImageKernelLevel level = (numComponents==3 || numComponents==4) ? getImageKernelLevel() : SCALAR_IMAGE_KERNELS;
+#endif
+
+    for(int j=0; j<destinationHeight; ++j)
+    {
+        const unsigned char* row0 = source + rows.index0[j]*sourceRowStride;
+        const unsigned char* row1 = source + rows.index1[j]*sourceRowStride;
+        unsigned char* dest = destination + j*destinationRowStride;
+
+#ifdef VPB_SSE41_KERNELS
+        if (level==AVX2_IMAGE_KERNELS)
+        {
+            blendRowsAVX2(row0, row1, rows.weight[j], &intermediate[0], columns.begin, columns.end);
+            blendColumnsAVX2(&intermediate[0], columns, destinationWidth, dest, numComponents);
+            continue;
+        }
+        if (level==SSE41_IMAGE_KERNELS)
+        {
+            blendRowsSSE41(row0, row1, rows.weight[j], &intermediate[0], columns.begin, columns.end);
+            blendColumnsSSE41(&intermediate[0], columns, destinationWidth, dest, numComponents);
+            continue;
+        }
+#endif
+        blendRows(row0, row1, rows.weight[j], &intermediate[0], columns.begin, columns.end);
+        blendColumns(&intermediate[0], columns, 0, destinationWidth, dest, numComponents);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Separable filtered resampling, used for the higher order filters.
+
+inline double sinc(double x)
+{
+    if (x==0.0) return 1.0;
+    x *= osg::PI;
+    return sin(x)/x;
+}
+
+inline double filterWeight(ResampleFilter filter, double x)
+{
+    x = fabs(x);
+    switch(filter)
+    {
+        case(RESAMPLE_BICUBIC):
+        {
+            // Catmull-Rom
+            const double a = -0.5;
+            if (x<1.0) return ((a+2.0)*x - (a+3.0))*x*x + 1.0;
+            if (x<2.0) return ((a*x - 5.0*a)*x + 8.0*a)*x - 4.0*a;
+            return 0.0;
+        }
+        case(RESAMPLE_LANCZOS):
+            return (x<3.0) ? sinc(x)*sinc(x/3.0) : 0.0;
+        default:
+            return (x<1.0) ? 1.0-x : 0.0;
+    }
+}
+
+inline double filterRadius(ResampleFilter filter)
+{
+    switch(filter)
+    {
+        case(RESAMPLE_BICUBIC): return 2.0;
+        case(RESAMPLE_LANCZOS): return 3.0;
+        default: return 1.0;
+    }
+}
+
+struct FilterAxis
+{
+    // destination pixel i is centred on the source at origin + i*step, in source pixels.
+    FilterAxis(int sourceSize, int destinationSize, double origin, double step, ResampleFilter filter):
+        start(destinationSize),
+        count(destinationSize)
+    {
+        // widen the filter when minifying so all source pixels contribute.
+        double scale = osg::maximum(step, 1.0);
+        double support = filterRadius(filter)*scale;
+
+        for(int i=0; i<destinationSize; ++i)
+        {
+            double center = origin + double(i)*step;
+            int first = (int)ceil(center-support);
+            int last = (int)floor(center+support);
+
+            start[i] = weights.size();
+            count[i] = last-first+1;
+
+            double total = 0.0;
+            for(int s=first; s<=last; ++s)
+            {
+                double w = filterWeight(filter, (double(s)-center)/scale);
+                indices.push_back(osg::clampBetween(s, 0, sourceSize-1));
+                weights.push_back(float(w));
+                total += w;
+            }
+
+            if (total!=0.0)
+            {
+                for(unsigned int k=start[i]; k<weights.size(); ++k) weights[k] = float(weights[k]/total);
+            }
+        }
+    }
+
+    std::vector<unsigned int>   start;
+    std::vector<int>            count;
+    std::vector<int>            indices;
+    std::vector<float>          weights;
+};
+
+void resampleFiltered(const unsigned char* source, int sourceWidth, int sourceHeight, int sourceRowStride,
+                      double sourceX, double sourceY, double sourceStepX, double sourceStepY,
+                      unsigned char* destination, int destinationWidth, int destinationHeight, int destinationRowStride,
+                      unsigned int numComponents, ResampleFilter filter)
+{
+    FilterAxis columns(sourceWidth, destinationWidth, sourceX, sourceStepX, filter);
+    FilterAxis rows(sourceHeight, destinationHeight, sourceY, sourceStepY, filter);
+
+    // horizontal pass into a float buffer of sourceHeight x destinationWidth.
+    std::vector<float> horizontal(sourceHeight*destinationWidth*numComponents);
+    for(int j=0; j<sourceHeight; ++j)
+    {
+        const unsigned char* row = source + j*sourceRowStride;
+        float* dest = &horizontal[j*destinationWidth*numComponents];
+        for(int i=0; i<destinationWidth; ++i, dest+=numComponents)
+        {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            const int* index = &columns.indices[columns.start[i]];
+            const float* weight = &columns.weights[columns.start[i]];
+            for(int n=0; n<columns.count[i]; ++n)
+            {
+                const unsigned char* pixel = row + index[n]*numComponents;
+                for(unsigned int k=0; k<numComponents; ++k) sum[k] += weight[n]*float(pixel[k]);
+            }
+            for(unsigned int k=0; k<numComponents; ++k) dest[k] = sum[k];
+        }
+    }
+
+    // vertical pass into the destination.
+    int floatRowStride = destinationWidth*numComponents;
+    for(int j=0; j<destinationHeight; ++j)
+    {
+        unsigned char* dest = destination + j*destinationRowStride;
+        const int* index = &rows.indices[rows.start[j]];
+        const float* weight = &rows.weights[rows.start[j]];
+        for(int i=0; i<floatRowStride; ++i)
+        {
+            float sum = 0.0f;
+            for(int n=0; n<rows.count[j]; ++n) sum += weight[n]*horizontal[index[n]*floatRowStride + i];
+            dest[i] = (unsigned char)osg::clampBetween(int(sum+0.5f), 0, 255);
+        }
+    }
+}
+
+}
+
+void vpb::resampleImage(const unsigned char* source, int sourceWidth, int sourceHeight, int sourceRowStride,
+                        unsigned char* destination, int destinationWidth, int destinationHeight, int destinationRowStride,
+                        unsigned int numComponents, ResampleFilter filter)
+{
+    // align the corner pixels.
+    double sourceStepX = (destinationWidth>1) ? double(sourceWidth-1)/double(destinationWidth-1) : 0.0;
+    double sourceStepY = (destinationHeight>1) ? double(sourceHeight-1)/double(destinationHeight-1) : 0.0;
+
+    resampleImageWindow(source, sourceWidth, sourceHeight, sourceRowStride,
+                        0.0, 0.0, sourceStepX, sourceStepY,
+                        destination, destinationWidth, destinationHeight, destinationRowStride,
+                        numComponents, filter);
+}
+
+void vpb::resampleImageWindow(const unsigned char* source, int sourceWidth, int sourceHeight, int sourceRowStride,
+                              double sourceX, double sourceY, double sourceStepX, double sourceStepY,
+                              unsigned char* destination, int destinationWidth, int destinationHeight, int destinationRowStride,
+                              unsigned int numComponents, ResampleFilter filter)
+{
+    if (sourceWidth<=0 || sourceHeight<=0 || destinationWidth<=0 || destinationHeight<=0) return;
+    if (numComponents<1 || numComponents>4) return;
+
+    if (filter==RESAMPLE_BILINEAR)
+    {
+        resampleBilinear(source, sourceWidth, sourceHeight, sourceRowStride,
+                         sourceX, sourceY, sourceStepX, sourceStepY,
+                         destination, destinationWidth, destinationHeight, destinationRowStride,
+                         numComponents);
+    }
+    else
+    {
+        resampleFiltered(source, sourceWidth, sourceHeight, sourceRowStride,
+                         sourceX, sourceY, sourceStepX, sourceStepY,
+                         destination, destinationWidth, destinationHeight, destinationRowStride,
+                         numComponents, filter);
+    }
+}
+
+osg::Image* vpb::resampleImage(const osg::Image& image, int width, int height, ResampleFilter filter)
+{
+    if (image.getDataType()!=GL_UNSIGNED_BYTE || image.isCompressed() || image.r()!=1 || !image.data())
+    {
+        log(osg::INFO,"vpb::resampleImage() unsupported image format");
+        return 0;
+    }
+
+    unsigned int numComponents = osg::Image::computeNumComponents(image.getPixelFormat());
+
+    osg::ref_ptr<osg::Image> result = new osg::Image;
+    result->allocateImage(width, height, 1, image.getPixelFormat(), GL_UNSIGNED_BYTE, image.getPacking());
+    result->setInternalTextureFormat(image.getInternalTextureFormat());
+
+    resampleImage(image.data(), image.s(), image.t(), image.getRowSizeInBytes(),
+                  result->data(), result->s(), result->t(), result->getRowSizeInBytes(),
+                  numComponents, filter);
+
+    return result.release();
+}
+
+namespace
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Compositing of source rows into destination rows.
+
+inline unsigned char divideBy255(int value)
+{
+    // exact rounded value/255 for value in 0..255*255
+    value += 128;
+    return (unsigned char)((value + (value>>8))>>8);
+}
+
+inline void blendPixel(const unsigned char* src, unsigned int sourceNumComponents, unsigned char* dst, unsigned int destinationNumComponents, bool coverageAlpha)
+{
+    int as = (sourceNumComponents==4) ? src[3] : 255;
+    if (as==0) return;
+
+    if (as==255)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        if (destinationNumComponents==4) dst[3] = 255;
+        return;
+    }
+
+    if (coverageAlpha && destinationNumComponents==4)
+    {
+        // straight alpha "over" operator.
+        int ad = dst[3];
+        int weightDestination = ad*(255-as);
+        int ao = as*255 + weightDestination;
+        for(unsigned int k=0; k<3; ++k)
+        {
+            dst[k] = (unsigned char)((src[k]*as*255 + dst[k]*weightDestination + ao/2)/ao);
+        }
+        dst[3] = divideBy255(ao);
+        return;
+    }
+
+    int ad = 255-as;
+    dst[0] = divideBy255(src[0]*as + dst[0]*ad);
+    dst[1] = divideBy255(src[1]*as + dst[1]*ad);
+    dst[2] = divideBy255(src[2]*as + dst[2]*ad);
+    if (destinationNumComponents==4) dst[3] = osg::maximum(dst[3], (unsigned char)as);
+}
+
+void compositeRow(const unsigned char* src, unsigned int sourceNumComponents,
+                  unsigned char* dst, unsigned int destinationNumComponents,
+                  int width, CompositeMode mode, bool coverageAlpha)
+{
+    switch(mode)
+    {
+        case(COMPOSITE_OPAQUE_COPY):
+        {
+            if (sourceNumComponents==destinationNumComponents)
+            {
+                memcpy(dst, src, width*sourceNumComponents);
+                return;
+            }
+            for(int i=0; i<width; ++i, src+=sourceNumComponents, dst+=destinationNumComponents)
+            {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                if (destinationNumComponents==4) dst[3] = (sourceNumComponents==4) ? src[3] : 255;
+            }
+            return;
+        }
+        case(COMPOSITE_ALPHA_OVER):
+        {
+            for(int i=0; i<width; ++i, src+=sourceNumComponents, dst+=destinationNumComponents)
+            {
+                blendPixel(src, sourceNumComponents, dst, destinationNumComponents, coverageAlpha);
+            }
+            return;
+        }
+        case(COMPOSITE_BLACK_AS_NODATA):
+        {
+            for(int i=0; i<width; ++i, src+=sourceNumComponents, dst+=destinationNumComponents)
+            {
+                if ((src[0] | src[1] | src[2])!=0)
+                {
+                    dst[0] = src[0];
+                    dst[1] = src[1];
+                    dst[2] = src[2];
+                    if (destinationNumComponents==4) dst[3] = 255;
+                }
+            }
+            return;
+        }
+    }
+}
+
+#ifdef VPB_SSE41_KERNELS
+
+// RGBA over RGBA, blending with destination alpha = max(source alpha, destination alpha), 4 pixels per iteration.
+VPB_TARGET_SSE41 int compositeRowAlphaOverSSE41(const unsigned char* src, unsigned char* dst, int width)
+{
+    const __m128i alphaShuffle = _mm_setr_epi8(3,3,3,3, 7,7,7,7, 11,11,11,11, 15,15,15,15);
+    const __m128i alphaLanes = _mm_setr_epi8(0,0,0,-1, 0,0,0,-1, 0,0,0,-1, 0,0,0,-1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i all255 = _mm_set1_epi16(255);
+    const __m128i rounding = _mm_set1_epi16(128);
+
+    int i = 0;
+    for(; i+4<=width; i+=4, src+=16, dst+=16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*)src);
+        __m128i a = _mm_shuffle_epi8(s, alphaShuffle);
+
+        // fast paths for fully transparent and fully opaque runs.
+        int transparent = _mm_movemask_epi8(_mm_cmpeq_epi8(a, zero));
+        if (transparent==0xffff) continue;
+
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+
+        int opaque = _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_set1_epi8(-1)));
+        if (opaque==0xffff)
+        {
+            _mm_storeu_si128((__m128i*)dst, s);
+            continue;
+        }
+
+        __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+        __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+        __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+        __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+        __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+        __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+
+        __m128i r_lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s_lo, a_lo), _mm_mullo_epi16(d_lo, _mm_sub_epi16(all255, a_lo))), rounding);
+        __m128i r_hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s_hi, a_hi), _mm_mullo_epi16(d_hi, _mm_sub_epi16(all255, a_hi))), rounding);
+        r_lo = _mm_srli_epi16(_mm_add_epi16(r_lo, _mm_srli_epi16(r_lo, 8)), 8);
+        r_hi = _mm_srli_epi16(_mm_add_epi16(r_hi, _mm_srli_epi16(r_hi, 8)), 8);
+
+        __m128i result = _mm_packus_epi16(r_lo, r_hi);
+        result = _mm_blendv_epi8(result, _mm_max_epu8(s, d), alphaLanes);
+
+        _mm_storeu_si128((__m128i*)dst, result);
+    }
+    return i;
+}
+
+#endif
+
+}
+
+void vpb::compositeImage(const unsigned char* source, int sourceRowStride, unsigned int sourceNumComponents,
+                         unsigned char* destination, int destinationRowStride, unsigned int destinationNumComponents,
+                         int width, int height, CompositeMode mode, bool coverageAlpha)
+{
+    if (width<=0 || height<=0) return;
+    if (sourceNumComponents<3 || sourceNumComponents>4 || destinationNumComponents<3 || destinationNumComponents>4)
+    {
+        log(osg::INFO,"vpb::compositeImage() unsupported number of components");
+        return;
+    }
+
+    // without source alpha alpha over is just an opaque copy.
+    if (mode==COMPOSITE_ALPHA_OVER && sourceNumComponents!=4) mode = COMPOSITE_OPAQUE_COPY;
+
+#ifdef VPB_SSE41_KERNELS
+    bool useSIMD = mode==COMPOSITE_ALPHA_OVER && !coverageAlpha &&
+                   sourceNumComponents==4 && destinationNumComponents==4 &&
+                   useSIMDImageKernels();
+#endif
+
+    for(int row=0; row<height; ++row, source+=sourceRowStride, destination+=destinationRowStride)
+    {
+        const unsigned char* src = source;
+        unsigned char* dst = destination;
+        int numPixels = width;
+
+#ifdef VPB_SSE41_KERNELS
+        if (useSIMD)
+        {
+            int numDone = compositeRowAlphaOverSSE41(src, dst, width);
+            src += numDone*4;
+            dst += numDone*4;
+            numPixels -= numDone;
+        }
+#endif
+
+        compositeRow(src, sourceNumComponents, dst, destinationNumComponents, numPixels, mode, coverageAlpha);
+    }
+}
+
+void vpb::expandPalette(const unsigned char* indices, unsigned int indexStride, const unsigned char* lut,
+                        unsigned char* destination, unsigned int destinationNumComponents, unsigned int numPixels)
+{
+    if (destinationNumComponents==4)
+    {
+        for(unsigned int i=0; i<numPixels; ++i, indices+=indexStride, destination+=4)
+        {
+            memcpy(destination, lut + (*indices)*4, 4);
+        }
+    }
+    else
+    {
+        for(unsigned int i=0; i<numPixels; ++i, indices+=indexStride, destination+=destinationNumComponents)
+        {
+            const unsigned char* entry = lut + (*indices)*4;
+            destination[0] = entry[0];
+            destination[1] = entry[1];
+            destination[2] = entry[2];
+        }
+    }
+}
+
+namespace
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Quantization, error diffusion and 16 bit packing of 8 bit images.
+
+struct Quantizer
+{
+    unsigned int    numComponents;
+    unsigned int    maxValue[4];    // largest quantized value of each component
+    unsigned int    packShift[4];   // bit position of each component in a packed pixel
+    bool            pack;
+
+    // per component tables from an 8 bit value to its quantized and packed bits, and back to the 8 bit value it represents.
+    unsigned short  packed[4][256];
+    unsigned char   reconstructed[4][256];
+
+    Quantizer(unsigned int components, unsigned int bits, GLenum dataType):
+        numComponents(components),
+        pack(dataType!=GL_UNSIGNED_BYTE)
+    {
+        unsigned int packBits[4] = { 8, 8, 8, 8 };
+        unsigned int shifts[4] = { 0, 0, 0, 0 };
+        if (dataType==GL_UNSIGNED_SHORT_5_6_5)
+        {
+            packBits[0] = 5; packBits[1] = 6; packBits[2] = 5;
+            shifts[0] = 11; shifts[1] = 5; shifts[2] = 0;
+        }
+        else if (dataType==GL_UNSIGNED_SHORT_5_5_5_1)
+        {
+            packBits[0] = 5; packBits[1] = 5; packBits[2] = 5; packBits[3] = 1;
+            shifts[0] = 11; shifts[1] = 6; shifts[2] = 1; shifts[3] = 0;
+        }
+
+        for(unsigned int c=0; c<4; ++c)
+        {
+            unsigned int quantizationBits = (bits>0 && bits<8) ? bits : 8;
+            unsigned int packMax = (1u<<packBits[c])-1;
+            maxValue[c] = (1u<<osg::minimum(quantizationBits, packBits[c]))-1;
+            packShift[c] = shifts[c];
+
+            for(unsigned int v=0; v<256; ++v)
+            {
+                unsigned int q = (v*maxValue[c]+127)/255;
+                unsigned int r = (q*255+maxValue[c]/2)/maxValue[c];
+                reconstructed[c][v] = static_cast<unsigned char>(r);
+                packed[c][v] = static_cast<unsigned short>(((r*packMax+127)/255) << shifts[c]);
+            }
+        }
+    }
+
+    void write(unsigned char* destination, unsigned int x, const unsigned char* values) const
+    {
+        if (pack)
+        {
+            unsigned short pixel = 0;
+            for(unsigned int c=0; c<numComponents; ++c) pixel |= packed[c][values[c]];
+            memcpy(destination + x*2, &pixel, 2);
+        }
+        else
+        {
+            unsigned char* pixel = destination + x*numComponents;
+            for(unsigned int c=0; c<numComponents; ++c) pixel[c] = reconstructed[c][values[c]];
+        }
+    }
+
+    // pixels are written at or before the position they were read from, so rows can be converted in place.
+    void quantizeRow(const unsigned char* source, unsigned char* destination, unsigned int width) const
+    {
+        for(unsigned int x=0; x<width; ++x, source += numComponents)
+        {
+            unsigned char values[4];
+            memcpy(values, source, numComponents);
+            write(destination, x, values);
+        }
+    }
+
+    // spread each pixel's error, a third right, a third below and a sixth to each of below left and below right.
+    void diffuseRow(const unsigned char* source, unsigned char* destination, unsigned int width,
+                    std::vector<float>& currentErrors, std::vector<float>& nextErrors) const
+    {
+        for(unsigned int x=0; x<width; ++x, source += numComponents)
+        {
+            unsigned char values[4];
+            for(unsigned int c=0; c<numComponents; ++c)
+            {
+                float v = float(source[c]) + currentErrors[x*numComponents+c];
+                values[c] = static_cast<unsigned char>(osg::clampBetween(int(floorf(v+0.5f)), 0, 255));
+
+                float error = v - float(reconstructed[c][values[c]]);
+                if (x+1<width)
+                {
+                    currentErrors[(x+1)*numComponents+c] += error*(2.0f/6.0f);
+                    nextErrors[(x+1)*numComponents+c] += error*(1.0f/6.0f);
+                }
+                if (x>0)
+                {
+                    nextErrors[(x-1)*numComponents+c] += error*(1.0f/6.0f);
+                }
+                nextErrors[x*numComponents+c] += error*(2.0f/6.0f);
+            }
+            write(destination, x, values);
+        }
+    }
+};
+
+}
+
+bool vpb::quantizeImage(osg::Image& image, unsigned int bits, bool errorDiffusion, GLenum dataType)
+{
+    if (image.getDataType()!=GL_UNSIGNED_BYTE || image.isCompressed() || image.isMipmap() || image.r()!=1 || !image.data())
+    {
+        log(osg::INFO,"vpb::quantizeImage() unsupported image format");
+        return false;
+    }
+
+    GLenum pixelFormat = image.getPixelFormat();
+    switch(pixelFormat)
+    {
+        case(GL_LUMINANCE):
+        case(GL_ALPHA):
+        case(GL_LUMINANCE_ALPHA):
+        case(GL_RGB):
+        case(GL_RGBA): break;
+        default: return false;
+    }
+
+    if ((dataType==GL_UNSIGNED_SHORT_5_6_5 && pixelFormat!=GL_RGB) ||
+        (dataType==GL_UNSIGNED_SHORT_5_5_5_1 && pixelFormat!=GL_RGBA) ||
+        (dataType!=GL_UNSIGNED_BYTE && dataType!=GL_UNSIGNED_SHORT_5_6_5 && dataType!=GL_UNSIGNED_SHORT_5_5_5_1))
+    {
+        log(osg::INFO,"vpb::quantizeImage() unsupported packing");
+        return false;
+    }
+
+    bool pack = dataType!=GL_UNSIGNED_BYTE;
+    if (!pack && (bits==0 || bits>=8)) return true;
+
+    unsigned int numComponents = osg::Image::computeNumComponents(pixelFormat);
+    Quantizer quantizer(numComponents, bits, dataType);
+
+    int s = image.s();
+    int t = image.t();
+    int packing = image.getPacking();
+    unsigned char* data = image.data();
+    unsigned int sourceRowSize = image.getRowSizeInBytes();
+    unsigned int destinationRowSize = pack ? osg::Image::computeRowWidthInBytes(s, pixelFormat, dataType, packing) : sourceRowSize;
+
+    std::vector<float> currentErrors;
+    std::vector<float> nextErrors;
+    if (errorDiffusion)
+    {
+        currentErrors.resize(s*numComponents, 0.0f);
+        nextErrors.resize(s*numComponents, 0.0f);
+    }
+
+    // packed rows are never longer than the rows they come from so each row is written at or before where it was read.
+    for(int r=0; r<t; ++r)
+    {
+        const unsigned char* source = data + r*sourceRowSize;
+        unsigned char* destination = data + r*destinationRowSize;
+        if (errorDiffusion)
+        {
+            quantizer.diffuseRow(source, destination, s, currentErrors, nextErrors);
+            currentErrors.swap(nextErrors);
+            std::fill(nextErrors.begin(), nextErrors.end(), 0.0f);
+        }
+        else
+        {
+            quantizer.quantizeRow(source, destination, s);
+        }
+    }
+
+    if (pack)
+    {
+        // hand the same memory back to the image, stopping setImage() from freeing it.
+        osg::Image::AllocationMode allocationMode = image.getAllocationMode();
+        image.setAllocationMode(osg::Image::NO_DELETE);
+        image.setImage(s, t, 1, image.getInternalTextureFormat(), pixelFormat, dataType, data, allocationMode, packing);
+    }
+    else
+    {
+        image.dirty();
+    }
+
+    return true;
+}
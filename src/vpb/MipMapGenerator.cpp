@@ -0,0 +1,478 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/MipMapGenerator>
+
+#include <osg/Math>
+
+#include <OpenThreads/Thread>
+
+#include <vector>
+#include <string.h>
+#include <math.h>
+
+using namespace vpb;
+
+namespace
+{
+
+float sinc(float x)
+{
+    if (fabsf(x)<1e-6f) return 1.0f;
+    x *= osg::PI;
+    return sinf(x)/x;
+}
+
+// zeroth order modified Bessel function of the first kind, summed from its power series.
+float bessel0(float x)
+{
+    float halfX = x*0.5f;
+    float sum = 1.0f;
+    float term = 1.0f;
+    for(unsigned int k=1; k<32; ++k)
+    {
+        term *= (halfX/float(k))*(halfX/float(k));
+        sum += term;
+        if (term<sum*1e-7f) break;
+    }
+    return sum;
+}
+
+// the half width of the filter, in texels of the level being generated.
+float computeFilterRadius(BuildOptions::MipMapFilter filter)
+{
+    switch(filter)
+    {
+        case(BuildOptions::KAISER_FILTER):
+        case(BuildOptions::LANCZOS_FILTER): return 3.0f;
+        default: return 0.5f;
+    }
+}
+
+float evaluateFilter(BuildOptions::MipMapFilter filter, float x)
+{
+    x = fabsf(x);
+    switch(filter)
+    {
+        case(BuildOptions::KAISER_FILTER):
+        {
+            const float width = 3.0f;
+            const float alpha = 4.0f;
+            if (x>=width) return 0.0f;
+            float r = x/width;
+            return sinc(x)*bessel0(alpha*sqrtf(1.0f-r*r))/bessel0(alpha);
+        }
+        case(BuildOptions::LANCZOS_FILTER):
+            return x<3.0f ? sinc(x)*sinc(x/3.0f) : 0.0f;
+        default:
+            return x<=0.5f ? 1.0f : 0.0f;
+    }
+}
+
+float decodeSRGB(float v)
+{
+    return v<=0.04045f ? v/12.92f : powf((v+0.055f)/1.055f, 2.4f);
+}
+
+float encodeSRGB(float v)
+{
+    return v<=0.0031308f ? v*12.92f : 1.055f*powf(v, 1.0f/2.4f)-0.055f;
+}
+
+// normalized filter weights along one axis, maxTaps per destination texel starting at the source texel first[d].
+struct Weights
+{
+    unsigned int                maxTaps;
+    std::vector<unsigned int>   first;
+    std::vector<unsigned int>   numTaps;
+    std::vector<float>          weights;
+
+    void compute(BuildOptions::MipMapFilter filter, unsigned int sourceSize, unsigned int destinationSize)
+    {
+        float scale = float(sourceSize)/float(destinationSize);
+        float support = computeFilterRadius(filter)*scale;
+
+        maxTaps = static_cast<unsigned int>(ceilf(support*2.0f))+2;
+        first.resize(destinationSize);
+        numTaps.resize(destinationSize);
+        weights.assign(destinationSize*maxTaps, 0.0f);
+
+        for(unsigned int d=0; d<destinationSize; ++d)
+        {
+            float centre = (float(d)+0.5f)*scale;
+            int start = osg::maximum(static_cast<int>(floorf(centre-support)), 0);
+            int end = osg::minimum(static_cast<int>(ceilf(centre+support)), static_cast<int>(sourceSize)-1);
+
+            float* w = &weights[d*maxTaps];
+            float total = 0.0f;
+            unsigned int n = 0;
+            for(int s=start; s<=end && n<maxTaps; ++s, ++n)
+            {
+                w[n] = evaluateFilter(filter, (float(s)+0.5f-centre)/scale);
+                total += w[n];
+            }
+
+            if (total!=0.0f)
+            {
+                for(unsigned int i=0; i<n; ++i) w[i] /= total;
+            }
+            else
+            {
+                start = osg::minimum(static_cast<int>(centre), static_cast<int>(sourceSize)-1);
+                w[0] = 1.0f;
+                n = 1;
+            }
+
+            first[d] = start;
+            numTaps[d] = n;
+        }
+    }
+};
+
+// one level of the chain, resampled horizontally into intermediate then vertically into destination.
+struct Resample
+{
+    unsigned int    numComponents;
+    const float*    source;
+    unsigned int    sourceWidth;
+    unsigned int    sourceHeight;
+    float*          intermediate;
+    float*          destination;
+    unsigned int    destinationWidth;
+    unsigned int    destinationHeight;
+    Weights         horizontal;
+    Weights         vertical;
+
+    void resampleRows(unsigned int first, unsigned int stride) const
+    {
+        for(unsigned int r=first; r<sourceHeight; r+=stride)
+        {
+            const float* in = source + r*sourceWidth*numComponents;
+            float* out = intermediate + r*destinationWidth*numComponents;
+            for(unsigned int x=0; x<destinationWidth; ++x, out += numComponents)
+            {
+                const float* w = &horizontal.weights[x*horizontal.maxTaps];
+                const float* texel = in + horizontal.first[x]*numComponents;
+                for(unsigned int c=0; c<numComponents; ++c) out[c] = 0.0f;
+                for(unsigned int k=0; k<horizontal.numTaps[x]; ++k, texel += numComponents)
+                {
+                    for(unsigned int c=0; c<numComponents; ++c) out[c] += w[k]*texel[c];
+                }
+            }
+        }
+    }
+
+    void resampleColumns(unsigned int first, unsigned int stride) const
+    {
+        // whole rows are accumulated at a time so the inner loop runs over contiguous floats.
+        unsigned int rowLength = destinationWidth*numComponents;
+        for(unsigned int y=first; y<destinationHeight; y+=stride)
+        {
+            float* out = destination + y*rowLength;
+            for(unsigned int i=0; i<rowLength; ++i) out[i] = 0.0f;
+
+            const float* w = &vertical.weights[y*vertical.maxTaps];
+            for(unsigned int k=0; k<vertical.numTaps[y]; ++k)
+            {
+                const float* in = intermediate + (vertical.first[y]+k)*rowLength;
+                float weight = w[k];
+                for(unsigned int i=0; i<rowLength; ++i) out[i] += weight*in[i];
+            }
+        }
+    }
+};
+
+class ResampleThread : public OpenThreads::Thread
+{
+    public:
+
+        ResampleThread(const Resample& resample, bool columns, unsigned int first, unsigned int stride):
+            _resample(resample),
+            _columns(columns),
+            _first(first),
+            _stride(stride) {}
+
+        virtual void run()
+        {
+            if (_columns) _resample.resampleColumns(_first, _stride);
+            else _resample.resampleRows(_first, _stride);
+        }
+
+    protected:
+
+        const Resample&     _resample;
+        bool                _columns;
+        unsigned int        _first;
+        unsigned int        _stride;
+};
+
+// interleave the rows of a pass between the threads, this thread takes the first share.
+void runPass(const Resample& resample, bool columns, unsigned int numRows, unsigned int rowLength, unsigned int numThreads)
+{
+    // small levels aren't worth starting threads for.
+    const unsigned int minimumValuesPerThread = 16384;
+    numThreads = osg::minimum(numThreads, osg::maximum(numRows*rowLength/minimumValuesPerThread, 1u));
+    numThreads = osg::minimum(numThreads, numRows);
+
+    typedef std::vector<ResampleThread*> Threads;
+    Threads threads;
+    for(unsigned int t=1; t<numThreads; ++t)
+    {
+        ResampleThread* thread = new ResampleThread(resample, columns, t, numThreads);
+        thread->start();
+        threads.push_back(thread);
+    }
+
+    if (columns) resample.resampleColumns(0, numThreads);
+    else resample.resampleRows(0, numThreads);
+
+    for(Threads::iterator itr = threads.begin();
+        itr != threads.end();
+        ++itr)
+    {
+        (*itr)->join();
+        delete *itr;
+    }
+}
+
+struct PixelLayout
+{
+    GLenum          dataType;
+    unsigned int    numComponents;
+    int             alphaComponent;
+    bool            linearLight;
+
+    bool isColour(unsigned int c) const { return static_cast<int>(c)!=alphaComponent; }
+
+    void readRow(const unsigned char* row, unsigned int width, float* out) const
+    {
+        unsigned int numValues = width*numComponents;
+        switch(dataType)
+        {
+            case(GL_UNSIGNED_BYTE):
+                for(unsigned int i=0; i<numValues; ++i) out[i] = float(row[i])/255.0f;
+                break;
+            case(GL_UNSIGNED_SHORT):
+            {
+                const unsigned short* values = reinterpret_cast<const unsigned short*>(row);
+                for(unsigned int i=0; i<numValues; ++i) out[i] = float(values[i])/65535.0f;
+                break;
+            }
+            case(GL_FLOAT):
+                memcpy(out, row, numValues*sizeof(float));
+                return;
+            case(GL_UNSIGNED_SHORT_5_6_5):
+            {
+                const unsigned short* values = reinterpret_cast<const unsigned short*>(row);
+                for(unsigned int x=0; x<width; ++x, out += 3)
+                {
+                    out[0] = float((values[x]>>11)&0x1f)/31.0f;
+                    out[1] = float((values[x]>>5)&0x3f)/63.0f;
+                    out[2] = float(values[x]&0x1f)/31.0f;
+                }
+                out -= numValues;
+                break;
+            }
+            case(GL_UNSIGNED_SHORT_5_5_5_1):
+            {
+                const unsigned short* values = reinterpret_cast<const unsigned short*>(row);
+                for(unsigned int x=0; x<width; ++x, out += 4)
+                {
+                    out[0] = float((values[x]>>11)&0x1f)/31.0f;
+                    out[1] = float((values[x]>>6)&0x1f)/31.0f;
+                    out[2] = float((values[x]>>1)&0x1f)/31.0f;
+                    out[3] = float(values[x]&0x1);
+                }
+                out -= numValues;
+                break;
+            }
+        }
+
+        if (linearLight)
+        {
+            for(unsigned int i=0; i<numValues; ++i)
+            {
+                if (isColour(i%numComponents)) out[i] = decodeSRGB(out[i]);
+            }
+        }
+    }
+
+    void writeRow(const float* in, unsigned int width, unsigned char* row) const
+    {
+        unsigned int numValues = width*numComponents;
+        if (dataType==GL_FLOAT)
+        {
+            memcpy(row, in, numValues*sizeof(float));
+            return;
+        }
+
+        // clamp away the ringing of the windowed sinc filters and return to sRGB.
+        std::vector<float> values(in, in+numValues);
+        for(unsigned int i=0; i<numValues; ++i)
+        {
+            float v = osg::clampBetween(values[i], 0.0f, 1.0f);
+            values[i] = (linearLight && isColour(i%numComponents)) ? encodeSRGB(v) : v;
+        }
+
+        switch(dataType)
+        {
+            case(GL_UNSIGNED_BYTE):
+                for(unsigned int i=0; i<numValues; ++i) row[i] = static_cast<unsigned char>(values[i]*255.0f+0.5f);
+                break;
+            case(GL_UNSIGNED_SHORT):
+            {
+                unsigned short* out = reinterpret_cast<unsigned short*>(row);
+                for(unsigned int i=0; i<numValues; ++i) out[i] = static_cast<unsigned short>(values[i]*65535.0f+0.5f);
+                break;
+            }
+            case(GL_UNSIGNED_SHORT_5_6_5):
+            {
+                unsigned short* out = reinterpret_cast<unsigned short*>(row);
+                for(unsigned int x=0; x<width; ++x)
+                {
+                    const float* v = &values[x*3];
+                    out[x] = static_cast<unsigned short>((static_cast<unsigned int>(v[0]*31.0f+0.5f)<<11) |
+                                                         (static_cast<unsigned int>(v[1]*63.0f+0.5f)<<5) |
+                                                          static_cast<unsigned int>(v[2]*31.0f+0.5f));
+                }
+                break;
+            }
+            case(GL_UNSIGNED_SHORT_5_5_5_1):
+            {
+                unsigned short* out = reinterpret_cast<unsigned short*>(row);
+                for(unsigned int x=0; x<width; ++x)
+                {
+                    const float* v = &values[x*4];
+                    out[x] = static_cast<unsigned short>((static_cast<unsigned int>(v[0]*31.0f+0.5f)<<11) |
+                                                         (static_cast<unsigned int>(v[1]*31.0f+0.5f)<<6) |
+                                                         (static_cast<unsigned int>(v[2]*31.0f+0.5f)<<1) |
+                                                         (v[3]>=0.5f ? 1u : 0u));
+                }
+                break;
+            }
+        }
+    }
+};
+
+}
+
+bool vpb::generateMipMaps(osg::Image& image, BuildOptions::MipMapFilter filter, bool linearLight, unsigned int numThreads)
+{
+    if (!image.data() || image.r()!=1) return false;
+
+    GLenum pixelFormat = image.getPixelFormat();
+    GLenum dataType = image.getDataType();
+
+    PixelLayout layout;
+    layout.dataType = dataType;
+    layout.numComponents = osg::Image::computeNumComponents(pixelFormat);
+    layout.alphaComponent = -1;
+    layout.linearLight = linearLight && dataType!=GL_FLOAT;
+
+    switch(pixelFormat)
+    {
+        case(GL_LUMINANCE):
+        case(GL_RGB): break;
+        case(GL_ALPHA): layout.alphaComponent = 0; break;
+        case(GL_LUMINANCE_ALPHA): layout.alphaComponent = 1; break;
+        case(GL_RGBA): layout.alphaComponent = 3; break;
+        default: return false;
+    }
+
+    switch(dataType)
+    {
+        case(GL_UNSIGNED_BYTE):
+        case(GL_UNSIGNED_SHORT):
+        case(GL_FLOAT): break;
+        case(GL_UNSIGNED_SHORT_5_6_5): if (pixelFormat!=GL_RGB) return false; break;
+        case(GL_UNSIGNED_SHORT_5_5_5_1): if (pixelFormat!=GL_RGBA) return false; break;
+        default: return false;
+    }
+
+    // there's no linear light for a channel that is only alpha.
+    if (layout.numComponents==1 && layout.alphaComponent==0) layout.linearLight = false;
+
+    unsigned int s = image.s();
+    unsigned int t = image.t();
+    unsigned int pixelSize = osg::Image::computePixelSizeInBits(pixelFormat, dataType)/8;
+
+    unsigned int numLevels = 1;
+    while((s>>(numLevels-1))>1 || (t>>(numLevels-1))>1) ++numLevels;
+
+    // levels are packed tightly one after another, as osg::Image expects its mipmaps.
+    osg::Image::MipmapDataType mipmapOffsets;
+    unsigned int totalSize = s*t*pixelSize;
+    for(unsigned int level=1; level<numLevels; ++level)
+    {
+        mipmapOffsets.push_back(totalSize);
+        totalSize += osg::maximum(s>>level, 1u)*osg::maximum(t>>level, 1u)*pixelSize;
+    }
+
+    unsigned char* data = new unsigned char[totalSize];
+
+    // the base level is copied as is, dropping any row packing, and read once into floats.
+    std::vector<float> current(s*t*layout.numComponents);
+    unsigned int rowSize = image.getRowSizeInBytes();
+    for(unsigned int r=0; r<t; ++r)
+    {
+        const unsigned char* row = image.data() + r*rowSize;
+        memcpy(data + r*s*pixelSize, row, s*pixelSize);
+        layout.readRow(row, s, &current[r*s*layout.numComponents]);
+    }
+
+    numThreads = osg::maximum(numThreads, 1u);
+
+    std::vector<float> intermediate;
+    std::vector<float> next;
+    unsigned int sourceWidth = s;
+    unsigned int sourceHeight = t;
+    for(unsigned int level=1; level<numLevels; ++level)
+    {
+        Resample resample;
+        resample.numComponents = layout.numComponents;
+        resample.sourceWidth = sourceWidth;
+        resample.sourceHeight = sourceHeight;
+        resample.destinationWidth = osg::maximum(s>>level, 1u);
+        resample.destinationHeight = osg::maximum(t>>level, 1u);
+        resample.horizontal.compute(filter, resample.sourceWidth, resample.destinationWidth);
+        resample.vertical.compute(filter, resample.sourceHeight, resample.destinationHeight);
+
+        unsigned int rowLength = resample.destinationWidth*layout.numComponents;
+        intermediate.resize(resample.sourceHeight*rowLength);
+        next.resize(resample.destinationHeight*rowLength);
+
+        resample.source = &current[0];
+        resample.intermediate = &intermediate[0];
+        resample.destination = &next[0];
+
+        runPass(resample, false, resample.sourceHeight, rowLength, numThreads);
+        runPass(resample, true, resample.destinationHeight, rowLength, numThreads);
+
+        unsigned char* levelData = data + mipmapOffsets[level-1];
+        for(unsigned int r=0; r<resample.destinationHeight; ++r)
+        {
+            layout.writeRow(&next[r*rowLength], resample.destinationWidth, levelData + r*resample.destinationWidth*pixelSize);
+        }
+
+        current.swap(next);
+        sourceWidth = resample.destinationWidth;
+        sourceHeight = resample.destinationHeight;
+    }
+
+    image.setImage(s, t, 1,
+                   image.getInternalTextureFormat(), pixelFormat, dataType,
+                   data, osg::Image::USE_NEW_DELETE);
+    image.setMipmapLevels(mipmapOffsets);
+
+    return true;
+}
@@ -0,0 +1,147 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/QuadMap>
+
+#include <osg/Math>
+
+#include <algorithm>
+
+using namespace vpb;
+
+static unsigned long long spreadBits(unsigned int value)
+{
+    unsigned long long v = value;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8))  & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2))  & 0x3333333333333333ULL;
+    v = (v | (v << 1))  & 0x5555555555555555ULL;
+    return v;
+}
+
+static unsigned int compactBits(unsigned long long v)
+{
+    v &= 0x5555555555555555ULL;
+    v = (v | (v >> 1))  & 0x3333333333333333ULL;
+    v = (v | (v >> 2))  & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v >> 4))  & 0x00FF00FF00FF00FFULL;
+    v = (v | (v >> 8))  & 0x0000FFFF0000FFFFULL;
+    v = (v | (v >> 16)) & 0x00000000FFFFFFFFULL;
+    return static_cast<unsigned int>(v);
+}
+
+unsigned long long QuadMap::computeMortonKey(unsigned int X, unsigned int Y)
+{
+    return spreadBits(X) | (spreadBits(Y) << 1);
+}
+
+unsigned int QuadMap::computeSlot(unsigned long long key, unsigned int mask)
+{
+    // Fibonacci hashing spreads the neighbouring keys of a level across the table.
+    return static_cast<unsigned int>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+bool QuadMap::insert(Slots& slots, unsigned long long key, CompositeDestination* cd)
+{
+    unsigned int mask = slots.size()-1;
+    for(unsigned int i = computeSlot(key, mask); ; i = (i+1) & mask)
+    {
+        Slot& slot = slots[i];
+        if (!slot.cd)
+        {
+            slot.key = key;
+            slot.cd = cd;
+            return true;
+        }
+        if (slot.key==key)
+        {
+            slot.cd = cd;
+            return false;
+        }
+    }
+}
+
+void QuadMap::insert(unsigned int level, unsigned int X, unsigned int Y, CompositeDestination* cd)
+{
+    if (!cd) return;
+
+    if (level>=_levels.size()) _levels.resize(level+1);
+
+    Level& quadLevel = _levels[level];
+
+    // keep the table at most half full so probe sequences stay short.
+    if ((quadLevel.size+1)*2 > quadLevel.slots.size())
+    {
+        Slots slots(osg::maximum(static_cast<unsigned int>(quadLevel.slots.size())*2, 64u));
+        for(Slots::iterator itr = quadLevel.slots.begin();
+            itr != quadLevel.slots.end();
+            ++itr)
+        {
+            if (itr->cd) insert(slots, itr->key, itr->cd);
+        }
+        quadLevel.slots.swap(slots);
+    }
+
+    if (insert(quadLevel.slots, computeMortonKey(X,Y), cd)) ++quadLevel.size;
+}
+
+CompositeDestination* QuadMap::find(unsigned int level, unsigned int X, unsigned int Y) const
+{
+    if (level>=_levels.size()) return 0;
+
+    const Slots& slots = _levels[level].slots;
+    if (slots.empty()) return 0;
+
+    unsigned long long key = computeMortonKey(X,Y);
+    unsigned int mask = slots.size()-1;
+    for(unsigned int i = computeSlot(key, mask); ; i = (i+1) & mask)
+    {
+        const Slot& slot = slots[i];
+        if (!slot.cd) return 0;
+        if (slot.key==key) return slot.cd;
+    }
+}
+
+void QuadMap::getComposites(unsigned int level, Composites& composites) const
+{
+    if (level>=_levels.size()) return;
+
+    const Level& quadLevel = _levels[level];
+
+    typedef std::pair<unsigned long long, CompositeDestination*> RowOrderEntry;
+    typedef std::vector<RowOrderEntry> RowOrder;
+    RowOrder rowOrder;
+    rowOrder.reserve(quadLevel.size);
+
+    for(Slots::const_iterator itr = quadLevel.slots.begin();
+        itr != quadLevel.slots.end();
+        ++itr)
+    {
+        if (!itr->cd) continue;
+
+        unsigned long long X = compactBits(itr->key);
+        unsigned long long Y = compactBits(itr->key >> 1);
+        rowOrder.push_back(RowOrderEntry((Y << 32) | X, itr->cd));
+    }
+
+    std::sort(rowOrder.begin(), rowOrder.end());
+
+    composites.reserve(composites.size()+rowOrder.size());
+    for(RowOrder::iterator itr = rowOrder.begin();
+        itr != rowOrder.end();
+        ++itr)
+    {
+        composites.push_back(itr->second);
+    }
+}
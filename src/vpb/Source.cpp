@@ -25,11 +25,15 @@
 #include <osgDB/ReadFile>
 #include <osgDB/FileNameUtils>
 
+#include <OpenThreads/ScopedLock>
+
 #include <cpl_string.h>
 #include <gdal_priv.h>
 #include <gdalwarper.h>
 #include <ogr_spatialref.h>
 
+#include <sstream>
+
 using namespace vpb;
 
 Source::Source(Type type, osg::Node* model):
@@ -45,7 +49,8 @@ Source::Source(Type type, osg::Node* model):
         _maxLevel(MAXIMUM_NUMBER_OF_LEVELS),
         _layer(0),
         _gdalDataset(0),
-        _hfDataset(0)
+        _hfDataset(0),
+        _virtualReprojectionErrorThreshold(0.0)
 {
     _sourceData = new SourceData(this);
     _sourceData->_model = model;
@@ -61,17 +66,26 @@ void Source::setSetName(const std::string& setname, BuildOptions* bo)
     }
 }
 
-GeospatialDataset* Source::getOptimumGeospatialDataset(const SpatialProperties& sp, AccessMode accessMode) const
+osg::ref_ptr<GeospatialDataset> Source::getOptimumGeospatialDataset(const SpatialProperties& sp, AccessMode accessMode) const
 {
     if (_gdalDataset) return new GeospatialDataset(_gdalDataset);
+    else if (getVirtualReprojection()) return getGeospatialDataset(accessMode);
     else return System::instance()->openOptimumGeospatialDataset(_filename, sp, accessMode);
 }
 
 
-GeospatialDataset* Source::getGeospatialDataset(AccessMode accessMode) const
+osg::ref_ptr<GeospatialDataset> Source::getGeospatialDataset(AccessMode accessMode) const
 {
     if (_gdalDataset) return new GeospatialDataset(_gdalDataset);
-    else return System::instance()->openGeospatialDataset(_filename, accessMode);
+
+    // reads go through the warped VRT, writes such as building overviews go to the original file.
+    if (getVirtualReprojection() && accessMode==READ_ONLY && _cs.valid())
+    {
+        return System::instance()->openWarpedGeospatialDataset(_filename, _virtualReprojectionSourceCS->getCoordinateSystem(),
+                                                               _cs->getCoordinateSystem(), _virtualReprojectionErrorThreshold);
+    }
+
+    return System::instance()->openGeospatialDataset(_filename, accessMode);
 }
 
 void Source::setGdalDataset(GDALDataset* gdalDataSet)
@@ -132,7 +146,8 @@ void Source::loadSourceData()
     if (!_sourceData)
     {
     
-        if (System::instance()->getFileCache())
+        // the FileCache only knows the spatial properties of the file as it is on disk, not as warped.
+        if (System::instance()->getFileCache() && !getVirtualReprojection())
         {
             osg::ref_ptr<SourceData> sourceData = new SourceData;
             if (System::instance()->getFileCache()->getSpatialProperties(getFileName(), *sourceData))
@@ -283,7 +298,29 @@ bool Source::needReproject(const osg::CoordinateSystemNode* cs, double minResolu
     return false;
 }
 
-Source* Source::doRasterReprojection(const std::string& filename, osg::CoordinateSystemNode* cs, double targetResolution) const
+std::string Source::computeReprojectionKey() const
+{
+    std::ostringstream key;
+    key.precision(17);
+    key<<_filename;
+
+    if (_sourceData.valid())
+    {
+        key<<"\n"<<(_sourceData->_cs.valid() ? _sourceData->_cs->getCoordinateSystem() : std::string());
+        key<<"\n";
+        for(unsigned int r=0; r<4; ++r)
+        {
+            for(unsigned int c=0; c<4; ++c)
+            {
+                key<<_sourceData->_geoTransform(r,c)<<" ";
+            }
+        }
+    }
+
+    return key.str();
+}
+
+Source* Source::doRasterReprojection(const std::string& filename, osg::CoordinateSystemNode* cs, double targetResolution, const BuildOptions* bo) const
 {
     // return nothing when repoject is inappropriate.
     if (!_sourceData) return 0;
@@ -336,6 +373,7 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
         != CE_None )
     {
         log(osg::INFO," failed to create warp");
+        GDALDestroyGenImgProjTransformer( hTransformArg );
         return 0;
     }
     
@@ -368,9 +406,6 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
         
     }
 
-    
-    GDALDestroyGenImgProjTransformer( hTransformArg );
-
     GDALDataType eDT = GDALGetRasterDataType(dataset->GetRasterBand(1));
     
 
@@ -383,15 +418,24 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
 
     char **papszOptions = NULL;
 
+    std::string compression = bo ? bo->getReprojectionCompression() : std::string("PACKBITS");
+    unsigned int predictor = bo ? bo->getReprojectionPredictor() : 0;
+
     papszOptions = CSLSetNameValue( papszOptions, "TILED", "YES" );
-    papszOptions = CSLSetNameValue( papszOptions, "COMPRESS", "PACKBITS" );
+    if (!compression.empty() && compression!="NONE") papszOptions = CSLSetNameValue( papszOptions, "COMPRESS", compression.c_str() );
+    if (predictor>0) papszOptions = CSLSetNameValue( papszOptions, "PREDICTOR", CPLSPrintf("%u",predictor) );
 
     GDALDatasetH hDstDS = GDALCreate( hDriver, filename.c_str(), nPixels, nLines, 
                          numDestinationBands , eDT,
                          papszOptions );
+
+    CSLDestroy( papszOptions );
     
     if( hDstDS == NULL )
+    {
+        GDALDestroyGenImgProjTransformer( hTransformArg );
         return NULL;
+    }
         
         
 
@@ -402,14 +446,26 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
     GDALSetGeoTransform( hDstDS, adfDstGeoTransform );
 
 
-// Set up the transformer along with the new datasets.
+// Reuse the transformer set up for the output size, pointed at the new dataset's geo transform.
 
-    hTransformArg = 
-         GDALCreateGenImgProjTransformer( dataset->getGDALDataset(),_sourceData->_cs->getCoordinateSystem().c_str(),
-                                          hDstDS, cs->getCoordinateSystem().c_str(),
-                                          TRUE, 0.0, 1 );
+    GDALSetGenImgProjTransformerDstGeoTransform( hTransformArg, adfDstGeoTransform );
 
     GDALTransformerFunc pfnTransformer = GDALGenImgProjTransform;
+    void* hWarpTransformArg = hTransformArg;
+
+    // the approximate transformer only transforms a few points per scanline exactly and interpolates
+    // between them, refining until within the error threshold, which is far cheaper than every pixel.
+    double errorThreshold = bo ? bo->getReprojectionErrorThreshold() : 0.0;
+    void* hApproxTransformArg = 0;
+    if (errorThreshold>0.0)
+    {
+        hApproxTransformArg = GDALCreateApproxTransformer( GDALGenImgProjTransform, hTransformArg, errorThreshold );
+        if (hApproxTransformArg)
+        {
+            pfnTransformer = GDALApproxTransform;
+            hWarpTransformArg = hApproxTransformArg;
+        }
+    }
 
     
     log(osg::INFO,"Setting projection %s",cs->getCoordinateSystem().c_str());
@@ -432,7 +488,10 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
     psWO->hDstDS = hDstDS;
 
     psWO->pfnTransformer = pfnTransformer;
-    psWO->pTransformerArg = hTransformArg;
+    psWO->pTransformerArg = hWarpTransformArg;
+
+    unsigned int warpMemory = bo ? bo->getReprojectionWarpMemory() : 0;
+    if (warpMemory>0) psWO->dfWarpMemoryLimit = double(warpMemory)*1024.0*1024.0;
 
     psWO->pfnProgress = GDALTermProgress;
       
@@ -491,9 +550,10 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
         }
     }
 
-    psWO->papszWarpOptions = (char**)CPLMalloc(2*sizeof(char*));
-    psWO->papszWarpOptions[0] = strdup("INIT_DEST=NO_DATA");
-    psWO->papszWarpOptions[1] = 0;
+    unsigned int numThreads = bo ? bo->getReprojectionNumThreads() : 0;
+
+    psWO->papszWarpOptions = CSLSetNameValue( psWO->papszWarpOptions, "INIT_DEST", "NO_DATA" );
+    if (numThreads>0) psWO->papszWarpOptions = CSLSetNameValue( psWO->papszWarpOptions, "NUM_THREADS", CPLSPrintf("%u",numThreads) );
     
     if (numDestinationBands==4)
     {
@@ -512,9 +572,10 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
 
     if( oWO.Initialize( psWO ) == CE_None )
     {
-        bool multithreaded = false;
-        
-        if (multithreaded)
+        log(osg::NOTICE,"warping %d x %d pixels with %u threads",GDALGetRasterXSize( hDstDS ),GDALGetRasterYSize( hDstDS ),numThreads);
+
+        // ChunkAndWarpMulti overlaps reading the next chunk with warping the current one.
+        if (numThreads>0)
         {
             oWO.ChunkAndWarpMulti( 0, 0, 
                                    GDALGetRasterXSize( hDstDS ),
@@ -533,13 +594,19 @@ Source* Source::doRasterReprojection(const std::string& filename, osg::Coordinat
 /* -------------------------------------------------------------------- */
 /*      Cleanup.                                                        */
 /* -------------------------------------------------------------------- */
+    psWO->pTransformerArg = 0;
+    GDALDestroyWarpOptions( psWO );
+
+    if (hApproxTransformArg) GDALDestroyApproxTransformer( hApproxTransformArg );
     GDALDestroyGenImgProjTransformer( hTransformArg );
-    
-#if 0
-    int anOverviewList[4] = { 2, 4, 8, 16 };
-    GDALBuildOverviews( hDstDS, "AVERAGE", 4, anOverviewList, 0, NULL, 
+
+    // build the overviews while the new file is still open, so the freshly warped blocks are still in GDAL's cache.
+    if (bo && bo->getBuildOverlays())
+    {
+        int anOverviewList[5] = { 2, 4, 8, 16, 32 };
+        GDALBuildOverviews( hDstDS, "AVERAGE", 4, anOverviewList, 0, NULL, 
                             GDALTermProgress/*GDALDummyProgress*/, NULL );
-#endif
+    }
 
     GDALClose( hDstDS );
     
@@ -582,29 +649,83 @@ Source* Source::doRasterReprojectionUsingFileCache(osg::CoordinateSystemNode* cs
     std::string optimumFile = fileCache->getOptimimumFile(getFileName(), cs);
     if (!optimumFile.empty())
     {
-        Source* newSource = new Source;
+        return createReprojectedSource(optimumFile, cs, false);
+    }
+    return 0;
+}
 
-        newSource->_type = _type;
-        newSource->_filename = optimumFile;
-        newSource->_temporaryFile = false;
-        newSource->_cs = cs;
+Source* Source::doVirtualRasterReprojection(osg::CoordinateSystemNode* cs, const BuildOptions* bo) const
+{
+    // return nothing when repoject is inappropriate.
+    if (!_sourceData || !_cs || !cs) return 0;
 
-        newSource->_coordinateSystemPolicy = _coordinateSystemPolicy;
-        newSource->_geoTransformPolicy = _geoTransformPolicy;
+    if (!isRaster())
+    {
+        log(osg::NOTICE,"Source::doVirtualRasterReprojection() reprojection of a model/shapefile not appropriate.");
+        return 0;
+    }
 
-        newSource->_minLevel = _minLevel;
-        newSource->_maxLevel = _maxLevel;
-        newSource->_layer = _layer;
+    double errorThreshold = bo ? bo->getReprojectionErrorThreshold() : 0.0;
 
-        newSource->_requiredResolutions = _requiredResolutions;
+    // check the warped VRT can be created before committing to it.
+    osg::ref_ptr<GeospatialDataset> dataset = System::instance()->openWarpedGeospatialDataset(_filename, _cs->getCoordinateSystem(),
+                                                                                              cs->getCoordinateSystem(), errorThreshold);
+    if (!dataset || !dataset->getGDALDataset())
+    {
+        log(osg::NOTICE,"Source::doVirtualRasterReprojection() unable to create warped dataset for %s",_filename.c_str());
+        return 0;
+    }
+    dataset = 0;
 
-        // reaload the new file
-        newSource->loadSourceData();
+    log(osg::NOTICE,"reprojecting %s on the fly",_filename.c_str());
 
-        return newSource;
+    Source* newSource = new Source;
 
-    }
-    return 0;
+    newSource->_type = _type;
+    newSource->_filename = _filename;
+    newSource->_temporaryFile = false;
+    newSource->_cs = cs;
+
+    // the warped VRT is in cs by construction, so keep cs rather than the WKT GDAL reports back for it.
+    newSource->_coordinateSystemPolicy = PREFER_CONFIG_SETTINGS;
+    newSource->_geoTransformPolicy = PREFER_FILE_SETTINGS;
+
+    newSource->_minLevel = _minLevel;
+    newSource->_maxLevel = _maxLevel;
+    newSource->_layer = _layer;
+
+    newSource->_requiredResolutions = _requiredResolutions;
+
+    newSource->_virtualReprojectionSourceCS = _cs;
+    newSource->_virtualReprojectionErrorThreshold = errorThreshold;
+
+    newSource->loadSourceData();
+
+    return newSource;
+}
+
+Source* Source::createReprojectedSource(const std::string& filename, osg::CoordinateSystemNode* cs, bool temporaryFile) const
+{
+    Source* newSource = new Source;
+
+    newSource->_type = _type;
+    newSource->_filename = filename;
+    newSource->_temporaryFile = temporaryFile;
+    newSource->_cs = cs;
+
+    newSource->_coordinateSystemPolicy = _coordinateSystemPolicy;
+    newSource->_geoTransformPolicy = _geoTransformPolicy;
+
+    newSource->_minLevel = _minLevel;
+    newSource->_maxLevel = _maxLevel;
+    newSource->_layer = _layer;
+
+    newSource->_requiredResolutions = _requiredResolutions;
+
+    // reaload the new file
+    newSource->loadSourceData();
+
+    return newSource;
 }
 
 
@@ -881,6 +1002,9 @@ void CompositeSource::setSortValueFromSourceDataResolution(const osg::Coordinate
 
 void CompositeSource::sortBySourceSortValue()
 {
+    // reordering the sources changes the order the indices return them in.
+    dirtySourceIndices();
+
     // sort the sources.
     std::sort(_sourceList.begin(),_sourceList.end(),DerefLessFunctor< osg::ref_ptr<Source> >());
 
@@ -917,6 +1041,9 @@ struct DerefLessSourceDetailsFunctor
 
 void CompositeSource::sortBySourceDetails()
 {
+    // reordering the sources changes the order the indices return them in.
+    dirtySourceIndices();
+
     // sort the sources.
     std::sort(_sourceList.begin(),_sourceList.end(),DerefLessSourceDetailsFunctor< osg::ref_ptr<Source> >());
 
@@ -1012,3 +1139,38 @@ unsigned int CompositeSource::getNumberAlteredSources()
     return number;
 }
 
+
+SourceIndex* CompositeSource::getSourceIndex(const osg::CoordinateSystemNode* cs)
+{
+    std::string key = cs ? cs->getCoordinateSystem() : std::string();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_sourceIndexMutex);
+
+    osg::ref_ptr<SourceIndex>& sourceIndex = _sourceIndexMap[key];
+    if (!sourceIndex)
+    {
+        sourceIndex = new SourceIndex(this, cs);
+        log(osg::INFO,"CompositeSource::getSourceIndex() indexed %u sources",sourceIndex->getNumSources());
+    }
+
+    return sourceIndex.get();
+}
+
+void CompositeSource::getIntersectingSources(const osg::CoordinateSystemNode* cs, const GeospatialExtents& extents, SourceIndex::Sources& sources)
+{
+    osg::ref_ptr<SourceIndex> sourceIndex = getSourceIndex(cs);
+    sourceIndex->getIntersectingSources(extents, sources);
+}
+
+void CompositeSource::dirtySourceIndices()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_sourceIndexMutex);
+        _sourceIndexMap.clear();
+    }
+
+    for(ChildList::iterator itr=_children.begin();itr!=_children.end();++itr)
+    {
+        if (itr->valid()) (*itr)->dirtySourceIndices();
+    }
+}
@@ -0,0 +1,265 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/SourceBlockCache>
+#include <vpb/BuildLog>
+
+#include <OpenThreads/ScopedLock>
+
+#include <string.h>
+
+using namespace vpb;
+
+SourceBlockCache::SourceBlockCache():
+    _maxNumBytes(0),
+    _numBytes(0)
+{
+}
+
+SourceBlockCache::~SourceBlockCache()
+{
+}
+
+void SourceBlockCache::setMaximumNumBytes(unsigned long long maxNumBytes)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _maxNumBytes = maxNumBytes;
+
+    // trim the cache down to the new budget
+    while(_numBytes>_maxNumBytes && !_keyList.empty())
+    {
+        BlockMap::iterator itr = _blockMap.find(_keyList.back());
+        _numBytes -= itr->second.first->data.size();
+        _blockMap.erase(itr);
+        _keyList.pop_back();
+        ++_statistics.numEvictions;
+    }
+}
+
+void SourceBlockCache::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _blockMap.clear();
+    _keyList.clear();
+    _numBytes = 0;
+}
+
+bool SourceBlockCache::readWindow(GDALDataset* dataset, int overview, int numBands, const int* bandMap, GDALDataType dataType,
+                                  int x, int y, int width, int height,
+                                  unsigned char* buffer, int bufferWidth, int bufferHeight, int pixelSpace, int lineSpace)
+{
+    int sampleSize = GDALGetDataTypeSize(dataType)/8;
+
+    if (overview<0)
+    {
+        return dataset->RasterIO(GF_Read, x, y, width, height, buffer, bufferWidth, bufferHeight,
+                                 dataType, numBands, const_cast<int*>(bandMap), pixelSpace, lineSpace, sampleSize)==CE_None;
+    }
+
+    // read the bands in one interleaved pass through the overview level's own dataset when every band's overview
+    // is the matching band of the same dataset.
+    std::vector<GDALRasterBand*> overviewBands(numBands);
+    std::vector<int> overviewBandMap(numBands);
+    GDALDataset* overviewDataset = 0;
+    bool sharedDataset = true;
+    for(int b=0; b<numBands; ++b)
+    {
+        GDALRasterBand* band = dataset->GetRasterBand(bandMap[b]);
+        GDALRasterBand* overviewBand = band ? band->GetOverview(overview) : 0;
+        if (!overviewBand) return false;
+
+        overviewBands[b] = overviewBand;
+        overviewBandMap[b] = overviewBand->GetBand();
+
+        GDALDataset* bandDataset = overviewBand->GetDataset();
+        if (b==0) overviewDataset = bandDataset;
+
+        if (!bandDataset || bandDataset==dataset || bandDataset!=overviewDataset ||
+            overviewBandMap[b]<1 || overviewBandMap[b]>bandDataset->GetRasterCount() ||
+            bandDataset->GetRasterBand(overviewBandMap[b])!=overviewBand) sharedDataset = false;
+    }
+
+    if (sharedDataset)
+    {
+        return overviewDataset->RasterIO(GF_Read, x, y, width, height, buffer, bufferWidth, bufferHeight,
+                                         dataType, numBands, &overviewBandMap.front(), pixelSpace, lineSpace, sampleSize)==CE_None;
+    }
+
+    // otherwise the overview bands have to be read one at a time.
+    for(int b=0; b<numBands; ++b)
+    {
+        if (overviewBands[b]->RasterIO(GF_Read, x, y, width, height, buffer+b*sampleSize, bufferWidth, bufferHeight,
+                                       dataType, pixelSpace, lineSpace)!=CE_None) return false;
+    }
+
+    return true;
+}
+
+SourceBlockCache::Block* SourceBlockCache::decodeBlock(GDALDataset* dataset, const BlockKey& key, int blockWidth, int blockHeight, int rasterXSize, int rasterYSize)
+{
+    int numBands = key.bands.size();
+    int sampleSize = GDALGetDataTypeSize((GDALDataType)key.dataType)/8;
+
+    osg::ref_ptr<Block> block = new Block;
+    block->x = key.blockX*blockWidth;
+    block->y = key.blockY*blockHeight;
+    block->width = osg::minimum(blockWidth, rasterXSize-block->x);
+    block->height = osg::minimum(blockHeight, rasterYSize-block->y);
+    block->pixelSize = numBands*sampleSize;
+    block->data.resize(block->width*block->height*block->pixelSize);
+
+    int lineSpace = block->width*block->pixelSize;
+
+    if (!readWindow(dataset, key.overview, numBands, &(key.bands.front()), (GDALDataType)key.dataType,
+                    block->x, block->y, block->width, block->height,
+                    &(block->data.front()), block->width, block->height, block->pixelSize, lineSpace)) return 0;
+
+    return block.release();
+}
+
+void SourceBlockCache::insert(const BlockKey& key, Block* block)
+{
+    // blocks bigger than the whole budget aren't worth holding on to.
+    if (block->data.size()>_maxNumBytes) return;
+
+    _keyList.push_front(key);
+    _blockMap[key] = BlockEntry(block, _keyList.begin());
+    _numBytes += block->data.size();
+
+    while(_numBytes>_maxNumBytes && !_keyList.empty())
+    {
+        BlockMap::iterator itr = _blockMap.find(_keyList.back());
+        _numBytes -= itr->second.first->data.size();
+        _blockMap.erase(itr);
+        _keyList.pop_back();
+        ++_statistics.numEvictions;
+    }
+}
+
+bool SourceBlockCache::read(const std::string& datasetKey, GDALDataset* dataset, int overview, int numBands, const int* bandMap, GDALDataType dataType,
+                            int x, int y, int width, int height,
+                            unsigned char* buffer, int pixelSpace, int lineSpace,
+                            unsigned long long* numBytesDecoded)
+{
+    if (datasetKey.empty() || !dataset || numBands<=0 || width<=0 || height<=0) return false;
+
+    GDALRasterBand* firstBand = dataset->GetRasterBand(bandMap[0]);
+    if (firstBand && overview>=0) firstBand = firstBand->GetOverview(overview);
+    if (!firstBand) return false;
+
+    int rasterXSize = firstBand->GetXSize();
+    int rasterYSize = firstBand->GetYSize();
+    if (x<0 || y<0 || x+width>rasterXSize || y+height>rasterYSize) return false;
+
+    // use the natural block size of the source where it's sensible, otherwise a regular grid.
+    int blockWidth = 0, blockHeight = 0;
+    firstBand->GetBlockSize(&blockWidth, &blockHeight);
+    if (blockWidth<64 || blockWidth>1024 || blockHeight<64 || blockHeight>1024)
+    {
+        blockWidth = 256;
+        blockHeight = 256;
+    }
+
+    BlockKey key;
+    key.datasetKey = datasetKey;
+    key.overview = overview;
+    key.bands.assign(bandMap, bandMap+numBands);
+    key.dataType = dataType;
+
+    int pixelSize = numBands*(GDALGetDataTypeSize(dataType)/8);
+
+    for(int by = y/blockHeight; by <= (y+height-1)/blockHeight; ++by)
+    {
+        for(int bx = x/blockWidth; bx <= (x+width-1)/blockWidth; ++bx)
+        {
+            key.blockX = bx;
+            key.blockY = by;
+
+            osg::ref_ptr<Block> block;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                BlockMap::iterator itr = _blockMap.find(key);
+                if (itr != _blockMap.end())
+                {
+                    block = itr->second.first;
+                    _keyList.splice(_keyList.begin(), _keyList, itr->second.second);
+                    ++_statistics.numHits;
+                }
+                else
+                {
+                    ++_statistics.numMisses;
+                }
+            }
+
+            if (!block)
+            {
+                // decode outside of the cache lock, the caller has exclusive use of the dataset.
+                block = decodeBlock(dataset, key, blockWidth, blockHeight, rasterXSize, rasterYSize);
+                if (!block) return false;
+
+                if (numBytesDecoded) *numBytesDecoded += block->data.size();
+
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                _statistics.numBytesDecoded += block->data.size();
+                if (_blockMap.count(key)==0) insert(key, block.get());
+            }
+
+            // copy the intersection of the block and the window into the buffer.
+            int startX = osg::maximum(x, block->x);
+            int endX = osg::minimum(x+width, block->x+block->width);
+            int startY = osg::maximum(y, block->y);
+            int endY = osg::minimum(y+height, block->y+block->height);
+
+            for(int r=startY; r<endY; ++r)
+            {
+                const unsigned char* src = &(block->data[((r-block->y)*block->width + (startX-block->x))*pixelSize]);
+                unsigned char* dst = buffer + (r-y)*lineSpace + (startX-x)*pixelSpace;
+                if (pixelSpace==pixelSize)
+                {
+                    memcpy(dst, src, (endX-startX)*pixelSize);
+                }
+                else
+                {
+                    for(int c=startX; c<endX; ++c, src+=pixelSize, dst+=pixelSpace)
+                    {
+                        memcpy(dst, src, pixelSize);
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+SourceBlockCache::Statistics SourceBlockCache::getStatistics() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    Statistics statistics = _statistics;
+    statistics.numBytes = _numBytes;
+    return statistics;
+}
+
+void SourceBlockCache::reportStatistics() const
+{
+    if (!isEnabled()) return;
+
+    Statistics statistics = getStatistics();
+    unsigned long long numRequests = statistics.numHits + statistics.numMisses;
+    double hitRatio = numRequests>0 ? double(statistics.numHits)/double(numRequests) : 0.0;
+
+    log(osg::NOTICE,"Source block cache: hits=%llu misses=%llu (hit ratio %.1f%%) evictions=%llu decoded=%lluMB held=%lluMB",
+        statistics.numHits, statistics.numMisses, hitRatio*100.0, statistics.numEvictions,
+        statistics.numBytesDecoded/(1024*1024), statistics.numBytes/(1024*1024));
+}
@@ -15,6 +15,7 @@
 #include <vpb/Destination>
 #include <vpb/DataSet>
 #include <vpb/System>
+#include <vpb/ImageUtils>
 
 #include <osg/Notify>
 #include <osg/io_utils>
@@ -24,6 +25,9 @@
 #include <gdal_priv.h>
 #include <gdalwarper.h>
 
+#include <vector>
+#include <string.h>
+
 using namespace vpb;
 
 
@@ -65,6 +69,158 @@ struct ValidValueOperator
     float maxValue;
 };
 
+// Nearest neighbour sample a width x height window of pixelSize byte pixels, held 1:1 in window, into readWidth x readHeight
+// pixels pixelSpace and lineSpace bytes apart, picking the same source pixels as GDAL's own RasterIO decimation does.
+static void sampleWindowNearest(const unsigned char* window, int width, int height, int pixelSize,
+                                unsigned char* buffer, int readWidth, int readHeight, int pixelSpace, int lineSpace)
+{
+    double stepX = double(width)/double(readWidth);
+    double stepY = double(height)/double(readHeight);
+
+    std::vector<int> columnOffsets(readWidth);
+    for(int i=0; i<readWidth; ++i)
+    {
+        columnOffsets[i] = osg::minimum((int)floor((double(i)+0.5)*stepX), width-1)*pixelSize;
+    }
+
+    for(int j=0; j<readHeight; ++j)
+    {
+        const unsigned char* sourceRow = window + osg::minimum((int)floor((double(j)+0.5)*stepY), height-1)*width*pixelSize;
+        unsigned char* destPixel = buffer + j*lineSpace;
+        for(int i=0; i<readWidth; ++i, destPixel += pixelSpace)
+        {
+            memcpy(destPixel, sourceRow + columnOffsets[i], pixelSize);
+        }
+    }
+}
+
+// Read a width x height window of the numBands bands in bandMap, at the specified overview level (-1 for full resolution),
+// into readWidth x readHeight interleaved pixels, pixelSpace and lineSpace bytes apart. When the shared block cache is enabled
+// the window is read through it, and reads that decimate or replicate it are then nearest neighbour sampled as GDAL would,
+// unless GDAL could decimate from an overview or the whole window would crowd out the cache. Otherwise GDAL reads and
+// resamples the window itself. The caller must hold the dataset's mutex.
+static bool readSourceWindow(GeospatialDataset* geospatialDataset, int overview, int numBands, int* bandMap, GDALDataType dataType,
+                             int x, int y, int width, int height,
+                             unsigned char* buffer, int readWidth, int readHeight, int pixelSpace, int lineSpace,
+                             unsigned long long& numBytesDecoded)
+{
+    GDALDataset* dataset = geospatialDataset->getGDALDataset();
+
+    SourceBlockCache* blockCache = System::instance()->getSourceBlockCache();
+    if (blockCache->isEnabled())
+    {
+        if (readWidth==width && readHeight==height)
+        {
+            if (blockCache->read(geospatialDataset->getBlockCacheKey(), dataset, overview, numBands, bandMap, dataType, x, y, width, height,
+                                 buffer, pixelSpace, lineSpace, &numBytesDecoded))
+            {
+                return true;
+            }
+        }
+        else
+        {
+            // GDAL decimates from the full resolution source's own overviews, which is cheaper than reading the window 1:1.
+            bool hasOverviews = overview<0 && dataset->GetRasterBand(bandMap[0])->GetOverviewCount()>0;
+            int pixelSize = numBands*(GDALGetDataTypeSize(dataType)/8);
+            if (!hasOverviews && (unsigned long long)width*height*pixelSize <= blockCache->getMaximumNumBytes()/4)
+            {
+                PooledBuffer<unsigned char> windowBuffer(System::instance()->getBufferPool(), width*height*pixelSize);
+                if (blockCache->read(geospatialDataset->getBlockCacheKey(), dataset, overview, numBands, bandMap, dataType, x, y, width, height,
+                                     windowBuffer.get(), pixelSize, width*pixelSize, &numBytesDecoded))
+                {
+                    sampleWindowNearest(windowBuffer.get(), width, height, pixelSize, buffer, readWidth, readHeight, pixelSpace, lineSpace);
+                    return true;
+                }
+            }
+        }
+    }
+
+    int sampleSize = GDALGetDataTypeSize(dataType)/8;
+    numBytesDecoded += (unsigned long long)width*height*numBands*sampleSize;
+
+    return SourceBlockCache::readWindow(dataset, overview, numBands, bandMap, dataType, x, y, width, height,
+                                        buffer, readWidth, readHeight, pixelSpace, lineSpace);
+}
+
+// Block of source values read with a single RasterIO call, used to bilinearly
+// sample a source band from memory rather than issuing 1x1 reads per vertex.
+struct InterpolatedValueBlock
+{
+    InterpolatedValueBlock(int numValuesX, int numValuesY):
+        _numValuesX(numValuesX),
+        _numValuesY(numValuesY),
+        _colStart(0),
+        _rowStart(0),
+        _numCols(0),
+        _numRows(0) {}
+
+    // read the window of dataset's band covering the pixel/line range [colMin,colMax] x [rowMin,rowMax], plus a one pixel apron.
+    bool read(GeospatialDataset* dataset, GDALRasterBand* band, double colMin, double rowMin, double colMax, double rowMax, unsigned int maxNumValues,
+              unsigned long long& numBytesDecoded)
+    {
+        _colStart = clampCol((int)floor(colMin)-1);
+        _rowStart = clampRow((int)floor(rowMin)-1);
+        _numCols = clampCol((int)ceil(colMax)+1) - _colStart + 1;
+        _numRows = clampRow((int)ceil(rowMax)+1) - _rowStart + 1;
+
+        if ((unsigned long long)_numCols * (unsigned long long)_numRows > (unsigned long long)maxNumValues) return false;
+
+        _values.resize(_numCols*_numRows);
+
+        // pull the window through the shared block cache so neighbouring tiles reuse the decoded blocks.
+        int bandIndex = band->GetBand();
+        return readSourceWindow(dataset, -1, 1, &bandIndex, GDT_Float32,
+                                _colStart, _rowStart, _numCols, _numRows,
+                                (unsigned char*)&_values.front(), _numCols, _numRows, sizeof(float), _numCols*sizeof(float),
+                                numBytesDecoded);
+    }
+
+    inline int clampCol(int c) const { return osg::maximum(osg::minimum(c, _numValuesX-1), 0); }
+    inline int clampRow(int r) const { return osg::maximum(osg::minimum(r, _numValuesY-1), 0); }
+
+    inline float getValue(int c, int r) const { return _values[(r-_rowStart)*_numCols + (c-_colStart)]; }
+
+    // same clamping, no data and weighting rules as SourceData::getInterpolatedValue(GDALRasterBand*,..)
+    float getInterpolatedValue(double c, double r, float originalHeight, ValidValueOperator& validValueOperator) const
+    {
+        int rowMin = osg::maximum((int)floor(r), 0);
+        int rowMax = clampRow((int)ceil(r));
+        int colMin = osg::maximum((int)floor(c), 0);
+        int colMax = clampCol((int)ceil(c));
+
+        if (rowMin > rowMax) rowMin = rowMax;
+        if (colMin > colMax) colMin = colMax;
+
+        float llHeight = getValue(colMin, rowMin);
+        float ulHeight = getValue(colMin, rowMax);
+        float lrHeight = getValue(colMax, rowMin);
+        float urHeight = getValue(colMax, rowMax);
+
+        if (validValueOperator.isNoDataValue(llHeight)) llHeight = originalHeight;
+        if (validValueOperator.isNoDataValue(ulHeight)) ulHeight = originalHeight;
+        if (validValueOperator.isNoDataValue(lrHeight)) lrHeight = originalHeight;
+        if (validValueOperator.isNoDataValue(urHeight)) urHeight = originalHeight;
+
+        double x_rem = c - (int)c;
+        double y_rem = r - (int)r;
+
+        double w00 = (1.0 - y_rem) * (1.0 - x_rem) * (double)llHeight;
+        double w01 = (1.0 - y_rem) * x_rem * (double)lrHeight;
+        double w10 = y_rem * (1.0 - x_rem) * (double)ulHeight;
+        double w11 = y_rem * x_rem * (double)urHeight;
+
+        return (float)(w00 + w01 + w10 + w11);
+    }
+
+    int                 _numValuesX;
+    int                 _numValuesY;
+    int                 _colStart;
+    int                 _rowStart;
+    int                 _numCols;
+    int                 _numRows;
+    std::vector<float>  _values;
+};
+
 
 SourceData::~SourceData()
 {
@@ -102,8 +258,11 @@ float SourceData::getInterpolatedValue(osg::HeightField* hf, double x, double y)
     return result;
 }
 
-float SourceData::getInterpolatedValue(GDALRasterBand *band, double x, double y, float originalHeight)
+// compute the GDAL style inverse geotransform, mapping from source coords to pixel/line
+static void computeInverseGeoTransform(const SourceData& sourceData, double* invTransform)
 {
+    const osg::Matrixd& _geoTransform = sourceData._geoTransform;
+
     double geoTransform[6];
     geoTransform[0] = _geoTransform(3,0);
     geoTransform[1] = _geoTransform(0,0);
@@ -114,15 +273,21 @@ float SourceData::getInterpolatedValue(GDALRasterBand *band, double x, double y,
 
     // shift the transform to the middle of the cell if a raster format is used
 #ifdef SHIFT_RASTER_BY_HALF_CELL
-    if (_dataType == RASTER)
+    if (sourceData._dataType == SpatialProperties::RASTER)
     {
         geoTransform[0] += 0.5 * geoTransform[1];
         geoTransform[3] += 0.5 * geoTransform[5];
     }
 #endif
 
-    double invTransform[6];
     GDALInvGeoTransform(geoTransform, invTransform);
+}
+
+float SourceData::getInterpolatedValue(GDALRasterBand *band, double x, double y, float originalHeight)
+{
+    double invTransform[6];
+    computeInverseGeoTransform(*this, invTransform);
+
     double r, c;
     GDALApplyGeoTransform(invTransform, x, y, &c, &r);
    
@@ -161,6 +326,35 @@ float SourceData::getInterpolatedValue(GDALRasterBand *band, double x, double y,
     return result;
 }
 
+const unsigned char* SourceData::getColorTableLUT(GDALColorTable* ct)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_colorTableLUTMutex);
+
+    if (_colorTableLUT.empty())
+    {
+        _colorTableLUT.resize(256*4);
+        for(int i = 0; i < 256; ++i)
+        {
+            GDALColorEntry sEntry;
+
+            // default to greyscale equilvelent.
+            sEntry.c1 = i;
+            sEntry.c2 = i;
+            sEntry.c3 = i;
+            sEntry.c4 = 255;
+
+            if (ct) ct->GetColorEntryAsRGB( i, &sEntry );
+
+            _colorTableLUT[i*4 + 0] = sEntry.c1;
+            _colorTableLUT[i*4 + 1] = sEntry.c2;
+            _colorTableLUT[i*4 + 2] = sEntry.c3;
+            _colorTableLUT[i*4 + 3] = sEntry.c4;
+        }
+    }
+
+    return &_colorTableLUT.front();
+}
+
 SourceData* SourceData::readData(Source* source)
 {
     if (!source) return 0;
@@ -453,6 +647,8 @@ void SourceData::readImage(DestinationData& destination)
         osg::ref_ptr<GeospatialDataset> _gdalDataset = _source->getOptimumGeospatialDataset(destination, READ_ONLY);
         if (!_gdalDataset) return;
         
+        // System hands out a separate read only handle per concurrent reader where possible,
+        // so this lock only serializes access when the per file handle limit has been reached.
         OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_gdalDataset->getMutex());
 
         GeospatialExtents s_bb = getExtents(destination._cs.get());
@@ -530,46 +726,100 @@ void SourceData::readImage(DestinationData& destination)
 
                 int pixelSpace=numSourceComponents*numBytesPerPixel;
 
+                int bandMap[4] = { 1, 2, 3, 4 };
+                int numBandsToRead = hasRGB ? numSourceComponents : 1;
+
+                // the window to read, in pixels of the full resolution source or of the chosen overview.
+                int overview = -1;
+                int sourceX = windowX;
+                int sourceY = _numValuesY-(windowY+windowHeight);
+                int sourceWidth = windowWidth;
+                int sourceHeight = windowHeight;
+
+                // where the centre of the first destination pixel falls in the overview window read, and the spacing
+                // of the destination pixels, in overview pixels.
+                double overviewOriginX = 0.0, overviewOriginY = 0.0;
+                double overviewStepX = 1.0, overviewStepY = 1.0;
+
+                // when reducing, pick the coarsest overview that still has at least the destination's resolution and read it 1:1,
+                // rather than leaving GDAL to choose and decimate, so the read is aligned to that overview's blocks.
+                if (!doResample)
+                {
+                    GDALRasterBand* firstBand = _gdalDataset->GetRasterBand(1);
+                    for(int i=0; i<firstBand->GetOverviewCount(); ++i)
+                    {
+                        GDALRasterBand* overviewBand = firstBand->GetOverview(i);
+                        if (!overviewBand) continue;
+
+                        bool allBandsHaveOverview = true;
+                        for(int b=1; b<numBandsToRead; ++b)
+                        {
+                            GDALRasterBand* bandOverview = _gdalDataset->GetRasterBand(bandMap[b])->GetOverview(i);
+                            if (!bandOverview ||
+                                bandOverview->GetXSize()!=overviewBand->GetXSize() ||
+                                bandOverview->GetYSize()!=overviewBand->GetYSize()) allBandsHaveOverview = false;
+                        }
+                        if (!allBandsHaveOverview) continue;
+
+                        // the exact window in overview pixels, the pixels read cover it and the remainder is resampled away.
+                        double scaleX = double(overviewBand->GetXSize())/double(_numValuesX);
+                        double scaleY = double(overviewBand->GetYSize())/double(_numValuesY);
+                        double fx0 = double(windowX)*scaleX;
+                        double fy0 = double(_numValuesY-(windowY+windowHeight))*scaleY;
+                        double fx1 = double(windowX+windowWidth)*scaleX;
+                        double fy1 = double(_numValuesY-windowY)*scaleY;
+                        int x0 = (int)floor(fx0);
+                        int y0 = (int)floor(fy0);
+                        int x1 = osg::minimum((int)ceil(fx1), overviewBand->GetXSize());
+                        int y1 = osg::minimum((int)ceil(fy1), overviewBand->GetYSize());
+
+                        if ((fx1-fx0)>=double(destWidth) && (fy1-fy0)>=double(destHeight) &&
+                            (x1-x0)*(y1-y0) < sourceWidth*sourceHeight)
+                        {
+                            overview = i;
+                            sourceX = x0;
+                            sourceY = y0;
+                            sourceWidth = x1-x0;
+                            sourceHeight = y1-y0;
+
+                            // sample at the destination pixel centres, as GDAL does when it decimates the full resolution window.
+                            overviewStepX = (fx1-fx0)/double(destWidth);
+                            overviewStepY = (fy1-fy0)/double(destHeight);
+                            overviewOriginX = (fx0-double(x0)) + 0.5*overviewStepX - 0.5;
+                            overviewOriginY = (fy0-double(y0)) + 0.5*overviewStepY - 0.5;
+                        }
+                    }
+
+                    if (overview>=0)
+                    {
+                        log(osg::INFO,"   reading overview %d from %d\t%d\t%d\t%d",overview,sourceX,sourceY,sourceWidth,sourceHeight);
+                        readWidth = sourceWidth;
+                        readHeight = sourceHeight;
+                    }
+                }
+
                 log(osg::INFO,"reading RGB");
 
-                unsigned char* tempImage = new unsigned char[readWidth*readHeight*pixelSpace];
+                BufferPool* bufferPool = System::instance()->getBufferPool();
+                PooledBuffer<unsigned char> tempBuffer(bufferPool, readWidth*readHeight*pixelSpace);
+                unsigned char* tempImage = tempBuffer.get();
 
 
                 /* New code courtesy of Frank Warmerdam of the GDAL group */
 
+                // the pooled buffer holds whatever was last read into it, so a failed read mustn't be composited.
+                bool readSucceeded = false;
+
                 // RGB images ... or at least we assume 3+ band images can be treated
                 // as RGB.
                 if( hasRGB )
                 {
-                    GDALRasterBand* bandRed = _gdalDataset->GetRasterBand(1);
-                    GDALRasterBand* bandGreen = _gdalDataset->GetRasterBand(2);
-                    GDALRasterBand* bandBlue = _gdalDataset->GetRasterBand(3);
-                    GDALRasterBand* bandAlpha = hasAlpha ? _gdalDataset->GetRasterBand(4) : 0;
-
-                    bandRed->RasterIO(GF_Read, 
-                                      windowX,_numValuesY-(windowY+windowHeight), 
-                                      windowWidth,windowHeight, 
-                                      (void*)(tempImage+0),readWidth,readHeight, 
-                                      targetGDALType,pixelSpace,pixelSpace*readWidth);
-                    bandGreen->RasterIO(GF_Read, 
-                                        windowX,_numValuesY-(windowY+windowHeight), 
-                                        windowWidth,windowHeight, 
-                                        (void*)(tempImage+1),readWidth,readHeight, 
-                                        targetGDALType,pixelSpace,pixelSpace*readWidth);
-                    bandBlue->RasterIO(GF_Read, 
-                                       windowX,_numValuesY-(windowY+windowHeight), 
-                                       windowWidth,windowHeight, 
-                                       (void*)(tempImage+2),readWidth,readHeight, 
-                                       targetGDALType,pixelSpace,pixelSpace*readWidth);
-
-                    if (bandAlpha)
-                    {
-                        bandAlpha->RasterIO(GF_Read, 
-                                           windowX,_numValuesY-(windowY+windowHeight), 
-                                           windowWidth,windowHeight, 
-                                           (void*)(tempImage+3),readWidth,readHeight, 
-                                           targetGDALType,pixelSpace,pixelSpace*readWidth);
-                    }
+                    // read all the bands in a single interleaved pass rather than once per band,
+                    // so compressed sources only need to be decoded once.
+                    readSucceeded = readSourceWindow(_gdalDataset.get(), overview, numSourceComponents, bandMap, targetGDALType,
+                                                     sourceX, sourceY, sourceWidth, sourceHeight,
+                                                     tempImage, readWidth, readHeight, pixelSpace, pixelSpace*readWidth,
+                                                     destination._numBytesDecoded);
                 }
 
                 else if( hasColorTable )
@@ -577,227 +827,88 @@ void SourceData::readImage(DestinationData& destination)
                     // Pseudocolored image.  Convert 1 band + color table to 24bit RGB.
 
                     GDALRasterBand *band;
-                    GDALColorTable *ct;
-                    int i;
 
 
                     band = _gdalDataset->GetRasterBand(1);
 
 
-                    band->RasterIO(GF_Read, 
-                                   windowX,_numValuesY-(windowY+windowHeight), 
-                                   windowWidth,windowHeight, 
-                                   (void*)(tempImage+0),readWidth,readHeight, 
-                                   targetGDALType,pixelSpace,pixelSpace*readWidth);
+                    readSucceeded = readSourceWindow(_gdalDataset.get(), overview, 1, bandMap, targetGDALType,
+                                                     sourceX, sourceY, sourceWidth, sourceHeight,
+                                                     tempImage, readWidth, readHeight, pixelSpace, pixelSpace*readWidth,
+                                                     destination._numBytesDecoded);
 
 
-                    ct = band->GetColorTable();
-
-
-                    for( i = 0; i < readWidth * readHeight; i++ )
+                    // expand the indices in place via the cached lookup table.
+                    if (readSucceeded)
                     {
-                        GDALColorEntry sEntry;
-
-                        // default to greyscale equilvelent.
-                        sEntry.c1 = tempImage[i*3];
-                        sEntry.c2 = tempImage[i*3];
-                        sEntry.c3 = tempImage[i*3];
-
+                        const unsigned char* lut = getColorTableLUT(band->GetColorTable());
 
-                        ct->GetColorEntryAsRGB( tempImage[i*3], &sEntry );
-
-
-                        // Apply RGB back over destination image.
-                        tempImage[i*3 + 0] = sEntry.c1;
-                        tempImage[i*3 + 1] = sEntry.c2;
-                        tempImage[i*3 + 2] = sEntry.c3;
+                        expandPalette(tempImage, pixelSpace, lut, tempImage, pixelSpace, readWidth * readHeight);
                     }
                 }
 
 
                 else if (hasGreyScale)
                 {
-                    // Greyscale image.  Convert 1 band to 24bit RGB.
-                    GDALRasterBand *band;
-
-                    band = _gdalDataset->GetRasterBand(1);
-
+                    // Greyscale image.  Read the band once and expand to 24bit RGB in memory.
+                    readSucceeded = readSourceWindow(_gdalDataset.get(), overview, 1, bandMap, targetGDALType,
+                                                     sourceX, sourceY, sourceWidth, sourceHeight,
+                                                     tempImage, readWidth, readHeight, pixelSpace, pixelSpace*readWidth,
+                                                     destination._numBytesDecoded);
+
+                    unsigned char* pixel = tempImage;
+                    for(int i = 0; readSucceeded && i < readWidth * readHeight; ++i, pixel += pixelSpace)
+                    {
+                        pixel[1] = pixel[0];
+                        pixel[2] = pixel[0];
+                    }
+                }
 
-                    band->RasterIO(GF_Read, 
-                                   windowX,_numValuesY-(windowY+windowHeight), 
-                                   windowWidth,windowHeight, 
-                                   (void*)(tempImage+0),readWidth,readHeight, 
-                                   targetGDALType,pixelSpace,pixelSpace*readWidth);
-                    band->RasterIO(GF_Read, 
-                                   windowX,_numValuesY-(windowY+windowHeight), 
-                                   windowWidth,windowHeight, 
-                                   (void*)(tempImage+1),readWidth,readHeight, 
-                                   targetGDALType,pixelSpace,pixelSpace*readWidth);
-                    band->RasterIO(GF_Read, 
-                                   windowX,_numValuesY-(windowY+windowHeight), 
-                                   windowWidth,windowHeight, 
-                                   (void*)(tempImage+2),readWidth,readHeight, 
-                                   targetGDALType,pixelSpace,pixelSpace*readWidth);
+                if (!readSucceeded)
+                {
+                    log(osg::WARN,"Warning: failed to read a %d x %d window of %s, leaving it out of the tile.",sourceWidth,sourceHeight,_source->getFileName().c_str());
+                    continue;
                 }
 
-                if (doResample || readWidth!=destWidth || readHeight!=destHeight)
+                if (overview>=0 || doResample || readWidth!=destWidth || readHeight!=destHeight)
                 {
-                    unsigned char* destImage = new unsigned char[destWidth*destHeight*pixelSpace];
+                    PooledBuffer<unsigned char> destBuffer(bufferPool, destWidth*destHeight*pixelSpace);
 
-                    // rescale image by hand as glu seem buggy....
-                    for(int j=0;j<destHeight;++j)
+                    if (overview>=0)
                     {
-                        float  t_d = (destHeight>1)?((float)j/((float)destHeight-1)):0;
-                        for(int i=0;i<destWidth;++i)
-                        {
-                            float s_d = (destWidth>1)?((float)i/((float)destWidth-1)):0;
-
-                            float flt_read_i = s_d * ((float)readWidth-1);
-                            float flt_read_j = t_d * ((float)readHeight-1);
-
-                            int read_i = (int)flt_read_i;
-                            if (read_i>=readWidth) read_i=readWidth-1;
-
-                            float flt_read_ir = flt_read_i-read_i;
-                            if (read_i==readWidth-1) flt_read_ir=0.0f;
-
-                            int read_j = (int)flt_read_j;
-                            if (read_j>=readHeight) read_j=readHeight-1;
-
-                            float flt_read_jr = flt_read_j-read_j;
-                            if (read_j==readHeight-1) flt_read_jr=0.0f;
-
-                            unsigned char* dest = destImage + (j*destWidth + i) * pixelSpace;
-                            if (flt_read_ir==0.0f)  // no need to interpolate i axis.
-                            {
-                                if (flt_read_jr==0.0f)  // no need to interpolate j axis.
-                                {
-                                    // copy pixels
-                                    unsigned char* src = tempImage + (read_j*readWidth + read_i) * pixelSpace;
-                                    dest[0] = src[0];
-                                    dest[1] = src[1];
-                                    dest[2] = src[2];
-                                    if (numSourceComponents==4) dest[3] = src[3];
-                                    //std::cout<<"copy");
-                                }
-                                else  // need to interpolate j axis.
-                                {
-                                    // copy pixels
-                                    unsigned char* src_0 = tempImage + (read_j*readWidth + read_i) * pixelSpace;
-                                    unsigned char* src_1 = src_0 + readWidth*pixelSpace;
-                                    float r_0 = 1.0f-flt_read_jr;
-                                    float r_1 = flt_read_jr;
-                                    dest[0] = (unsigned char)((float)src_0[0]*r_0 + (float)src_1[0]*r_1);
-                                    dest[1] = (unsigned char)((float)src_0[1]*r_0 + (float)src_1[1]*r_1);
-                                    dest[2] = (unsigned char)((float)src_0[2]*r_0 + (float)src_1[2]*r_1);
-                                    if (numSourceComponents==4) dest[3] = (unsigned char)((float)src_0[3]*r_0 + (float)src_1[3]*r_1);
-                                    //std::cout<<"interpolate j axis");
-                                }
-                            }
-                            else // need to interpolate i axis.
-                            {
-                                if (flt_read_jr==0.0f) // no need to interpolate j axis.
-                                {
-                                    // copy pixels
-                                    unsigned char* src_0 = tempImage + (read_j*readWidth + read_i) * pixelSpace;
-                                    unsigned char* src_1 = src_0 + pixelSpace;
-                                    float r_0 = 1.0f-flt_read_ir;
-                                    float r_1 = flt_read_ir;
-                                    dest[0] = (unsigned char)((float)src_0[0]*r_0 + (float)src_1[0]*r_1);
-                                    dest[1] = (unsigned char)((float)src_0[1]*r_0 + (float)src_1[1]*r_1);
-                                    dest[2] = (unsigned char)((float)src_0[2]*r_0 + (float)src_1[2]*r_1);
-                                    if (numSourceComponents==4) dest[3] = (unsigned char)((float)src_0[3]*r_0 + (float)src_1[3]*r_1);
-                                    //std::cout<<"interpolate i axis");
-                                }
-                                else  // need to interpolate i and j axis.
-                                {
-                                    unsigned char* src_0 = tempImage + (read_j*readWidth + read_i) * pixelSpace;
-                                    unsigned char* src_1 = src_0 + readWidth*pixelSpace;
-                                    unsigned char* src_2 = src_0 + pixelSpace;
-                                    unsigned char* src_3 = src_1 + pixelSpace;
-                                    float r_0 = (1.0f-flt_read_ir)*(1.0f-flt_read_jr);
-                                    float r_1 = (1.0f-flt_read_ir)*flt_read_jr;
-                                    float r_2 = (flt_read_ir)*(1.0f-flt_read_jr);
-                                    float r_3 = (flt_read_ir)*flt_read_jr;
-                                    dest[0] = (unsigned char)(((float)src_0[0])*r_0 + ((float)src_1[0])*r_1 + ((float)src_2[0])*r_2 + ((float)src_3[0])*r_3);
-                                    dest[1] = (unsigned char)(((float)src_0[1])*r_0 + ((float)src_1[1])*r_1 + ((float)src_2[1])*r_2 + ((float)src_3[1])*r_3);
-                                    dest[2] = (unsigned char)(((float)src_0[2])*r_0 + ((float)src_1[2])*r_1 + ((float)src_2[2])*r_2 + ((float)src_3[2])*r_3);
-                                    if (numSourceComponents==4) dest[3] = (unsigned char)(((float)src_0[3])*r_0 + ((float)src_1[3])*r_1 + ((float)src_2[3])*r_2 + ((float)src_3[3])*r_3);
-                                    //std::cout<<"interpolate i & j axis");
-                                }
-                            }
-
-                        }
+                        // the overview window read is pixel aligned, so carry over the sub pixel offset of the exact window.
+                        resampleImageWindow(tempImage, readWidth, readHeight, readWidth*pixelSpace,
+                                            overviewOriginX, overviewOriginY, overviewStepX, overviewStepY,
+                                            destBuffer.get(), destWidth, destHeight, destWidth*pixelSpace,
+                                            numSourceComponents, RESAMPLE_BILINEAR);
+                    }
+                    else
+                    {
+                        resampleImage(tempImage, readWidth, readHeight, readWidth*pixelSpace,
+                                      destBuffer.get(), destWidth, destHeight, destWidth*pixelSpace,
+                                      numSourceComponents, RESAMPLE_BILINEAR);
                     }
 
-                    delete [] tempImage;
-                    tempImage = destImage;
+                    tempBuffer.swap(destBuffer);
+                    tempImage = tempBuffer.get();
                 }
 
-                // now copy into destination image
-                unsigned char* sourceRowPtr = tempImage;
-                int sourceRowDelta = pixelSpace*destWidth;
+                // now copy into destination image, writing the rows bottom-up.
                 unsigned char* destinationRowPtr = destination._image->data(destX,destY+destHeight-1);
                 int destinationRowDelta = -(int)(destination._image->getRowSizeInBytes());
-                int destination_pixelSpace = destination._image->getPixelSizeInBits()/8;
-                bool destination_hasAlpha = osg::Image::computeNumComponents(destination._image->getPixelFormat())==4;
+                unsigned int destination_numComponents = osg::Image::computeNumComponents(destination._image->getPixelFormat());
 
-                // copy image to destination image
-                for(int row=0;
-                    row<destHeight;
-                    ++row, sourceRowPtr+=sourceRowDelta, destinationRowPtr+=destinationRowDelta)
-                {
-                    unsigned char* sourceColumnPtr = sourceRowPtr;
-                    unsigned char* destinationColumnPtr = destinationRowPtr;
+                // sources with alpha are blended over the destination, otherwise black is treated as no data.
+                CompositeMode compositeMode = hasAlpha ? COMPOSITE_ALPHA_OVER : COMPOSITE_BLACK_AS_NODATA;
 
-                    for(int col=0;
-                        col<destWidth;
-                        ++col, sourceColumnPtr+=pixelSpace, destinationColumnPtr+=destination_pixelSpace)
-                    {
-                        if (hasAlpha)
-                        {
-                            // only copy over source pixel if its alpha value is not 0
-                            if (sourceColumnPtr[3]!=0)
-                            {
-                                if (sourceColumnPtr[3]==255)
-                                {
-                                    // source alpha is full on so directly copy over.
-                                    destinationColumnPtr[0] = sourceColumnPtr[0];
-                                    destinationColumnPtr[1] = sourceColumnPtr[1];
-                                    destinationColumnPtr[2] = sourceColumnPtr[2];
-
-                                    if (destination_hasAlpha)
-                                        destinationColumnPtr[3] = sourceColumnPtr[3];
-                                }
-                                else
-                                {
-                                    // source value isn't full on so blend it with destination
-                                    float rs = (float)sourceColumnPtr[3]/255.0f;
-                                    float rd = 1.0f-rs;
-
-                                    destinationColumnPtr[0] = (int)(rd * (float)destinationColumnPtr[0] + rs * (float)sourceColumnPtr[0]);
-                                    destinationColumnPtr[1] = (int)(rd * (float)destinationColumnPtr[1] + rs * (float)sourceColumnPtr[1]);
-                                    destinationColumnPtr[2] = (int)(rd * (float)destinationColumnPtr[2] + rs * (float)sourceColumnPtr[2]);
-
-                                    if (destination_hasAlpha)
-                                        destinationColumnPtr[3] = osg::maximum(destinationColumnPtr[3],sourceColumnPtr[3]);
-
-                                }
-                            }
-                        }
-                        else if (sourceColumnPtr[0]!=0 || sourceColumnPtr[1]!=0 || sourceColumnPtr[2]!=0)
-                        {
-                            destinationColumnPtr[0] = sourceColumnPtr[0];
-                            destinationColumnPtr[1] = sourceColumnPtr[1];
-                            destinationColumnPtr[2] = sourceColumnPtr[2];
-                            if (destination_hasAlpha) 
-                                destinationColumnPtr[3] = 255; 
-              
-                        }
-                    }
-                }
+                // when the tile is to be rendered with blending, accumulate the destination alpha as coverage.
+                BuildOptions::BlendingPolicy blendingPolicy = destination._dataSet->getBlendingPolicy();
+                bool coverageAlpha = (blendingPolicy==BuildOptions::ENABLE_BLENDING ||
+                                      blendingPolicy==BuildOptions::ENABLE_BLENDING_WHEN_ALPHA_PRESENT);
 
-                delete [] tempImage;
+                compositeImage(tempImage, pixelSpace*destWidth, numSourceComponents,
+                               destinationRowPtr, destinationRowDelta, destination_numComponents,
+                               destWidth, destHeight, compositeMode, coverageAlpha);
 
             }
             else
@@ -821,6 +932,8 @@ void SourceData::readHeightField(DestinationData& destination)
         osg::ref_ptr<GeospatialDataset> _gdalDataset = _source->getOptimumGeospatialDataset(destination, READ_ONLY);
         if (!_gdalDataset.valid()) return;
         
+        // System hands out a separate read only handle per concurrent reader where possible,
+        // so this lock only serializes access when the per file handle limit has been reached.
         OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_gdalDataset->getMutex());
 
         GeospatialExtents s_bb = getExtents(destination._cs.get());
@@ -963,15 +1076,57 @@ void SourceData::readHeightField(DestinationData& destination)
                     double delta_X = hf->getXInterval();
                     double delta_Y = hf->getYInterval();
 
-                    for (int c = destX; c < endX; ++c)
+                    double invTransform[6];
+                    computeInverseGeoTransform(*this, invTransform);
+
+                    // the transform is affine so the corners of the destination area bound the source window
+                    double colMin = DBL_MAX, colMax = -DBL_MAX, rowMin = DBL_MAX, rowMax = -DBL_MAX;
+                    for(int corner = 0; corner < 4; ++corner)
                     {
-                        double geoX = orig_X + (delta_X * (double)c);
-                        for (int r = destY; r < endY; ++r)
+                        double geoX = orig_X + delta_X * (double)((corner & 1) ? endX-1 : destX) - xoffset;
+                        double geoY = orig_Y + delta_Y * (double)((corner & 2) ? endY-1 : destY);
+                        double c, r;
+                        GDALApplyGeoTransform(invTransform, geoX, geoY, &c, &r);
+                        colMin = osg::minimum(colMin, c); colMax = osg::maximum(colMax, c);
+                        rowMin = osg::minimum(rowMin, r); rowMax = osg::maximum(rowMax, r);
+                    }
+
+                    // cap the block so that a coarse destination over a fine source doesn't pull in a huge window
+                    const unsigned int maxNumValues = osg::maximum(16u * (unsigned int)((destWidth+2)*(destHeight+2)), 1024u*1024u);
+
+                    InterpolatedValueBlock block(_numValuesX, _numValuesY);
+                    if (block.read(_gdalDataset.get(), bandSelected, colMin, rowMin, colMax, rowMax, maxNumValues, destination._numBytesDecoded))
+                    {
+                        log(osg::INFO,"   interpolating from block %d\t%d\t%d\t%d",block._colStart,block._rowStart,block._numCols,block._numRows);
+
+                        for (int c = destX; c < endX; ++c)
                         {
-                            double geoY = orig_Y + (delta_Y * (double)r);
-                            float h = getInterpolatedValue(bandSelected, geoX-xoffset, geoY, hf->getHeight(c,r)/scale);
-                            if (!validValueOperator.isNoDataValue(h)) hf->setHeight(c,r,offset + h*scale);
-                            else if (!ignoreNoDataValue) hf->setHeight(c,r,noDataValueFill);
+                            double geoX = orig_X + (delta_X * (double)c);
+                            for (int r = destY; r < endY; ++r)
+                            {
+                                double geoY = orig_Y + (delta_Y * (double)r);
+                                double sc, sr;
+                                GDALApplyGeoTransform(invTransform, geoX-xoffset, geoY, &sc, &sr);
+                                float h = block.getInterpolatedValue(sc, sr, hf->getHeight(c,r)/scale, validValueOperator);
+                                if (!validValueOperator.isNoDataValue(h)) hf->setHeight(c,r,offset + h*scale);
+                                else if (!ignoreNoDataValue) hf->setHeight(c,r,noDataValueFill);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        log(osg::INFO,"   unable to read source block for interpolation, sampling per vertex");
+
+                        for (int c = destX; c < endX; ++c)
+                        {
+                            double geoX = orig_X + (delta_X * (double)c);
+                            for (int r = destY; r < endY; ++r)
+                            {
+                                double geoY = orig_Y + (delta_Y * (double)r);
+                                float h = getInterpolatedValue(bandSelected, geoX-xoffset, geoY, hf->getHeight(c,r)/scale);
+                                if (!validValueOperator.isNoDataValue(h)) hf->setHeight(c,r,offset + h*scale);
+                                else if (!ignoreNoDataValue) hf->setHeight(c,r,noDataValueFill);
+                            }
                         }
                     }
                 }
@@ -987,14 +1142,23 @@ void SourceData::readHeightField(DestinationData& destination)
                     log(osg::INFO,"             to %d\t%s\t%d\t%d",destX,destY,destWidth,destHeight);
 
                     // read data into temporary array
-                    float* heightData = new float [ destWidth*destHeight ];
-
-                    //bandSelected->RasterIO(GF_Read,windowX,_numValuesY-(windowY+windowHeight),windowWidth,windowHeight,floatdata,destWidth,destHeight,GDT_Float32,numBytesPerZvalue,lineSpace);
-                    bandSelected->RasterIO(GF_Read,windowX,_numValuesY-(windowY+windowHeight),windowWidth,windowHeight,heightData,destWidth,destHeight,GDT_Float32,0,0);
+                    PooledBuffer<float> heightBuffer(System::instance()->getBufferPool(), destWidth*destHeight);
+                    float* heightData = heightBuffer.get();
+
+                    // pull the window through the shared block cache so neighbouring tiles reuse the decoded blocks.
+                    int bandIndex = bandSelected->GetBand();
+                    bool readSucceeded = readSourceWindow(_gdalDataset.get(), -1, 1, &bandIndex, GDT_Float32,
+                                                          windowX, _numValuesY-(windowY+windowHeight), windowWidth, windowHeight,
+                                                          (unsigned char*)heightData, destWidth, destHeight, sizeof(float), destWidth*sizeof(float),
+                                                          destination._numBytesDecoded);
+                    if (!readSucceeded)
+                    {
+                        log(osg::WARN,"Warning: failed to read a %d x %d window of heights from %s, leaving it out of the height field.",windowWidth,windowHeight,_source->getFileName().c_str());
+                    }
 
                     float* heightPtr = heightData;
 
-                    for(int r=destY+destHeight-1;r>=destY;--r)
+                    for(int r=destY+destHeight-1;readSucceeded && r>=destY;--r)
                     {
                         for(int c=destX;c<destX+destWidth;++c)
                         {
@@ -1004,8 +1168,6 @@ void SourceData::readHeightField(DestinationData& destination)
                             h = hf->getHeight(c,r);
                         }
                     }
-
-                    delete [] heightData;
                 }
             }
         }
@@ -0,0 +1,183 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/SourceIndex>
+#include <vpb/Source>
+
+#include <algorithm>
+#include <math.h>
+
+using namespace vpb;
+
+namespace
+{
+
+const unsigned int NODE_CAPACITY = 16;
+
+template<class T>
+struct LessCentreX
+{
+    bool operator () (const T& lhs, const T& rhs) const
+    {
+        return (lhs.extents.xMin()+lhs.extents.xMax()) < (rhs.extents.xMin()+rhs.extents.xMax());
+    }
+};
+
+template<class T>
+struct LessCentreY
+{
+    bool operator () (const T& lhs, const T& rhs) const
+    {
+        return (lhs.extents.yMin()+lhs.extents.yMax()) < (rhs.extents.yMin()+rhs.extents.yMax());
+    }
+};
+
+// order the items so that each run of NODE_CAPACITY items forms a compact node, sorting into vertical slices by x then within each slice by y.
+template<class T>
+void sortTileRecursive(std::vector<T>& items)
+{
+    unsigned int numNodes = (items.size()+NODE_CAPACITY-1)/NODE_CAPACITY;
+    unsigned int numSlices = static_cast<unsigned int>(ceil(sqrt(double(numNodes))));
+    unsigned int sliceSize = numSlices*NODE_CAPACITY;
+
+    std::sort(items.begin(), items.end(), LessCentreX<T>());
+
+    for(unsigned int i=0; i<items.size(); i+=sliceSize)
+    {
+        unsigned int end = osg::minimum(i+sliceSize, static_cast<unsigned int>(items.size()));
+        std::sort(items.begin()+i, items.begin()+end, LessCentreY<T>());
+    }
+}
+
+template<class T, class N>
+void groupItems(const std::vector<T>& items, std::vector<N>& nodes)
+{
+    for(unsigned int i=0; i<items.size(); i+=NODE_CAPACITY)
+    {
+        N node;
+        node.begin = i;
+        node.end = osg::minimum(i+NODE_CAPACITY, static_cast<unsigned int>(items.size()));
+        for(unsigned int c=node.begin; c<node.end; ++c)
+        {
+            node.extents.expandBy(items[c].extents);
+        }
+        nodes.push_back(node);
+    }
+}
+
+inline bool overlaps(const GeospatialExtents& extents, const GeospatialExtents* boxes, unsigned int numBoxes)
+{
+    for(unsigned int i=0; i<numBoxes; ++i)
+    {
+        if (osg::maximum(extents.xMin(),boxes[i].xMin()) <= osg::minimum(extents.xMax(),boxes[i].xMax()) &&
+            osg::maximum(extents.yMin(),boxes[i].yMin()) <= osg::minimum(extents.yMax(),boxes[i].yMax())) return true;
+    }
+    return false;
+}
+
+}
+
+SourceIndex::SourceIndex(CompositeSource* sourceGraph, const osg::CoordinateSystemNode* cs)
+{
+    for(CompositeSource::source_iterator itr(sourceGraph);itr.valid();++itr)
+    {
+        Source* source = itr->get();
+
+        unsigned int order = _sources.size();
+        _sources.push_back(source);
+
+        SourceData* sd = source ? source->getSourceData() : 0;
+        if (!sd) continue;
+
+        Entry entry;
+        entry.extents = sd->getExtents(cs);
+        entry.order = order;
+
+        // sources that couldn't be mapped into cs never intersect anything.
+        if (entry.extents.valid()) _entries.push_back(entry);
+    }
+
+    if (_entries.empty()) return;
+
+    sortTileRecursive(_entries);
+
+    Nodes nodes;
+    groupItems(_entries, nodes);
+
+    while(nodes.size()>NODE_CAPACITY)
+    {
+        sortTileRecursive(nodes);
+
+        Nodes parents;
+        groupItems(nodes, parents);
+
+        _levels.push_back(Nodes());
+        _levels.back().swap(nodes);
+        nodes.swap(parents);
+    }
+
+    _levels.push_back(Nodes());
+    _levels.back().swap(nodes);
+}
+
+void SourceIndex::intersect(const GeospatialExtents& extents, const GeospatialExtents* boxes, unsigned int numBoxes,
+                            unsigned int level, unsigned int begin, unsigned int end, Orders& orders) const
+{
+    const Nodes& nodes = _levels[level];
+    for(unsigned int i=begin; i<end; ++i)
+    {
+        const Node& node = nodes[i];
+        if (!overlaps(node.extents, boxes, numBoxes)) continue;
+
+        if (level>0)
+        {
+            intersect(extents, boxes, numBoxes, level-1, node.begin, node.end, orders);
+        }
+        else
+        {
+            for(unsigned int e=node.begin; e<node.end; ++e)
+            {
+                // use the same test as Source::intersects() so the results match a linear scan exactly.
+                if (extents.intersects(_entries[e].extents)) orders.push_back(_entries[e].order);
+            }
+        }
+    }
+}
+
+void SourceIndex::getIntersectingSources(const GeospatialExtents& extents, Sources& sources) const
+{
+    if (_levels.empty() || !extents.valid()) return;
+
+    // geographic extents also intersect sources a whole revolution either side.
+    GeospatialExtents boxes[3];
+    unsigned int numBoxes = 1;
+    boxes[0] = extents;
+    if (extents._isGeographic)
+    {
+        boxes[1] = GeospatialExtents(extents.xMin()-360.0, extents.yMin(), extents.xMax()-360.0, extents.yMax(), true);
+        boxes[2] = GeospatialExtents(extents.xMin()+360.0, extents.yMin(), extents.xMax()+360.0, extents.yMax(), true);
+        numBoxes = 3;
+    }
+
+    Orders orders;
+    intersect(extents, boxes, numBoxes, _levels.size()-1, 0, _levels.back().size(), orders);
+
+    std::sort(orders.begin(), orders.end());
+
+    for(Orders::iterator itr = orders.begin();
+        itr != orders.end();
+        ++itr)
+    {
+        sources.push_back(_sources[*itr]);
+    }
+}
@@ -16,6 +16,8 @@
 #include <vpb/Date>
 #include <vpb/FileUtils>
 
+#include <OpenThreads/Thread>
+
 #include <map>
 #include <gdal_priv.h>
 
@@ -66,9 +68,14 @@ System::System()
     // setup GDAL
     GDALAllRegister();
 
-    _trimOldestTiles = true;
-    _numUnusedDatasetsToTrimFromCache = 10;
-    _maxNumDatasets = (unsigned int)(double(vpb::getdtablesize()) * 0.8);
+    _datasetCache = new DatasetCache;
+    _datasetCache->setTrimOldest(true);
+    _datasetCache->setNumDatasetsToTrim(10);
+    _datasetCache->setMaximumNumDatasets((unsigned int)(double(vpb::getdtablesize()) * 0.8));
+    _datasetCache->setMaximumNumDatasetsPerFile(osg::maximum(OpenThreads::GetNumberOfProcessors(), 1));
+
+    _sourceBlockCache = new SourceBlockCache;
+    _bufferPool = new BufferPool;
     
     _logDirectory = "logs";
     _taskDirectory = "tasks";
@@ -160,26 +167,37 @@ void System::readEnvironmentVariables()
     {
         if (strcmp(str,"OLDEST")==0 || strcmp(str,"oldest")==0 ||  strcmp(str,"Oldest")==0)
         {
-            _trimOldestTiles = true;
+            setTrimOldestTiles(true);
         }
         else
         {
-            _trimOldestTiles = false;
+            setTrimOldestTiles(false);
         }
     }
 
     str = getenv("VPB_NUM_UNUSED_DATASETS_TO_TRIM_FROM_CACHE");
     if (str)
     {
-        _numUnusedDatasetsToTrimFromCache = atoi(str);
+        setNumUnusedDatasetsToTrimFromCache(atoi(str));
     }
 
     str = getenv("VPB_MAXIMUM_NUM_OPEN_DATASETS");
     if (str)
     {
-        _maxNumDatasets = atoi(str);
+        setMaximumNumDatasets(atoi(str));
     }
 
+    str = getenv("VPB_MAXIMUM_NUM_OPEN_DATASETS_PER_FILE");
+    if (str)
+    {
+        setMaximumNumDatasetsPerFile(osg::maximum(atoi(str), 1));
+    }
+
+    str = getenv("VPB_MAXIMUM_OPEN_DATASETS_SIZE");
+    if (str)
+    {
+        setMaximumNumDatasetBytes(strtoull(str, 0, 10));
+    }
 
     str = getenv("VPB_MACHINE_FILE");
     if (str)
@@ -253,123 +271,31 @@ TaskManager* System::getTaskManager()
 
 void System::clearDatasetCache()
 {
-    _datasetMap.clear();
+    _datasetCache->clear();
 }
 
-
-class TrimN
-{
-public:
-
-    TrimN(unsigned int n, bool oldest):
-        _oldest(oldest),
-        _num(n) {}
-    
-    
-    inline void add(System::DatasetMap::iterator itr)
-    {
-        if (itr->second->referenceCount()!=1) return;
-    
-        double t = itr->second->getTimeStamp();
-        if (_timeIteratorMap.size() < _num)
-        {
-            _timeIteratorMap.insert(TimeIteratorMap::value_type(t,itr));
-        }
-        else if (_oldest)
-        {
-            if (t < _timeIteratorMap.rbegin()->first)
-            {
-                // erase the end entry
-                _timeIteratorMap.erase(_timeIteratorMap.rbegin()->first);
-                _timeIteratorMap.insert(TimeIteratorMap::value_type(t,itr));
-            }
-        }
-        else
-        {
-            if (t > _timeIteratorMap.begin()->first)
-            {
-                // erase the first entry
-                _timeIteratorMap.erase(_timeIteratorMap.begin()->first);
-                _timeIteratorMap.insert(TimeIteratorMap::value_type(t,itr));
-            }
-        }
-    }
-    
-    void add(System::DatasetMap& datasetMap)
-    {
-        for(System::DatasetMap::iterator itr = datasetMap.begin();
-            itr != datasetMap.end();
-            ++itr)
-        {
-            add(itr);
-        }
-    }
-    
-    void eraseFrom(System::DatasetMap& datasetMap)
-    {
-        for(TimeIteratorMap::iterator itr = _timeIteratorMap.begin();
-            itr != _timeIteratorMap.end();
-            ++itr)
-        {
-            datasetMap.erase(itr->second);
-        }
-    }
-    
-    typedef std::multimap<double, System::DatasetMap::iterator> TimeIteratorMap;
-    
-    bool            _oldest;
-    unsigned int    _num;
-    TimeIteratorMap _timeIteratorMap;
-};
-
 void System::clearUnusedDatasets(unsigned int numToClear)
 {
-    TrimN lowerN(numToClear, _trimOldestTiles);
-
-    lowerN.add(_datasetMap);
-    lowerN.eraseFrom(_datasetMap);
-    
-    _datasetMap.clear();
+    _datasetCache->trim(numToClear);
 }
 
-GeospatialDataset* System::openGeospatialDataset(const std::string& filename, AccessMode accessMode)
+osg::ref_ptr<GeospatialDataset> System::openGeospatialDataset(const std::string& filename, AccessMode accessMode)
 {
-    // first check to see if dataset already exists in cache, if so return it.
-    DatasetMap::iterator itr = _datasetMap.find(FileNameAccessModePair(filename,accessMode));
-    if (itr != _datasetMap.end())
-    {
-        //osg::notify(osg::NOTICE)<<"System::openGeospatialDataset("<<filename<<") returning existing entry, ref count "<<itr->second->referenceCount()<<std::endl;
-        return itr->second.get();
-    }
-
-    // make sure there is room available for this new Dataset
-    if (_datasetMap.size()>=_maxNumDatasets) clearUnusedDatasets(_numUnusedDatasetsToTrimFromCache);
-    
-    // double check to make sure there is room to open a new dataset
-    if (_datasetMap.size()>=_maxNumDatasets)
-    {
-        log(osg::NOTICE,"Error: System::GDALOpen(%s) unable to open file as unsufficient file handles available.",filename.c_str());
-        return 0;
-    }
-    
-    //osg::notify(osg::NOTICE)<<"System::openGeospatialDataset("<<filename<<") requires new entry "<<std::endl;
-
-    // open the new dataset.
-    GeospatialDataset* dataset = new GeospatialDataset(filename, accessMode);
+    return _datasetCache->open(filename, accessMode);
+}
 
-    // insert it into the cache
-    _datasetMap[FileNameAccessModePair(filename,accessMode)] = dataset;
-    
-    // return it.
-    return dataset;
+osg::ref_ptr<GeospatialDataset> System::openWarpedGeospatialDataset(const std::string& filename, const std::string& sourceWKT, const std::string& destinationWKT, double errorThreshold)
+{
+    return _datasetCache->openWarped(filename, sourceWKT, destinationWKT, errorThreshold);
 }
 
-GeospatialDataset* System::openOptimumGeospatialDataset(const std::string& filename, const SpatialProperties& sp, AccessMode accessMode)
+osg::ref_ptr<GeospatialDataset> System::openOptimumGeospatialDataset(const std::string& filename, const SpatialProperties& sp, AccessMode accessMode)
 {
     if (_fileCache.valid())
     {
         std::string optimumFile = _fileCache->getOptimimumFile(filename, sp);
-        return (optimumFile.empty()) ? 0 : openGeospatialDataset(optimumFile, accessMode);
+        if (optimumFile.empty()) return 0;
+        return openGeospatialDataset(optimumFile, accessMode);
     }
     else
     {
@@ -1,9 +1,56 @@
 #include <vpb/TextureUtils>
+#include <vpb/DXTCompression>
+#include <vpb/MipMapGenerator>
 #include <vpb/BuildLog>
+
 #include <iostream>
 
-void vpb::compress(osg::State& state, osg::Texture& texture, osg::Texture::InternalFormatMode compressedFormat, bool generateMipMap, bool resizeToPowerOfTwo, vpb::BuildOptions::CompressionMethod method, vpb::BuildOptions::CompressionQuality quality)
+static void resizeImageToPowerOfTwo(osg::Image& image)
 {
+    int s = osg::Image::computeNearestPowerOfTwo(image.s());
+    int t = osg::Image::computeNearestPowerOfTwo(image.t());
+    if (s!=image.s() || t!=image.t())
+    {
+        image.scaleImage(s,t,image.r());
+    }
+}
+
+static bool generateMipMapsOnCPU(osg::Image& image, bool resizeToPowerOfTwo, vpb::BuildOptions::MipMapFilter mipMapFilter, bool mipMapLinearLight, unsigned int mipMapNumThreads)
+{
+    if (resizeToPowerOfTwo) resizeImageToPowerOfTwo(image);
+    if (image.isMipmap()) return true;
+
+    if (!vpb::generateMipMaps(image, mipMapFilter, mipMapLinearLight, mipMapNumThreads))
+    {
+        vpb::log(osg::WARN,"Unable to mipmap image of this data type on the CPU.");
+        return false;
+    }
+    return true;
+}
+
+void vpb::compress(osg::State& state, osg::Texture& texture, osg::Texture::InternalFormatMode compressedFormat, bool generateMipMap, bool resizeToPowerOfTwo, vpb::BuildOptions::CompressionMethod method, vpb::BuildOptions::CompressionQuality quality, unsigned int numThreads,
+                   vpb::BuildOptions::MipMapFilter mipMapFilter, bool mipMapLinearLight, unsigned int mipMapNumThreads,
+                   vpb::BuildOptions::MipMapMethod mipMapMethod)
+{
+    if(method == vpb::BuildOptions::CPU)
+    {
+        osg::Image* image = texture.getImage(0);
+        GLenum compressedPixelFormat = computeDXTPixelFormat(compressedFormat, image->getPixelFormat());
+
+        if (generateMipMap) generateMipMapsOnCPU(*image, resizeToPowerOfTwo, mipMapFilter, mipMapLinearLight, mipMapNumThreads);
+        else if (resizeToPowerOfTwo) resizeImageToPowerOfTwo(*image);
+
+        if (!compressedPixelFormat || !compressDXT(*image, compressedPixelFormat, quality, numThreads))
+        {
+            log(osg::WARN,"CPU compressor unable to compress image, leaving it uncompressed.");
+        }
+
+        texture.setInternalFormatMode(osg::Texture::USE_IMAGE_DATA_FORMAT);
+        texture.setResizeNonPowerOfTwoHint(resizeToPowerOfTwo);
+
+        return;
+    }
+
     if(method != vpb::BuildOptions::GL_DRIVER)
     {
         osgDB::ImageProcessor* processor = osgDB::Registry::instance()->getImageProcessor();
@@ -33,6 +80,12 @@ void vpb::compress(osg::State& state, osg::Texture& texture, osg::Texture::Inter
         }
     }
 
+    // the GL driver compresses each level of an image that already has mipmaps, so generate them here unless asked not to.
+    if (generateMipMap && mipMapMethod==vpb::BuildOptions::CPU_MIPMAPS)
+    {
+        generateMipMapsOnCPU(*texture.getImage(0), resizeToPowerOfTwo, mipMapFilter, mipMapLinearLight, mipMapNumThreads);
+    }
+
     texture.setInternalFormatMode(compressedFormat);
 
     // force the mip mapping off temporay if we intend the graphics hardware to do the mipmapping.
@@ -61,8 +114,23 @@ void vpb::compress(osg::State& state, osg::Texture& texture, osg::Texture::Inter
 }
 
 
-void vpb::generateMipMap(osg::State& state, osg::Texture& texture, bool resizeToPowerOfTwo, vpb::BuildOptions::CompressionMethod method)
+void vpb::generateMipMap(osg::State& state, osg::Texture& texture, bool resizeToPowerOfTwo, vpb::BuildOptions::CompressionMethod method,
+                         vpb::BuildOptions::MipMapFilter mipMapFilter, bool mipMapLinearLight, unsigned int mipMapNumThreads,
+                         vpb::BuildOptions::MipMapMethod mipMapMethod)
 {
+    if(method == vpb::BuildOptions::CPU || mipMapMethod == vpb::BuildOptions::CPU_MIPMAPS)
+    {
+        // only fall back to the GL driver or NVTT if they were selected and the CPU generator can't handle the image.
+        if (generateMipMapsOnCPU(*texture.getImage(0), resizeToPowerOfTwo, mipMapFilter, mipMapLinearLight, mipMapNumThreads) ||
+            method == vpb::BuildOptions::CPU)
+        {
+            texture.setInternalFormatMode(osg::Texture::USE_IMAGE_DATA_FORMAT);
+            texture.setResizeNonPowerOfTwoHint(resizeToPowerOfTwo);
+
+            return;
+        }
+    }
+
     if(method != vpb::BuildOptions::GL_DRIVER)
     {
         osgDB::ImageProcessor* processor = osgDB::Registry::instance()->getImageProcessor();
@@ -13,8 +13,35 @@
 
 #include <vpb/ThreadPool>
 
+#include <OpenThreads/ScopedLock>
+
 using namespace vpb;
 
+namespace vpb
+{
+
+// Sits on each pool thread's own OperationQueue as a kept operation, so the thread calls it over and over,
+// each call running the next operation from the pool's deques.
+class WorkerOperation : public osg::Operation
+{
+    public:
+
+        WorkerOperation(ThreadPool* threadPool, unsigned int workerIndex):
+            osg::Operation("WorkerOperation", true),
+            _threadPool(threadPool),
+            _workerIndex(workerIndex) {}
+
+        virtual void operator () (osg::Object* object)
+        {
+            _threadPool->runNextOperation(_workerIndex, object);
+        }
+
+        ThreadPool*     _threadPool;
+        unsigned int    _workerIndex;
+};
+
+}
+
 ThreadPool::ThreadPool(unsigned int numThreads, bool requiresGraphicsContext):
     _numThreads(numThreads),
     _requiresGraphicsContext(requiresGraphicsContext)
@@ -32,16 +59,32 @@ ThreadPool::ThreadPool(const ThreadPool& tp, const osg::CopyOp& copyop):
 ThreadPool::~ThreadPool()
 {
     stopThreads();
+
+    // the threads reference the workers, so make sure they've exited before deleting them.
+    for(Threads::iterator itr = _threads.begin();
+        itr != _threads.end();
+        ++itr)
+    {
+        itr->first->cancel();
+    }
+
+    for(Workers::iterator itr = _workers.begin();
+        itr != _workers.end();
+        ++itr)
+    {
+        delete *itr;
+    }
 }
 
 
 void ThreadPool::init()
 {
     _numRunningOperations = 0;
+    _numQueuedOperations = 0;
+    _numWaitingOperations = 0;
+    _nextWorker = 0;
     _done = false;
-
-    _operationQueue = new osg::OperationQueue;
-    _blockOp = new BlockOperation;
+    _startTick = osg::Timer::instance()->tick();
 
     osg::GraphicsContext* sharedContext = 0;
 
@@ -96,8 +139,15 @@ void ThreadPool::init()
 
         if (thread.valid())
         {
-            thread->setOperationQueue(_operationQueue.get());
+            Worker* worker = new Worker;
+            worker->thread = thread.get();
+
+            // each thread gets its own queue holding just its WorkerOperation.
+            osg::ref_ptr<osg::OperationQueue> operationQueue = new osg::OperationQueue;
+            operationQueue->add(new WorkerOperation(this, _workers.size()));
+            thread->setOperationQueue(operationQueue.get());
 
+            _workers.push_back(worker);
             _threads.push_back(ThreadContextPair(thread, gc));
         }
     }
@@ -107,7 +157,11 @@ void ThreadPool::startThreads()
 {
     //int numProcessors = OpenThreads::GetNumberOfProcessors();
     int processNum = 0;
-    _done = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _done = false;
+        _startTick = osg::Timer::instance()->tick();
+    }
     for(Threads::iterator itr = _threads.begin();
         itr != _threads.end();
         ++itr, ++processNum)
@@ -123,7 +177,13 @@ void ThreadPool::startThreads()
 
 void ThreadPool::stopThreads()
 {
-    _done = true;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _done = true;
+
+        // release any callers blocked in run() or waitForCompletion().
+        _condition.broadcast();
+    }
     
     for(Threads::iterator itr = _threads.begin();
         itr != _threads.end();
@@ -137,23 +197,162 @@ void ThreadPool::stopThreads()
     }
 }
 
+bool ThreadPool::done() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _done;
+}
+
+void ThreadPool::setMaximumNumOperationsInQueue(unsigned int num)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _maxNumberOfOperationsInQueue = num;
+    _condition.broadcast();
+}
+
+int ThreadPool::getCurrentWorker() const
+{
+    OpenThreads::Thread* currentThread = OpenThreads::Thread::CurrentThread();
+    if (!currentThread) return -1;
+
+    for(unsigned int i=0; i<_workers.size(); ++i)
+    {
+        if (_workers[i]->thread==currentThread) return i;
+    }
+    return -1;
+}
+
 void ThreadPool::run(osg::Operation* op)
 {
+    if (_workers.empty())
+    {
+        if (done())
+        {
+            log(osg::NOTICE,"ThreadPool::run() Attempt to run BuilderOperation after ThreadPool has been suspended.");
+            return;
+        }
+
+        // no threads to hand the operation to so just run it now.
+        (*op)(this);
+        return;
+    }
+
+    int currentWorker = getCurrentWorker();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
     if (_done)
     {
         log(osg::NOTICE,"ThreadPool::run() Attempt to run BuilderOperation after ThreadPool has been suspended.");
         return;
     }
-    
-    while (_operationQueue->getNumOperationsInQueue() >= _maxNumberOfOperationsInQueue)
+
+    unsigned int workerIndex;
+    BuildOperation* buildOp = dynamic_cast<BuildOperation*>(op);
+    if (buildOp && buildOp->getAffinityHint()>=0) workerIndex = buildOp->getAffinityHint() % _workers.size();
+    else if (currentWorker>=0) workerIndex = currentWorker;
+    else workerIndex = (_nextWorker++) % _workers.size();
+
+    // the pool's own threads never block on a full queue, as they are the ones that have to empty it.
+    if (currentWorker<0 && _numQueuedOperations >= _maxNumberOfOperationsInQueue && !_done)
     {
         log(osg::INFO,"ThreadPool::run() Waiting for operation queue to clear.");
 
-        // Wait for half a seocnd for the queue to clear.
-        OpenThreads::Thread::microSleep(500000);
+        // sleep until a thread takes an operation off the queue.
+        osg::Timer_t startWait = osg::Timer::instance()->tick();
+        while (_numQueuedOperations >= _maxNumberOfOperationsInQueue && !_done)
+        {
+            _condition.wait(&_mutex);
+        }
+
+        ++_statistics.numProducerWaits;
+        _statistics.producerWaitTime += osg::Timer::instance()->delta_s(startWait, osg::Timer::instance()->tick());
+    }
+
+    {
+        Worker* worker = _workers[workerIndex];
+        OpenThreads::ScopedLock<OpenThreads::Mutex> workerLock(worker->mutex);
+        worker->operations.push_back(op);
+    }
+
+    ++_numQueuedOperations;
+    ++_statistics.numOperations;
+    _statistics.maxQueueDepth = osg::maximum(_statistics.maxQueueDepth, _numQueuedOperations);
+
+    // wake any idle threads so they can take or steal the new operation.
+    _condition.broadcast();
+}
+
+bool ThreadPool::takeOperation(unsigned int workerIndex, osg::ref_ptr<osg::Operation>& op)
+{
+    {
+        Worker* worker = _workers[workerIndex];
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(worker->mutex);
+        if (!worker->operations.empty())
+        {
+            op = worker->operations.front();
+            worker->operations.pop_front();
+            return true;
+        }
+    }
+
+    // steal from the back so the victim keeps working through its own operations in order.
+    for(unsigned int i=1; i<_workers.size() && !op; ++i)
+    {
+        Worker* victim = _workers[(workerIndex+i) % _workers.size()];
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(victim->mutex);
+        if (!victim->operations.empty())
+        {
+            op = victim->operations.back();
+            victim->operations.pop_back();
+        }
+    }
+
+    if (!op) return false;
+
+    // take the pool lock only once the victim's is released, run() takes them in the opposite order.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    ++_statistics.numStolen;
+    return true;
+}
+
+void ThreadPool::runNextOperation(unsigned int workerIndex, osg::Object* object)
+{
+    osg::ref_ptr<osg::Operation> op;
+    if (!takeOperation(workerIndex, op))
+    {
+        // nothing to do, sleep until more work is queued, waking periodically so a stopped thread can exit.
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (_numQueuedOperations==0 && !_done) _condition.wait(&_mutex, 100);
+        return;
+    }
+
+    runOperation(op.get(), object);
+}
+
+void ThreadPool::runOperation(osg::Operation* op, osg::Object* object)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        --_numQueuedOperations;
+        ++_numRunningOperations;
+
+        // there's now room in the queue for any blocked producer.
+        _condition.broadcast();
+    }
+
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    (*op)(object);
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        --_numRunningOperations;
+        _statistics.busyTime += osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+
+        // wake waitForCompletion() callers, including pool threads waiting on the operations other than their own.
+        if (_numQueuedOperations==0 && _numRunningOperations<=_numWaitingOperations) _condition.broadcast();
     }
-    
-    _operationQueue->add(op);
 }
 
 unsigned int ThreadPool::getNumOperationsRunning() const
@@ -162,32 +361,73 @@ unsigned int ThreadPool::getNumOperationsRunning() const
     return _numRunningOperations;
 }
 
+unsigned int ThreadPool::getNumOperationsQueued() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _numQueuedOperations;
+}
+
 void ThreadPool::waitForCompletion()
 {
-    _blockOp->reset();
+    int currentWorker = getCurrentWorker();
+    if (currentWorker>=0)
+    {
+        // a pool thread that just slept would deadlock, as its own operation is one of those running, and the queued
+        // operations may be waiting on it, so run queued operations until only operations that are also waiting remain.
+        Worker* worker = _workers[currentWorker];
+        osg::Object* object = worker->thread->getParent();
+
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            ++_numWaitingOperations;
+        }
 
-    _operationQueue->add(_blockOp.get());
+        for(;;)
+        {
+            osg::ref_ptr<osg::Operation> op;
+            if (takeOperation(currentWorker, op))
+            {
+                runOperation(op.get(), object);
+                continue;
+            }
 
-    // wait till block is complete i.e. the operation queue has been cleared up to the block
-    _blockOp->block();
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            if ((_numQueuedOperations==0 && _numRunningOperations<=_numWaitingOperations) || _done)
+            {
+                --_numWaitingOperations;
+                _condition.broadcast();
+                return;
+            }
+            _condition.wait(&_mutex, 100);
+        }
+    }
 
-    // there can still be operations running though so need to double check.
-    while(getNumOperationsRunning()>0 && !done())
+    // sleep until every queued operation has been taken and run to completion.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    while((_numQueuedOperations>0 || _numRunningOperations>0) && !_done)
     {
-        // log(osg::INFO, "MachinePool::waitForCompletion : Waiting for threads to complete = %d",getNumOperationsRunning());
-        OpenThreads::Thread::YieldCurrentThread();
+        _condition.wait(&_mutex);
     }
-
 }
 
-void ThreadPool::runningOperation(BuildOperation* op)
+ThreadPool::Statistics ThreadPool::getStatistics() const
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-    ++_numRunningOperations;
+
+    Statistics statistics = _statistics;
+    statistics.queueDepth = _numQueuedOperations;
+
+    double elapsedTime = osg::Timer::instance()->delta_s(_startTick, osg::Timer::instance()->tick());
+    statistics.idleTime = osg::maximum(0.0, elapsedTime*double(_threads.size()) - statistics.busyTime);
+
+    return statistics;
 }
 
-void ThreadPool::completedOperation(BuildOperation* op)
+void ThreadPool::reportStatistics(const std::string& name) const
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-    --_numRunningOperations;
+    Statistics statistics = getStatistics();
+
+    log(osg::NOTICE,"%s thread pool: operations=%u stolen=%u queue depth=%u (max %u) producer waits=%u (%.2fs) thread busy=%.2fs idle=%.2fs",
+        name.c_str(), statistics.numOperations, statistics.numStolen, statistics.queueDepth, statistics.maxQueueDepth,
+        statistics.numProducerWaits, statistics.producerWaitTime, statistics.busyTime, statistics.idleTime);
 }